@@ -0,0 +1,127 @@
+// DirectorySync.cpp
+#include "DirectorySync.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // fsync, or syncfs for the whole filesystem; false with errno set on failure
+    bool SyncOne(const fs::path &dir, bool wholeFilesystem)
+    {
+#if defined(_WIN32)
+        // Directory entries cannot be flushed on their own here
+        (void)dir;
+        (void)wholeFilesystem;
+        return true;
+#else
+        const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+#if defined(__linux__)
+        const int rc = wholeFilesystem ? ::syncfs(fd) : ::fsync(fd);
+#else
+        (void)wholeFilesystem;
+        const int rc = ::fsync(fd);
+#endif
+        const int error = errno;
+        ::close(fd);
+        errno = error;
+        return rc == 0;
+#endif
+    }
+}
+
+bool DirectorySync::Sync(const std::vector<fs::path> &dirs, bool useSyncfs, Stats &out, std::string &outError)
+{
+    out = Stats();
+    const auto start = std::chrono::steady_clock::now();
+
+    // Distinct directories, grouped by filesystem
+    std::set<std::string> seen;
+    std::map<uint64_t, std::vector<fs::path>> byDevice;
+    for (const fs::path &dir : dirs)
+    {
+        const fs::path normal = (dir.empty() ? fs::path(".") : dir).lexically_normal();
+        if (!seen.insert(normal.string()).second)
+            continue;
+        uint64_t device = 0;
+#if !defined(_WIN32)
+        struct stat st;
+        if (::stat(normal.c_str(), &st) == 0)
+            device = static_cast<uint64_t>(st.st_dev);
+#endif
+        byDevice[device].push_back(normal);
+    }
+
+    struct Task
+    {
+        fs::path dir;
+        bool wholeFilesystem = false;
+    };
+    std::vector<Task> tasks;
+    for (auto &entry : byDevice)
+    {
+#if defined(__linux__)
+        if (useSyncfs && entry.second.size() >= SYNCFS_THRESHOLD)
+        {
+            tasks.push_back({entry.second.front(), true});
+            continue;
+        }
+#endif
+        for (fs::path &dir : entry.second)
+            tasks.push_back({std::move(dir), false});
+    }
+
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> directories{0};
+    std::atomic<size_t> filesystems{0};
+    std::atomic<size_t> failed{0};
+    std::mutex errorMutex;
+    auto work = [&]()
+    {
+        for (size_t i = next.fetch_add(1); i < tasks.size(); i = next.fetch_add(1))
+        {
+            const Task &task = tasks[i];
+            if (SyncOne(task.dir, task.wholeFilesystem))
+            {
+                (task.wholeFilesystem ? filesystems : directories).fetch_add(1);
+                continue;
+            }
+            const std::string reason = std::strerror(errno);
+            failed.fetch_add(1);
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (outError.empty())
+                outError = std::string("cannot ") + (task.wholeFilesystem ? "syncfs " : "sync ") + task.dir.string() + ": " + reason;
+        }
+    };
+
+    outError.clear();
+    const size_t workers = std::min<size_t>(tasks.size(), WORKERS);
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < workers; ++t)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    out.directories = directories;
+    out.filesystems = filesystems;
+    out.failed = failed;
+    out.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return out.failed == 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * How durable a move job is when it reports done (per job, see FileManager::SetDurability).
+ */
+enum class Durability : uint8_t
+{
+    Default = 0,  // copies are fsynced (file and directory); renames and links are left to the filesystem
+    Batched,      // plus every touched source and destination directory, fsynced once when the job commits
+    BatchedSyncfs // the same, with one syncfs() for a filesystem where the job touched many directories
+};
+
+/**
+ * DirectorySync
+ * --------------
+ * Makes the entries of a set of directories durable in one pass: each directory is fsynced
+ * once, however many files a job renamed into or out of it, from parallel workers (a
+ * directory fsync mostly waits on the device's cache flush, and flushes overlap).
+ *
+ * With useSyncfs, a filesystem with at least SYNCFS_THRESHOLD directories in the set gets a
+ * single syncfs() instead (Linux only). That flushes everything dirty on it, other writers'
+ * data included, so it only pays off once the job touched many directories there.
+ */
+class DirectorySync
+{
+public:
+    static constexpr size_t SYNCFS_THRESHOLD = 64; // directories per filesystem
+    static constexpr unsigned WORKERS = 8;         // parallel fsyncs at most
+
+    struct Stats
+    {
+        size_t directories = 0; // fsynced one by one
+        size_t filesystems = 0; // synced as a whole (syncfs)
+        size_t failed = 0;      // directories or filesystems that could not be synced
+        double seconds = 0.0;
+    };
+
+    /**
+     * Sync every directory in dirs (duplicates are synced once). Returns false if anything
+     * failed; outError names the first failure.
+     */
+    static bool Sync(const std::vector<std::filesystem::path> &dirs, bool useSyncfs, Stats &out, std::string &outError);
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * FileBitmap
+ * -----------
+ * Dense bitset over file IDs (or indices); one bit per file slot.
+ *
+ * Used for selections and bulk tag operations so a batch over N files
+ * costs N/64 word operations instead of N vector inserts / lookups.
+ */
+class FileBitmap
+{
+public:
+    FileBitmap() = default;
+    explicit FileBitmap(size_t bitCount) { Resize(bitCount); }
+
+    // ------------------ Size ------------------
+
+    size_t Size() const { return m_bitCount; }
+
+    /**
+     * Grow or shrink the bitmap. New bits are cleared.
+     */
+    void Resize(size_t bitCount)
+    {
+        m_bitCount = bitCount;
+        m_words.resize((bitCount + 63) / 64, 0);
+        ClearTail();
+    }
+
+    // ------------------ Bit access ------------------
+
+    void Set(size_t index)
+    {
+        if (index >= m_bitCount)
+            Resize(index + 1);
+        m_words[index >> 6] |= (uint64_t(1) << (index & 63));
+    }
+
+    void Reset(size_t index)
+    {
+        if (index < m_bitCount)
+            m_words[index >> 6] &= ~(uint64_t(1) << (index & 63));
+    }
+
+    bool Test(size_t index) const
+    {
+        if (index >= m_bitCount)
+            return false;
+        return (m_words[index >> 6] >> (index & 63)) & 1;
+    }
+
+    /**
+     * Set every bit in [0, Size()).
+     */
+    void SetAll()
+    {
+        for (auto &w : m_words)
+            w = ~uint64_t(0);
+        ClearTail();
+    }
+
+    void ClearAll()
+    {
+        for (auto &w : m_words)
+            w = 0;
+    }
+
+    // ------------------ Set algebra ------------------
+
+    FileBitmap &operator|=(const FileBitmap &other)
+    {
+        if (other.m_bitCount > m_bitCount)
+            Resize(other.m_bitCount);
+        for (size_t i = 0; i < other.m_words.size(); ++i)
+            m_words[i] |= other.m_words[i];
+        return *this;
+    }
+
+    FileBitmap &operator&=(const FileBitmap &other)
+    {
+        for (size_t i = 0; i < m_words.size(); ++i)
+            m_words[i] &= (i < other.m_words.size()) ? other.m_words[i] : 0;
+        return *this;
+    }
+
+    /**
+     * Clear every bit that is set in other (this &= ~other).
+     */
+    FileBitmap &AndNot(const FileBitmap &other)
+    {
+        const size_t n = m_words.size() < other.m_words.size() ? m_words.size() : other.m_words.size();
+        for (size_t i = 0; i < n; ++i)
+            m_words[i] &= ~other.m_words[i];
+        return *this;
+    }
+
+    // ------------------ Queries ------------------
+
+    size_t Count() const
+    {
+        size_t n = 0;
+        for (uint64_t w : m_words)
+            n += PopCount(w);
+        return n;
+    }
+
+    bool None() const
+    {
+        for (uint64_t w : m_words)
+            if (w)
+                return false;
+        return true;
+    }
+
+    bool Intersects(const FileBitmap &other) const
+    {
+        const size_t n = m_words.size() < other.m_words.size() ? m_words.size() : other.m_words.size();
+        for (size_t i = 0; i < n; ++i)
+            if (m_words[i] & other.m_words[i])
+                return true;
+        return false;
+    }
+
+    /**
+     * Invoke fn(index) for every set bit, in ascending order.
+     */
+    template <typename Fn>
+    void ForEach(Fn &&fn) const
+    {
+        for (size_t wi = 0; wi < m_words.size(); ++wi)
+        {
+            uint64_t w = m_words[wi];
+            while (w)
+            {
+                const size_t bit = CountTrailingZeros(w);
+                fn(wi * 64 + bit);
+                w &= w - 1;
+            }
+        }
+    }
+
+    const std::vector<uint64_t> &Words() const { return m_words; }
+
+private:
+    std::vector<uint64_t> m_words;
+    size_t m_bitCount = 0;
+
+    void ClearTail()
+    {
+        const size_t rem = m_bitCount & 63;
+        if (rem && !m_words.empty())
+            m_words.back() &= (uint64_t(1) << rem) - 1;
+    }
+
+    static size_t PopCount(uint64_t w)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(__builtin_popcountll(w));
+#else
+        size_t n = 0;
+        for (; w; w &= w - 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    static size_t CountTrailingZeros(uint64_t w)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<size_t>(__builtin_ctzll(w));
+#else
+        size_t n = 0;
+        while (!(w & 1))
+        {
+            w >>= 1;
+            ++n;
+        }
+        return n;
+#endif
+    }
+};
@@ -0,0 +1,677 @@
+// FileCopier.cpp
+#include "FileCopier.h"
+#include "FileFingerprint.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/xattr.h>
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+#if !defined(_WIN32)
+    std::string ErrnoText(const char *what, const fs::path &path)
+    {
+        return std::string(what) + " " + path.string() + ": " + std::strerror(errno);
+    }
+
+    class Fd
+    {
+    public:
+        explicit Fd(int fd) : m_fd(fd) {}
+        ~Fd()
+        {
+            if (m_fd >= 0)
+                ::close(m_fd);
+        }
+        Fd(const Fd &) = delete;
+        Fd &operator=(const Fd &) = delete;
+
+        int Get() const { return m_fd; }
+        bool Close()
+        {
+            const int fd = m_fd;
+            m_fd = -1;
+            return ::close(fd) == 0;
+        }
+
+    private:
+        int m_fd;
+    };
+
+    bool SyncDirectory(const fs::path &dir)
+    {
+        Fd fd(::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+        return fd.Get() >= 0 && ::fsync(fd.Get()) == 0;
+    }
+
+    struct Extent
+    {
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+
+    // Data regions of a file, holes skipped. Filesystems without hole tracking
+    // report one region covering the whole file.
+    bool ListDataExtents(int fd, uint64_t size, std::vector<Extent> &out)
+    {
+        out.clear();
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        uint64_t pos = 0;
+        while (pos < size)
+        {
+            const off_t data = ::lseek(fd, static_cast<off_t>(pos), SEEK_DATA);
+            if (data < 0)
+                return errno == ENXIO; // ENXIO: only a hole is left
+            if (static_cast<uint64_t>(data) >= size)
+                break;
+            const off_t hole = ::lseek(fd, data, SEEK_HOLE);
+            if (hole < 0)
+                return false;
+            const uint64_t end = std::min(static_cast<uint64_t>(hole), size);
+            out.push_back({static_cast<uint64_t>(data), end - static_cast<uint64_t>(data)});
+            pos = end;
+        }
+        return true;
+#else
+        (void)fd;
+        if (size > 0)
+            out.push_back({0, size});
+        return true;
+#endif
+    }
+
+    // Reserve the data regions up front, so the copy is laid out contiguously and a full
+    // disk fails before anything is written. Only "no space" is an error.
+    bool Preallocate(int fd, const std::vector<Extent> &extents)
+    {
+#if defined(__linux__)
+        for (const Extent &extent : extents)
+        {
+            if (::fallocate(fd, 0, static_cast<off_t>(extent.offset), static_cast<off_t>(extent.length)) != 0)
+                return errno != ENOSPC && errno != EDQUOT;
+        }
+#else
+        (void)fd;
+        (void)extents;
+#endif
+        return true;
+    }
+
+    // Copies byte ranges to the same offsets, with the cheapest mechanism that works.
+    // Falls back to the next mechanism only while nothing has been copied, so a
+    // partial copy is never resumed by another.
+    class RangeCopier
+    {
+    public:
+        RangeCopier(int in, int out, const FileCopyOptions &options, FileCopier::Result &result)
+            : m_in(in), m_out(out), m_options(options), m_result(result)
+        {
+#if defined(__linux__)
+            m_result.method = FileCopier::Method::CopyFileRange;
+#else
+            m_result.method = FileCopier::Method::Buffered;
+#endif
+        }
+
+        bool Copy(const Extent &extent)
+        {
+            uint64_t done = 0;
+            while (done < extent.length)
+            {
+                const uint64_t offset = extent.offset + done;
+                const uint64_t chunk = m_options.chunkBytes ? m_options.chunkBytes : FileCopier::CHUNK_BYTES;
+                const size_t want = static_cast<size_t>(std::min<uint64_t>(extent.length - done, chunk));
+                if (m_options.beforeChunk && !m_options.beforeChunk(want))
+                {
+                    errno = ECANCELED;
+                    return false;
+                }
+                const ssize_t n = Chunk(offset, want);
+                if (n > 0)
+                {
+                    done += static_cast<uint64_t>(n);
+                    m_result.bytes += static_cast<uint64_t>(n);
+                    continue;
+                }
+                if (n < 0 && errno == EINTR)
+                    continue;
+                // Some filesystems report 0 instead of an error when they cannot copy
+                if (m_result.bytes == 0 && (n == 0 || Unsupported(errno)) && Downgrade())
+                    continue;
+                return n == 0; // 0: the source shrank; verification reports it
+            }
+            return true;
+        }
+
+    private:
+        int m_in;
+        int m_out;
+        const FileCopyOptions &m_options;
+        FileCopier::Result &m_result;
+        std::vector<char> m_buffer;
+
+        ssize_t Chunk(uint64_t offset, size_t want)
+        {
+            switch (m_result.method)
+            {
+#if defined(__linux__)
+            case FileCopier::Method::CopyFileRange:
+            {
+                loff_t inOffset = static_cast<loff_t>(offset);
+                loff_t outOffset = inOffset;
+                return ::copy_file_range(m_in, &inOffset, m_out, &outOffset, want, 0);
+            }
+            case FileCopier::Method::SendFile:
+            {
+                off_t inOffset = static_cast<off_t>(offset);
+                if (::lseek(m_out, inOffset, SEEK_SET) < 0)
+                    return -1;
+                return ::sendfile(m_out, m_in, &inOffset, want);
+            }
+#endif
+            default:
+                return Buffered(offset, want);
+            }
+        }
+
+        ssize_t Buffered(uint64_t offset, size_t want)
+        {
+            m_buffer.resize(FileCopier::BUFFER_BYTES);
+            const ssize_t n = ::pread(m_in, m_buffer.data(), std::min(want, m_buffer.size()), static_cast<off_t>(offset));
+            if (n <= 0)
+                return n;
+            for (ssize_t written = 0; written < n;)
+            {
+                const ssize_t w = ::pwrite(m_out, m_buffer.data() + written, static_cast<size_t>(n - written),
+                                           static_cast<off_t>(offset) + written);
+                if (w < 0 && errno != EINTR)
+                    return -1;
+                if (w > 0)
+                    written += w;
+            }
+            return n;
+        }
+
+        bool Unsupported(int error) const
+        {
+            return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP;
+        }
+
+        bool Downgrade()
+        {
+            switch (m_result.method)
+            {
+            case FileCopier::Method::CopyFileRange:
+                m_result.method = FileCopier::Method::SendFile;
+                return true;
+            case FileCopier::Method::SendFile:
+                m_result.method = FileCopier::Method::Buffered;
+                return true;
+            default:
+                return false;
+            }
+        }
+    };
+
+    // out is empty. Everything but a reflink goes extent by extent: one extent for a
+    // dense file, only the data regions of a sparse one (the holes stay holes).
+    bool CopyData(int in, int out, const struct stat &st, const FileCopyOptions &options, FileCopier::Result &result)
+    {
+        const uint64_t size = static_cast<uint64_t>(st.st_size);
+        result.logicalBytes = size;
+        result.bytes = 0;
+#if defined(__linux__)
+        if (::ioctl(out, FICLONE, in) == 0)
+        {
+            result.method = FileCopier::Method::Reflink;
+            return true;
+        }
+#endif
+        if (options.reflinkOnly)
+        {
+#if !defined(__linux__)
+            errno = EOPNOTSUPP;
+#endif
+            return false;
+        }
+
+        std::vector<Extent> extents;
+        const bool hasHoles = static_cast<uint64_t>(st.st_blocks) * 512 < size;
+        if (options.sparse && hasHoles && ListDataExtents(in, size, extents))
+        {
+            result.sparse = true;
+        }
+        else
+        {
+            extents.clear();
+            if (size > 0)
+                extents.push_back({0, size});
+        }
+
+        if (options.preallocate && !Preallocate(out, extents))
+            return false;
+
+        RangeCopier copier(in, out, options, result);
+        for (const Extent &extent : extents)
+        {
+            if (!copier.Copy(extent))
+                return false;
+        }
+        // Sets the size past a trailing hole (and trims preallocation if the source shrank)
+        return ::ftruncate(out, static_cast<off_t>(size)) == 0;
+    }
+
+    // Best effort: a destination filesystem without xattr support only loses the attributes
+    void CopyXattrs(int in, int out)
+    {
+#if defined(__linux__)
+        const ssize_t listSize = ::flistxattr(in, nullptr, 0);
+        if (listSize <= 0)
+            return;
+        std::vector<char> names(static_cast<size_t>(listSize));
+        const ssize_t got = ::flistxattr(in, names.data(), names.size());
+        if (got <= 0)
+            return;
+
+        std::vector<char> value;
+        for (size_t pos = 0; pos < static_cast<size_t>(got); pos += std::strlen(names.data() + pos) + 1)
+        {
+            const char *name = names.data() + pos;
+            const ssize_t valueSize = ::fgetxattr(in, name, nullptr, 0);
+            if (valueSize < 0)
+                continue;
+            value.resize(static_cast<size_t>(valueSize));
+            const ssize_t read = ::fgetxattr(in, name, value.data(), value.size());
+            if (read >= 0)
+                ::fsetxattr(out, name, value.data(), static_cast<size_t>(read), 0);
+        }
+#else
+        (void)in;
+        (void)out;
+#endif
+    }
+
+    bool CopySymlink(const fs::path &source, const fs::path &destination, const struct stat &st,
+                     FileCopier::Result &out, std::string &outError)
+    {
+        std::vector<char> target(static_cast<size_t>(st.st_size > 0 ? st.st_size : PATH_MAX) + 1);
+        const ssize_t n = ::readlink(source.c_str(), target.data(), target.size() - 1);
+        if (n < 0)
+        {
+            outError = ErrnoText("cannot read link", source);
+            return false;
+        }
+        target[static_cast<size_t>(n)] = '\0';
+        if (::symlink(target.data(), destination.c_str()) != 0)
+        {
+            outError = ErrnoText("cannot create link", destination);
+            return false;
+        }
+
+        // Best effort: the link itself is intact either way
+        ::lchown(destination.c_str(), st.st_uid, st.st_gid);
+        const struct timespec times[2] = {st.st_atim, st.st_mtim};
+        ::utimensat(AT_FDCWD, destination.c_str(), times, AT_SYMLINK_NOFOLLOW);
+
+        out.method = FileCopier::Method::Symlink;
+        out.bytes = 0;
+        return true;
+    }
+#endif
+}
+
+bool FileCopier::Copy(const fs::path &source, const fs::path &destination, Result &out, std::string &outError,
+                      const FileCopyOptions &options)
+{
+    out = Result();
+#if defined(_WIN32)
+    std::error_code ec;
+    if (options.reflinkOnly)
+    {
+        outError = "cannot clone " + source.string() + ": not supported on this platform";
+        return false;
+    }
+    if (options.beforeChunk && !options.beforeChunk(fs::file_size(source, ec)))
+    {
+        outError = "copy of " + source.string() + " cancelled";
+        return false;
+    }
+    if (!fs::copy_file(source, destination, fs::copy_options::none, ec))
+    {
+        outError = "cannot copy " + source.string() + " -> " + destination.string() + ": " + ec.message();
+        return false;
+    }
+    fs::last_write_time(destination, fs::last_write_time(source, ec), ec);
+    out.method = Method::Buffered;
+    out.bytes = out.logicalBytes = fs::file_size(destination, ec);
+    if (ec || out.bytes != fs::file_size(source, ec) || !SameContent(source, destination))
+    {
+        outError = "copy of " + source.string() + " does not match the source";
+        fs::remove(destination, ec);
+        return false;
+    }
+    return true;
+#else
+    struct stat st;
+    if (::lstat(source.c_str(), &st) != 0)
+    {
+        outError = ErrnoText("cannot stat", source);
+        return false;
+    }
+    if (S_ISLNK(st.st_mode))
+        return CopySymlink(source, destination, st, out, outError);
+    if (!S_ISREG(st.st_mode))
+    {
+        outError = "not a regular file: " + source.string();
+        return false;
+    }
+
+    Fd in(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+    if (in.Get() < 0)
+    {
+        outError = ErrnoText("cannot open", source);
+        return false;
+    }
+    Fd dst(::open(destination.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+    if (dst.Get() < 0)
+    {
+        outError = ErrnoText("cannot create", destination);
+        return false;
+    }
+
+    auto fail = [&](const std::string &error)
+    {
+        outError = error;
+        ::unlink(destination.c_str());
+        return false;
+    };
+
+    if (!CopyData(in.Get(), dst.Get(), st, options, out))
+        return fail(ErrnoText("cannot copy data to", destination));
+
+    // Owner before mode: chown clears setuid / setgid bits
+    if (::fchown(dst.Get(), st.st_uid, st.st_gid) != 0 && errno != EPERM)
+        return fail(ErrnoText("cannot set owner of", destination));
+    if (::fchmod(dst.Get(), st.st_mode & 07777) != 0)
+        return fail(ErrnoText("cannot set mode of", destination));
+    CopyXattrs(in.Get(), dst.Get());
+    const struct timespec times[2] = {st.st_atim, st.st_mtim};
+    if (::futimens(dst.Get(), times) != 0)
+        return fail(ErrnoText("cannot set times of", destination));
+
+    if (::fsync(dst.Get()) != 0)
+        return fail(ErrnoText("cannot sync", destination));
+    struct stat copied;
+    if (::fstat(dst.Get(), &copied) != 0 || copied.st_size != st.st_size)
+        return fail("copy of " + source.string() + " has the wrong size");
+    if (!dst.Close())
+        return fail(ErrnoText("cannot close", destination));
+    if (!SameContent(source, destination))
+        return fail("copy of " + source.string() + " does not match the source");
+    return true;
+#endif
+}
+
+bool FileCopier::Place(const fs::path &source, const fs::path &requested, Result &out, std::string &outError,
+                       const FileCopyOptions &options, const ConflictHandler &onConflict, fs::path *outDestination)
+{
+    const fs::path temporary = TemporaryPath(requested);
+    std::error_code ec;
+    fs::remove(temporary, ec); // leftover of an interrupted move
+
+    if (!Copy(source, temporary, out, outError, options))
+        return false;
+
+    // The copy is done once; a taken name only costs another rename attempt
+    fs::path destination = requested;
+    RenameNoReplace(temporary, destination, ec);
+    while (ec == std::errc::file_exists && onConflict && onConflict(destination))
+        RenameNoReplace(temporary, destination, ec);
+    if (ec)
+    {
+        outError = "cannot rename " + temporary.string() + " -> " + destination.string() + ": " + ec.message();
+        fs::remove(temporary, ec);
+        return false;
+    }
+
+#if !defined(_WIN32)
+    // The new entry must be durable before the only other copy can go away
+    if (!SyncDirectory(destination.parent_path()))
+    {
+        outError = ErrnoText("cannot sync", destination.parent_path());
+        fs::remove(destination, ec);
+        return false;
+    }
+#endif
+    if (outDestination)
+        *outDestination = destination;
+    return true;
+}
+
+bool FileCopier::Move(const fs::path &source, const fs::path &requested, Result &out, std::string &outError,
+                      const FileCopyOptions &options, const ConflictHandler &onConflict)
+{
+    fs::path destination;
+    if (!Place(source, requested, out, outError, options, onConflict, &destination))
+        return false;
+
+    std::error_code ec;
+    fs::remove(source, ec);
+    if (ec)
+    {
+        outError = "cannot remove " + source.string() + " after copying: " + ec.message();
+        fs::remove(destination, ec);
+        return false;
+    }
+    return true;
+}
+
+#if !defined(_WIN32)
+void FileCopier::RenameNoReplace(int fromDir, const char *from, int toDir, const char *to, std::error_code &ec)
+{
+    ec.clear();
+#if defined(__linux__) && defined(SYS_renameat2) && defined(RENAME_NOREPLACE)
+    if (::syscall(SYS_renameat2, fromDir, from, toDir, to, RENAME_NOREPLACE) == 0)
+        return;
+    // Old kernels and some filesystems (e.g. NFS) do not know the flag
+    if (errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+    {
+        ec.assign(errno, std::generic_category());
+        return;
+    }
+#endif
+
+    if (::linkat(fromDir, from, toDir, to, 0) == 0)
+    {
+        if (::unlinkat(fromDir, from, 0) != 0)
+        {
+            ec.assign(errno, std::generic_category());
+            ::unlinkat(toDir, to, 0);
+        }
+        return;
+    }
+    if (errno != EPERM && errno != EOPNOTSUPP && errno != EMLINK)
+    {
+        ec.assign(errno, std::generic_category());
+        return;
+    }
+
+    // No hard links here (e.g. FAT): check, then rename
+    struct stat st;
+    if (::fstatat(toDir, to, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        ec = std::make_error_code(std::errc::file_exists);
+    else if (errno != ENOENT)
+        ec.assign(errno, std::generic_category());
+    else if (::renameat(fromDir, from, toDir, to) != 0)
+        ec.assign(errno, std::generic_category());
+}
+#endif
+
+void FileCopier::RenameNoReplace(const fs::path &from, const fs::path &to, std::error_code &ec)
+{
+#if defined(_WIN32)
+    ec.clear();
+    fs::create_hard_link(from, to, ec);
+    if (!ec)
+    {
+        fs::remove(from, ec);
+        if (ec)
+        {
+            std::error_code ignored;
+            fs::remove(to, ignored);
+        }
+        return;
+    }
+    if (ec == std::errc::file_exists)
+        return;
+
+    // No hard links here (e.g. FAT): check, then rename
+    if (fs::exists(fs::symlink_status(to, ec)))
+    {
+        ec = std::make_error_code(std::errc::file_exists);
+        return;
+    }
+    fs::rename(from, to, ec);
+#else
+    RenameNoReplace(AT_FDCWD, from.c_str(), AT_FDCWD, to.c_str(), ec);
+#endif
+}
+
+void FileCopier::ReplaceWithLink(const fs::path &target, const fs::path &path, std::error_code &ec)
+{
+    const fs::path staged = TemporaryPath(path);
+    fs::remove(staged, ec);
+    fs::create_hard_link(target, staged, ec);
+    if (ec)
+        return;
+    fs::rename(staged, path, ec);
+    if (ec)
+    {
+        std::error_code ignored;
+        fs::remove(staged, ignored);
+    }
+}
+
+fs::path FileCopier::TemporaryPath(const fs::path &destination)
+{
+    return destination.parent_path() / ("." + destination.filename().string() + ".fsort-part");
+}
+
+// A full re-read would double the I/O of every copy
+bool FileCopier::SameContent(const fs::path &a, const fs::path &b)
+{
+    FingerprintCache cache;
+    FileFingerprint fa, fb;
+    return cache.GetSample(a, fa) && cache.GetSample(b, fb) && fa.SameSample(fb);
+}
+
+namespace
+{
+    // What a file is at one moment; any write or replacement in between changes it
+    struct FileState
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+
+        bool operator==(const FileState &other) const
+        {
+            return device == other.device && inode == other.inode && size == other.size && mtime == other.mtime;
+        }
+    };
+
+    bool GetFileState(const fs::path &path, FileState &out)
+    {
+        std::error_code ec;
+        if (!fs::is_regular_file(fs::symlink_status(path, ec)))
+            return false;
+        out.size = fs::file_size(path, ec);
+        if (ec)
+            return false;
+        out.mtime = static_cast<int64_t>(fs::last_write_time(path, ec).time_since_epoch().count());
+        if (ec)
+            return false;
+#if !defined(_WIN32)
+        struct stat st;
+        if (::lstat(path.c_str(), &st) != 0)
+            return false;
+        out.device = static_cast<uint64_t>(st.st_dev);
+        out.inode = static_cast<uint64_t>(st.st_ino);
+#endif
+        return true;
+    }
+
+    bool SameBytes(const fs::path &a, const fs::path &b)
+    {
+        std::ifstream ia(a, std::ios::binary);
+        std::ifstream ib(b, std::ios::binary);
+        if (!ia.is_open() || !ib.is_open())
+            return false;
+        std::vector<char> bufferA(FileCopier::BUFFER_BYTES);
+        std::vector<char> bufferB(FileCopier::BUFFER_BYTES);
+        while (true)
+        {
+            ia.read(bufferA.data(), static_cast<std::streamsize>(bufferA.size()));
+            ib.read(bufferB.data(), static_cast<std::streamsize>(bufferB.size()));
+            const std::streamsize n = ia.gcount();
+            if (n != ib.gcount() || ia.bad() || ib.bad())
+                return false;
+            if (n == 0)
+                return ia.eof() && ib.eof();
+            if (std::memcmp(bufferA.data(), bufferB.data(), static_cast<size_t>(n)) != 0)
+                return false;
+        }
+    }
+}
+
+bool FileCopier::Identical(const fs::path &a, const fs::path &b)
+{
+    FileState beforeA, beforeB, afterA, afterB;
+    if (!GetFileState(a, beforeA) || !GetFileState(b, beforeB) || beforeA.size != beforeB.size)
+        return false;
+    if (!SameBytes(a, b))
+        return false;
+    return GetFileState(a, afterA) && GetFileState(b, afterB) && afterA == beforeA && afterB == beforeB;
+}
+
+const char *FileCopier::MethodName(Method method)
+{
+    switch (method)
+    {
+    case Method::Reflink:
+        return "reflink";
+    case Method::CopyFileRange:
+        return "copy_file_range";
+    case Method::SendFile:
+        return "sendfile";
+    case Method::Buffered:
+        return "buffered";
+    case Method::Symlink:
+        return "symlink";
+    default:
+        return "none";
+    }
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+
+/**
+ * How FileCopier lays out the data of a copy.
+ */
+struct FileCopyOptions
+{
+    bool sparse = true;      // copy only the data regions of a file with holes (SEEK_DATA / SEEK_HOLE)
+    bool preallocate = true; // fallocate the data regions before writing them
+    bool reflinkOnly = false; // clone or fail (EOPNOTSUPP etc.), never copy the data
+    size_t chunkBytes = 0;   // bytes per copy call, 0 = FileCopier::CHUNK_BYTES
+
+    // Called before each chunk is copied, with its size; may block (rate limits).
+    // Returning false abandons the copy (ECANCELED).
+    std::function<bool(uint64_t bytes)> beforeChunk;
+};
+
+/**
+ * FileCopier
+ * -----------
+ * Moves a file across filesystems, where rename() fails with EXDEV.
+ *
+ * Data is copied by the cheapest mechanism the kernel accepts, in this order:
+ *   reflink (FICLONE: shared extents, no data copied at all)
+ *   copy_file_range (in-kernel, or server-side on network filesystems)
+ *   sendfile (in-kernel)
+ *   read / write through a user-space buffer
+ * Each step is only tried while nothing has been copied yet.
+ *
+ * A sparse source (fewer blocks allocated than its size) is copied region by region, so
+ * its holes stay holes instead of turning into written zeros. The destination's data
+ * regions are preallocated first: the copy is laid out contiguously, and a destination
+ * without room fails before any data is written.
+ *
+ * The copy keeps mode, owner (when permitted), timestamps and extended attributes, is
+ * fsynced and checked against the source (size and sampled content) before it is
+ * renamed into place; only then is the source unlinked.
+ */
+class FileCopier
+{
+public:
+    static constexpr size_t CHUNK_BYTES = 64ull * 1024 * 1024; // per in-kernel copy call
+    static constexpr size_t BUFFER_BYTES = 1024 * 1024;        // buffered fallback
+
+    enum class Method : uint8_t
+    {
+        None = 0,
+        Reflink,
+        CopyFileRange,
+        SendFile,
+        Buffered,
+        Symlink // link recreated, no data
+    };
+
+    struct Result
+    {
+        Method method = Method::None;
+        bool sparse = false;       // holes were skipped
+        uint64_t logicalBytes = 0; // file size
+        uint64_t bytes = 0;        // data bytes actually copied (0 for a reflink: extents are shared)
+    };
+
+    /**
+     * Copy source (regular file or symlink) to destination, which must not exist.
+     * On failure nothing is left at destination.
+     */
+    static bool Copy(const std::filesystem::path &source, const std::filesystem::path &destination,
+                     Result &out, std::string &outError, const FileCopyOptions &options = FileCopyOptions());
+
+    /**
+     * Called when the destination name is taken: set a new destination and return true to
+     * retry under it, or return false to give up.
+     */
+    using ConflictHandler = std::function<bool(std::filesystem::path &destination)>;
+
+    /**
+     * Copy to a temporary name next to destination, rename it into place (never replacing
+     * an existing file) and sync the directory; source is left alone. A taken destination
+     * name goes to onConflict, or fails without one. On failure nothing is left behind.
+     * outDestination (if given) receives the name the copy ended up under.
+     */
+    static bool Place(const std::filesystem::path &source, const std::filesystem::path &destination,
+                      Result &out, std::string &outError, const FileCopyOptions &options = FileCopyOptions(),
+                      const ConflictHandler &onConflict = nullptr, std::filesystem::path *outDestination = nullptr);
+
+    /**
+     * Place(), then unlink source. On failure the source is untouched and the copy removed.
+     */
+    static bool Move(const std::filesystem::path &source, const std::filesystem::path &destination,
+                     Result &out, std::string &outError, const FileCopyOptions &options = FileCopyOptions(),
+                     const ConflictHandler &onConflict = nullptr);
+
+    /**
+     * rename() that fails with EEXIST (errc::file_exists) instead of replacing an existing
+     * entry: renameat2(RENAME_NOREPLACE) where the filesystem supports it, else link +
+     * unlink (link() never replaces either). Filesystems without hard links get a checked
+     * rename, the only fallback that is not atomic.
+     */
+    static void RenameNoReplace(const std::filesystem::path &from, const std::filesystem::path &to, std::error_code &ec);
+
+#if !defined(_WIN32)
+    /**
+     * The same, with names relative to directory handles (AT_FDCWD for the working directory).
+     */
+    static void RenameNoReplace(int fromDir, const char *from, int toDir, const char *to, std::error_code &ec);
+#endif
+
+    /**
+     * Make path a second name of target (a hard link), replacing what path was. The link is
+     * made at path's TemporaryPath and renamed over it, so path never goes missing.
+     */
+    static void ReplaceWithLink(const std::filesystem::path &target, const std::filesystem::path &path, std::error_code &ec);
+
+    /**
+     * Where Move() stages the copy for destination (a hidden name in the same directory).
+     */
+    static std::filesystem::path TemporaryPath(const std::filesystem::path &destination);
+
+    /**
+     * Same size and same sampled head / tail (the check a copy must pass).
+     */
+    static bool SameContent(const std::filesystem::path &a, const std::filesystem::path &b);
+
+    /**
+     * Regular files with byte-for-byte the same content, neither of which changed (device,
+     * inode, size, mtime) while they were compared. Reads both in full: the check before a
+     * file is given up for an identical one.
+     */
+    static bool Identical(const std::filesystem::path &a, const std::filesystem::path &b);
+
+    static const char *MethodName(Method method);
+};
@@ -0,0 +1,242 @@
+// FileFingerprint.cpp
+#include "FileFingerprint.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+
+    // Full hashes are streamed through a buffer of this size
+    constexpr size_t FULL_READ_CHUNK = 1024 * 1024;
+
+    uint64_t Mix(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= PRIME_2;
+        h ^= h >> 29;
+        h *= PRIME_1;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // Word-at-a-time hash; not cryptographic, only has to separate distinct contents
+    uint64_t HashBytes(const uint8_t *data, size_t size, uint64_t seed)
+    {
+        uint64_t h = seed ^ (size * PRIME_1);
+        size_t pos = 0;
+        for (; pos + 8 <= size; pos += 8)
+        {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i)
+                word |= uint64_t(data[pos + i]) << (8 * i);
+            h = (h ^ Mix(word)) * PRIME_1;
+        }
+        uint64_t tail = 0;
+        for (int i = 0; pos < size; ++pos, ++i)
+            tail |= uint64_t(data[pos]) << (8 * i);
+        return Mix(h ^ Mix(tail));
+    }
+
+    bool ReadAt(std::ifstream &ifs, uint64_t offset, std::vector<uint8_t> &buffer)
+    {
+        ifs.seekg(static_cast<std::streamoff>(offset));
+        ifs.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        return ifs.gcount() == static_cast<std::streamsize>(buffer.size());
+    }
+}
+
+size_t FingerprintCache::KeyHash::operator()(const Key &key) const
+{
+    uint64_t h = Mix(key.device ^ PRIME_1);
+    h = Mix(h ^ key.inode);
+    h = Mix(h ^ static_cast<uint64_t>(key.mtime));
+    return static_cast<size_t>(Mix(h ^ key.size));
+}
+
+bool FingerprintCache::StatKey(const fs::path &path, Key &outKey)
+{
+    std::error_code ec;
+    const auto mtime = fs::last_write_time(path, ec);
+    if (ec)
+        return false;
+    outKey.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+
+#if !defined(_WIN32)
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    outKey.device = static_cast<uint64_t>(st.st_dev);
+    outKey.inode = static_cast<uint64_t>(st.st_ino);
+    outKey.size = static_cast<uint64_t>(st.st_size);
+#else
+    // No inode here: the path stands in for it
+    if (!fs::is_regular_file(path, ec))
+        return false;
+    outKey.size = fs::file_size(path, ec);
+    if (ec)
+        return false;
+    outKey.inode = std::hash<std::string>()(path.string());
+#endif
+    return true;
+}
+
+bool FingerprintCache::HashSample(const fs::path &path, uint64_t size, uint64_t &outHash)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    // Head, and tail when the file is longer than one sample
+    std::vector<uint8_t> buffer(static_cast<size_t>(size < SAMPLE_BYTES ? size : SAMPLE_BYTES));
+    if (!ReadAt(ifs, 0, buffer))
+        return false;
+    uint64_t h = HashBytes(buffer.data(), buffer.size(), size);
+
+    if (size > SAMPLE_BYTES)
+    {
+        const uint64_t rest = size - SAMPLE_BYTES;
+        buffer.resize(static_cast<size_t>(rest < SAMPLE_BYTES ? rest : SAMPLE_BYTES));
+        if (!ReadAt(ifs, size - buffer.size(), buffer))
+            return false;
+        h = HashBytes(buffer.data(), buffer.size(), h);
+    }
+
+    outHash = h;
+    return true;
+}
+
+bool FingerprintCache::HashFull(const fs::path &path, uint64_t &outHash)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open())
+        return false;
+
+    std::vector<uint8_t> buffer(FULL_READ_CHUNK);
+    uint64_t h = PRIME_2;
+    while (ifs)
+    {
+        ifs.read(reinterpret_cast<char *>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        const std::streamsize n = ifs.gcount();
+        if (n <= 0)
+            break;
+        h = HashBytes(buffer.data(), static_cast<size_t>(n), h);
+    }
+    if (ifs.bad())
+        return false;
+
+    outHash = h ? h : 1; // 0 means "not computed"
+    return true;
+}
+
+bool FingerprintCache::GetSample(const fs::path &path, FileFingerprint &out)
+{
+    Key key;
+    if (!StatKey(path, key))
+        return false;
+
+    auto it = m_cache.find(key);
+    if (it != m_cache.end())
+    {
+        out = it->second;
+        return true;
+    }
+
+    FileFingerprint fp;
+    fp.size = key.size;
+    if (!HashSample(path, key.size, fp.sample))
+        return false;
+
+    m_cache.emplace(key, fp);
+    out = fp;
+    return true;
+}
+
+bool FingerprintCache::GetFull(const fs::path &path, FileFingerprint &out)
+{
+    Key key;
+    if (!StatKey(path, key))
+        return false;
+
+    auto it = m_cache.find(key);
+    FileFingerprint fp = (it != m_cache.end()) ? it->second : FileFingerprint();
+    if (fp.full == 0)
+    {
+        if (it == m_cache.end())
+        {
+            fp.size = key.size;
+            if (!HashSample(path, key.size, fp.sample))
+                return false;
+        }
+        if (!HashFull(path, fp.full))
+            return false;
+        m_cache[key] = fp;
+    }
+    out = fp;
+    return true;
+}
+
+void FingerprintCache::GetFullAll(const std::vector<fs::path> &paths, std::vector<FileFingerprint> &out)
+{
+    out.assign(paths.size(), FileFingerprint());
+    std::vector<Key> keys(paths.size());
+    std::vector<bool> sampled(paths.size(), false);
+    std::vector<size_t> pending; // files still to read in full
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        if (!StatKey(paths[i], keys[i]))
+            continue;
+        auto it = m_cache.find(keys[i]);
+        if (it != m_cache.end())
+        {
+            out[i] = it->second;
+            sampled[i] = true;
+            if (it->second.full != 0)
+                continue;
+        }
+        pending.push_back(i);
+    }
+    if (pending.empty())
+        return;
+
+    // One file per task: the reads are what this waits on, so large and small files interleave
+    std::atomic<size_t> next{0};
+    auto work = [&]()
+    {
+        for (size_t n = next.fetch_add(1); n < pending.size(); n = next.fetch_add(1))
+        {
+            const size_t i = pending[n];
+            FileFingerprint fp = out[i];
+            fp.size = keys[i].size;
+            if ((sampled[i] || HashSample(paths[i], fp.size, fp.sample)) && HashFull(paths[i], fp.full))
+                out[i] = fp;
+            else
+                out[i] = FileFingerprint();
+        }
+    };
+
+    const size_t workers = std::min<size_t>(pending.size(), std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < workers; ++t)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    for (size_t i : pending)
+    {
+        if (out[i].full != 0)
+            m_cache[keys[i]] = out[i];
+    }
+}
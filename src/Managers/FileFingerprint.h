@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Content identity of a regular file.
+ *
+ * size + sample (hash of the first and last SAMPLE_BYTES) is cheap and
+ * tells almost all files apart; the full-content hash is only computed
+ * when two files share a sample.
+ */
+struct FileFingerprint
+{
+    uint64_t size = 0;
+    uint64_t sample = 0;
+    uint64_t full = 0; // 0 = not computed
+
+    bool SameSample(const FileFingerprint &other) const { return size == other.size && sample == other.sample; }
+};
+
+/**
+ * FingerprintCache
+ * -----------------
+ * Computes fingerprints, memoized by (device, inode, mtime, size):
+ * an unchanged file is read once for its sample and at most once more for its full hash.
+ */
+class FingerprintCache
+{
+public:
+    static constexpr size_t SAMPLE_BYTES = 16 * 1024;
+
+    /**
+     * Fill size + sample. Returns false if the file cannot be stat'ed or read.
+     */
+    bool GetSample(const std::filesystem::path &path, FileFingerprint &out);
+
+    /**
+     * Fill size + sample + full hash (reads the whole file unless cached).
+     */
+    bool GetFull(const std::filesystem::path &path, FileFingerprint &out);
+
+    /**
+     * GetFull for many files at once: the full hashes not cached yet are computed on
+     * worker threads. out[i] keeps full == 0 for a file that cannot be read.
+     */
+    void GetFullAll(const std::vector<std::filesystem::path> &paths, std::vector<FileFingerprint> &out);
+
+    void Clear() { m_cache.clear(); }
+
+private:
+    struct Key
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0;
+        int64_t mtime = 0;
+        uint64_t size = 0;
+
+        bool operator==(const Key &other) const
+        {
+            return device == other.device && inode == other.inode && mtime == other.mtime && size == other.size;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    std::unordered_map<Key, FileFingerprint, KeyHash> m_cache;
+
+    static bool StatKey(const std::filesystem::path &path, Key &outKey);
+    static bool HashSample(const std::filesystem::path &path, uint64_t size, uint64_t &outHash);
+    static bool HashFull(const std::filesystem::path &path, uint64_t &outHash);
+};
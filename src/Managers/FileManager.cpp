@@ -1,113 +1,247 @@
 #include "FileManager.h"
-#include "../../include/json/json.hpp"
-#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <unordered_set>
 
-namespace fs = std::filesystem;
+static constexpr const char *MOVE_JOURNAL_FILENAME = "moves.journal";
 
-FileManager::FileManager(TagManager &tagManager, SearchManager &searchManager)
-    : m_tagManager(tagManager), m_searchManager(searchManager)
+FileManager::FileManager(TagManager &tagManager, SearchManager &searchManager, MoveJournal::Recovery recovery)
+    : m_tagManager(tagManager), m_searchManager(searchManager), m_journal(MOVE_JOURNAL_FILENAME)
 {
-}
-
-size_t FileManager::MoveAllTaggedFiles()
-{
-    size_t movedCount = 0;
-    const auto &tagMap = m_tagManager.GetTagMap();
-
-    for (const auto &[tagName, fileIndices] : tagMap)
+    m_journal.Recover(recovery, m_recoveryReport);
+    if (m_recoveryReport.batches > 0)
     {
-        movedCount += MoveFilesByTag(tagName);
+        std::cout << "FileManager: " << m_recoveryReport.batches << " interrupted move batch(es) "
+                  << (recovery == MoveJournal::Recovery::RollForward ? "finished" : "rolled back") << ", "
+                  << m_recoveryReport.repaired << " files repaired, " << m_recoveryReport.problems.size()
+                  << " unresolved\n";
     }
+    m_journal.Open();
+}
 
-    return movedCount;
+MoveJobPtr FileManager::MoveAllTaggedFiles(OrganizeMode mode)
+{
+    return ExecutePlan(PlanAllTaggedFiles(mode));
 }
 
-size_t FileManager::MoveFilesByTag(const std::string &tagName)
+MoveJobPtr FileManager::MoveFilesByTag(const std::string &tagName, OrganizeMode mode)
 {
-    size_t movedCount = 0;
-    const auto &tagMap = m_tagManager.GetTagMap();
-    auto it = tagMap.find(tagName);
-    if (it == tagMap.end())
-        return 0;
+    return ExecutePlan(PlanFilesByTag(tagName, mode));
+}
 
-    // We’ll need destination path from TagManager internals
-    // Adapted since TagManager stores it inside Impl
-    // To keep decoupling, we’ll use GetFilesByTag() instead
-    std::vector<FileData *> files = m_tagManager.GetFilesByTag(tagName);
+MoveJobPtr FileManager::MoveFiles(const FileBitmap &fileIds, const std::string &destination, OrganizeMode mode)
+{
+    return ExecutePlan(PlanFiles(fileIds, destination, mode));
+}
 
-    // Reopen TagManager JSON to fetch destination
-    std::ifstream ifs("tags.json");
-    if (!ifs.is_open())
+MovePlan FileManager::PlanAllTaggedFiles(OrganizeMode mode) const
+{
+    // One consistent view of every tag, even while other threads keep tagging
+    const TagSnapshotPtr tagMap = m_tagManager.GetTagMap();
+
+    // Every tag goes into one plan, so moves to different devices overlap. Moves are
+    // collected first: a file that leaves its source is not also copied or linked
+    // elsewhere, while one that stays can appear under every one of its tags.
+    FileBitmap scheduled;
+    std::vector<MoveRequest> requests;
+    for (bool moves : {true, false})
     {
-        std::cerr << "FileManager: cannot read tags.json.\n";
-        return 0;
+        for (const auto &tag : tagMap->tags)
+        {
+            const OrganizeMode tagMode = tag.organize.value_or(mode);
+            if ((tagMode == OrganizeMode::Move) == moves)
+                CollectRequests(*tag.files, tag.destinationDir, tagMode, scheduled, requests);
+        }
     }
 
-    nlohmann::json j;
-    ifs >> j;
-    ifs.close();
+    return MovePlanner::Plan(requests, m_executor.GetCopyOptions(), m_duplicatePolicy);
+}
 
-    if (!j.contains("tags") || !j["tags"].contains(tagName))
-        return 0;
+MovePlan FileManager::PlanFilesByTag(const std::string &tagName, OrganizeMode mode) const
+{
+    const TagSnapshotPtr tagMap = m_tagManager.GetTagMap();
+    const TagSnapshot::Tag *tag = tagMap->Find(tagName);
+    if (!tag)
+        return MovePlan();
+
+    // Effective destination as of the snapshot (tags.json may lag behind tags.wal)
+    FileBitmap scheduled;
+    std::vector<MoveRequest> requests;
+    CollectRequests(*tag->files, tag->destinationDir, tag->organize.value_or(mode), scheduled, requests);
+    return MovePlanner::Plan(requests, m_executor.GetCopyOptions(), m_duplicatePolicy);
+}
 
-    std::string destination = j["tags"][tagName]["destination"].get<std::string>();
-    EnsureDirectory(destination);
+MovePlan FileManager::PlanFiles(const FileBitmap &fileIds, const std::string &destination, OrganizeMode mode) const
+{
+    FileBitmap scheduled;
+    std::vector<MoveRequest> requests;
+    CollectRequests(fileIds, destination, mode, scheduled, requests);
+    return MovePlanner::Plan(requests, m_executor.GetCopyOptions(), m_duplicatePolicy);
+}
 
-    for (FileData *fd : files)
-    {
+void FileManager::CollectRequests(const FileBitmap &fileIds, const std::filesystem::path &destination, OrganizeMode mode,
+                                  FileBitmap &scheduled, std::vector<MoveRequest> &requests) const
+{
+    if (destination.empty())
+        return;
+
+    fileIds.ForEach([&](size_t fileId)
+                    {
+        if (scheduled.Test(fileId))
+            return;
+        const FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
         if (!fd)
-            continue;
-        if (MoveSingleFile(*fd, destination))
-            movedCount++;
-    }
+            return;
+        if (mode == OrganizeMode::Move)
+            scheduled.Set(fileId);
+        requests.push_back({fileId, fd->path, destination, mode}); });
+}
 
-    return movedCount;
+MoveJobPtr FileManager::ExecutePlan(const MovePlan &plan)
+{
+    return ExecutePlan(plan, m_durability);
 }
 
-bool FileManager::MoveSingleFile(const FileData &file, const std::string &destination)
+MoveJobPtr FileManager::ExecutePlan(const MovePlan &plan, Durability durability)
 {
-    try
-    {
-        fs::path src = file.path;
-        if (!fs::exists(src))
-        {
-            std::cerr << "FileManager: missing source " << src << "\n";
-            return false;
-        }
+    auto job = std::make_shared<MoveJob>(plan);
+    for (const auto &skip : plan.skipped)
+        std::cerr << "FileManager: skipped " << skip.source << ": " << skip.reason << "\n";
 
-        fs::path destDir(destination);
-        EnsureDirectory(destDir);
+    if (plan.operations.empty())
+    {
+        job->Finish();
+        return job;
+    }
 
-        fs::path destFile = destDir / src.filename();
+    // Nothing moves unless its intent is on disk
+    const uint64_t batch = m_journal.BeginBatch(plan.operations);
+    if (batch == 0)
+    {
+        std::cerr << "FileManager: cannot journal the move; nothing was moved\n";
+        for (size_t i = 0; i < plan.operations.size(); ++i)
+            job->FileDone(i, false);
+        job->Finish();
+        return job;
+    }
 
-        // Handle conflict: rename duplicate files
-        if (fs::exists(destFile))
+    // Directories whose entries the job changed, each synced once when it commits
+    struct TouchedDirs
+    {
+        std::mutex mutex;
+        std::unordered_set<std::string> dirs;
+    };
+    auto touched = durability == Durability::Default ? nullptr : std::make_shared<TouchedDirs>();
+
+    MoveExecutor::Callbacks callbacks;
+    callbacks.onProgress = [job](size_t index, uint64_t bytes)
+    { job->AddBytes(index, bytes); };
+    callbacks.onRedirect = [this, batch](size_t index, const std::filesystem::path &destination)
+    { return m_journal.Redirect(batch, index, destination); };
+    callbacks.onFallback = [this, batch](size_t index, MoveStrategy strategy)
+    { return m_journal.Fallback(batch, index, strategy); };
+    callbacks.onComplete = [this, job, batch, touched, durability](const MoveResult &result)
+    {
+        m_journal.MarkDone(batch, result.index, result.ok);
+        LogResult(result);
+        if (result.ok)
         {
-            std::string stem = destFile.stem().string();
-            std::string ext = destFile.extension().string();
-            int count = 1;
-            while (fs::exists(destFile))
-            {
-                destFile = destDir / fs::path(stem + "_" + std::to_string(count++) + ext);
-            }
+            std::lock_guard<std::mutex> lock(m_movesMutex);
+            m_finishedMoves.push_back({result.source, result.destination, KeepsSource(result.strategy)});
         }
+        if (touched && result.ok)
+        {
+            std::lock_guard<std::mutex> lock(touched->mutex);
+            touched->dirs.insert(result.destination.parent_path().string());
+            for (const std::filesystem::path &created : result.createdDirs)
+                touched->dirs.insert(created.parent_path().string());
+            if (!KeepsSource(result.strategy) || result.strategy == MoveStrategy::LinkDuplicate)
+                touched->dirs.insert(result.source.parent_path().string());
+        }
+        if (!job->FileDone(result.index, result.ok))
+            return;
+
+        // Last file of the plan: durable first, then the journal may forget the batch. A
+        // batch that could not be synced stays open, for recovery to check at startup
+        bool durable = true;
+        std::string syncError;
+        if (touched)
+        {
+            const std::vector<std::filesystem::path> dirs(touched->dirs.begin(), touched->dirs.end());
+            DirectorySync::Stats stats;
+            durable = DirectorySync::Sync(dirs, durability == Durability::BatchedSyncfs, stats, syncError);
+            job->SetSyncStats(stats);
+        }
+        if (durable)
+            m_journal.EndBatch(batch);
+        job->Finish();
+
+        const MoveJob::Progress progress = job->GetProgress();
+        std::lock_guard<std::mutex> lock(m_logMutex);
+        if (!durable)
+            std::cerr << "FileManager: " << syncError << "; the batch stays in the journal\n";
+        if (touched)
+        {
+            std::cout << "FileManager: synced " << progress.syncedDirectories << " directories";
+            if (progress.syncedFilesystems > 0)
+                std::cout << " and " << progress.syncedFilesystems << " filesystems";
+            std::cout << " in " << static_cast<long>(progress.syncSeconds * 1000.0) << " ms\n";
+        }
+        if (progress.state == MoveJob::State::Cancelled)
+        {
+            std::cout << "FileManager: move cancelled, " << progress.files << " of " << progress.totalFiles
+                      << " files moved\n";
+        }
+        if (progress.duplicates > 0)
+        {
+            std::cout << "FileManager: " << progress.duplicates << " files already at their destination, "
+                      << progress.savedBytes << " bytes not placed again\n";
+        }
+    };
+
+    const uint64_t ticket = m_executor.Submit(plan.operations, std::move(callbacks));
+    job->SetCancelHandler([this, batch, ticket]
+                          {
+        // Journaled first: recovery must not start what the user stopped
+        m_journal.Cancel(batch);
+        m_executor.Cancel(ticket); });
+    return job;
+}
 
-        fs::rename(src, destFile);
-
-        std::cout << "Moved: " << src << " -> " << destFile << "\n";
-        return true;
-    }
-    catch (const std::exception &ex)
+size_t FileManager::PublishMoves()
+{
+    std::vector<IndexMove> moves;
     {
-        std::cerr << "FileManager::MoveSingleFile error: " << ex.what() << "\n";
-        return false;
+        std::lock_guard<std::mutex> lock(m_movesMutex);
+        moves.swap(m_finishedMoves);
     }
+    if (moves.empty())
+        return 0;
+
+    m_searchManager.ApplyMoves(moves);
+    m_tagManager.SyncWithIndex();
+    return moves.size();
 }
 
-void FileManager::EnsureDirectory(const fs::path &dest)
+void FileManager::LogResult(const MoveResult &result)
 {
-    std::error_code ec;
-    if (!fs::exists(dest, ec))
-        fs::create_directories(dest, ec);
+    std::lock_guard<std::mutex> lock(m_logMutex);
+    if (result.cancelled)
+        return; // summarized when the job ends
+    if (!result.ok)
+    {
+        std::cerr << "FileManager: " << result.error << "\n";
+        return;
+    }
+    static const char *verbs[] = {"Moved", "Moved", "Copied", "Cloned", "Hard linked", "Symlinked",
+                                  "Removed duplicate", "Linked duplicate"};
+    std::cout << verbs[static_cast<size_t>(result.strategy)] << ": " << result.source << " -> " << result.destination;
+    if (result.copy.method != FileCopier::Method::None)
+    {
+        std::cout << " (" << FileCopier::MethodName(result.copy.method);
+        if (result.copy.sparse)
+            std::cout << ", " << result.copy.bytes << " of " << result.copy.logicalBytes << " bytes";
+        std::cout << ")";
+    }
+    std::cout << "\n";
 }
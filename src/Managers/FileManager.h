@@ -1,33 +1,114 @@
 #pragma once
 
 #include <filesystem>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "TagManager.h"
 #include "SearchManager.h"
+#include "DirectorySync.h"
+#include "MoveExecutor.h"
+#include "MoveJob.h"
+#include "MoveJournal.h"
 
 class FileManager
 {
 public:
-    FileManager(TagManager &tagManager, SearchManager &searchManager);
+    /**
+     * Move batches interrupted by a crash (see MoveJournal) are resolved here, before
+     * anything else moves: finished by default, or undone with Recovery::RollBack.
+     */
+    FileManager(TagManager &tagManager, SearchManager &searchManager,
+                MoveJournal::Recovery recovery = MoveJournal::Recovery::RollForward);
 
     /**
      * Move all tagged files to their respective destination directories.
      * Called when user presses “Move” in the GUI.
-     * Returns number of successfully moved files.
+     * mode applies to tags without an organize mode of their own (TagManager::SetOrganizeMode):
+     * OrganizeMode::Mirror, Copy or a link mode organizes without touching the sources.
+     * Returns at once; the job reports progress and can be cancelled.
      */
-    size_t MoveAllTaggedFiles();
+    MoveJobPtr MoveAllTaggedFiles(OrganizeMode mode = OrganizeMode::Move);
 
     /**
      * Move only files for a specific tag.
      */
-    size_t MoveFilesByTag(const std::string &tagName);
+    MoveJobPtr MoveFilesByTag(const std::string &tagName, OrganizeMode mode = OrganizeMode::Move);
+
+    /**
+     * Move a selection of files (bitmap over file IDs, e.g. from TagManager::SelectFiles)
+     * to one destination directory.
+     */
+    MoveJobPtr MoveFiles(const FileBitmap &fileIds, const std::string &destination,
+                         OrganizeMode mode = OrganizeMode::Move);
+
+    // ------------------ Planning (dry run) ------------------
+
+    /**
+     * The plans the Move* calls above execute: final names, strategy and bytes per file,
+     * nothing touched yet. Show one with MovePlan::Describe, run it with ExecutePlan.
+     */
+    MovePlan PlanAllTaggedFiles(OrganizeMode mode = OrganizeMode::Move) const;
+    MovePlan PlanFilesByTag(const std::string &tagName, OrganizeMode mode = OrganizeMode::Move) const;
+    MovePlan PlanFiles(const FileBitmap &fileIds, const std::string &destination,
+                       OrganizeMode mode = OrganizeMode::Move) const;
+
+    /**
+     * What plans do with a source whose name and content are already at its destination:
+     * keep both (a _N suffix, the default), skip it, delete it or hard link it.
+     */
+    void SetDuplicatePolicy(DuplicatePolicy policy) { m_duplicatePolicy = policy; }
+    DuplicatePolicy GetDuplicatePolicy() const { return m_duplicatePolicy; }
+
+    /**
+     * Execute a plan as is, journaled, in the background. Returns the job at once.
+     * durability defaults to GetDurability(); a batched one syncs every directory the job
+     * changed once, before the job reports done and the journal lets go of it.
+     */
+    MoveJobPtr ExecutePlan(const MovePlan &plan);
+    MoveJobPtr ExecutePlan(const MovePlan &plan, Durability durability);
+
+    /**
+     * Durability of the jobs started from now on (the Move* calls and ExecutePlan(plan)).
+     */
+    void SetDurability(Durability durability) { m_durability = durability; }
+    Durability GetDurability() const { return m_durability; }
+
+    /**
+     * Bring SearchManager's index and the tag associations up to date with the moves that
+     * finished since the last call, without a rescan (SearchManager::ApplyMoves, then
+     * TagManager::SyncWithIndex). Moves finish on worker threads; call this from the thread
+     * that owns the index, e.g. once per frame. Returns the number of files applied.
+     */
+    size_t PublishMoves();
+
+    /**
+     * What startup recovery found and did.
+     */
+    const MoveJournal::RecoveryReport &GetRecoveryReport() const { return m_recoveryReport; }
+
+    /**
+     * Worker pool the moves run on (per-device concurrency can be tuned here).
+     */
+    MoveExecutor &GetMoveExecutor() { return m_executor; }
 
 private:
     TagManager &m_tagManager;
     SearchManager &m_searchManager;
+    MoveJournal m_journal;
+    MoveJournal::RecoveryReport m_recoveryReport;
+    std::mutex m_logMutex;
+    std::mutex m_movesMutex;
+    std::vector<IndexMove> m_finishedMoves; // not yet published to the index
+    DuplicatePolicy m_duplicatePolicy = DuplicatePolicy::KeepBoth;
+    Durability m_durability = Durability::Default;
+    MoveExecutor m_executor; // last: drains running jobs while everything they use still exists
+
+    void LogResult(const MoveResult &result);
 
-    bool MoveSingleFile(const FileData &file, const std::string &destination);
-    void EnsureDirectory(const std::filesystem::path &dest);
+    // Queue a selection, skipping files already scheduled to move (a file with several
+    // tags moves to the first tag's destination only); only moves are scheduled
+    void CollectRequests(const FileBitmap &fileIds, const std::filesystem::path &destination, OrganizeMode mode,
+                         FileBitmap &scheduled, std::vector<MoveRequest> &requests) const;
 };
@@ -0,0 +1,821 @@
+// MoveExecutor.cpp
+#include "MoveExecutor.h"
+#include "DirectorySync.h"
+#include "RateLimiter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    unsigned CoreCount()
+    {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Spinning disk behind a device number, from the block layer's own flag.
+    // Unknown (network, virtual or non-Linux filesystems) counts as solid-state.
+    bool IsRotational(uint64_t device)
+    {
+#if defined(__linux__)
+        const std::string base = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+        // Whole disks have queue/ themselves; a partition's is on its parent
+        for (const char *queue : {"/queue/rotational", "/../queue/rotational"})
+        {
+            std::ifstream in(base + queue);
+            int flag = 0;
+            if (in >> flag)
+                return flag != 0;
+        }
+#else
+        (void)device;
+#endif
+        return false;
+    }
+
+    // Idle I/O class for the calling thread; not idle = back to the default (derived from nice)
+    bool SetThreadIdleIo(bool idle)
+    {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+        constexpr int IOPRIO_WHO_PROCESS = 1; // with id 0: the calling thread
+        constexpr int IOPRIO_CLASS_IDLE = 3;
+        constexpr int IOPRIO_CLASS_SHIFT = 13;
+        return ::syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, idle ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT : 0) == 0;
+#else
+        (void)idle;
+        return false;
+#endif
+    }
+
+    // Chunks of about a quarter second at the byte limit, so a throttled copy runs evenly
+    size_t ThrottledChunk(uint64_t bytesPerSecond)
+    {
+        if (bytesPerSecond == 0)
+            return 0;
+        return static_cast<size_t>(std::min<uint64_t>(FileCopier::CHUNK_BYTES, std::max<uint64_t>(bytesPerSecond / 4, 64 * 1024)));
+    }
+}
+
+class MoveExecutor::Impl
+{
+public:
+    // Directory shared by every batch that touches it, so it is created and opened once.
+    // Renames then go through renameat() relative to the handle instead of resolving
+    // the full path again for every file.
+    struct DirState
+    {
+        fs::path path;
+        std::mutex mutex;
+        bool created = false;
+        bool opened = false;
+        bool createdSynced = false;        // the entries of createdDirs are durable
+        std::vector<fs::path> createdDirs; // made by Prepare, deepest (path itself) first
+        std::string error; // set if the directory could not be created
+        int fd = -1;       // directory handle, -1 if unavailable (paths are used instead)
+        std::unordered_map<std::string, int> nextSuffix; // source file name -> last _N planned or handed out
+
+        ~DirState()
+        {
+#if !defined(_WIN32)
+            if (fd >= 0)
+                ::close(fd);
+#endif
+        }
+
+        // The plan's suffixes, so a conflict at run time continues after them
+        void Seed(const fs::path &fileName, int suffix)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            int &last = nextSuffix[fileName.string()];
+            last = std::max(last, suffix);
+        }
+
+        // A taken name: stem_N.ext of the source's own name (not of a planned a_1.txt,
+        // which would give a_1_1.txt), after the last suffix planned or handed out for it
+        fs::path NextName(const fs::path &fileName)
+        {
+            const std::string stem = fileName.stem().string();
+            const std::string ext = fileName.extension().string();
+            std::lock_guard<std::mutex> lock(mutex);
+            const int suffix = ++nextSuffix[fileName.string()];
+            return path / (stem + "_" + std::to_string(suffix) + ext);
+        }
+
+        // Make the directories Prepare created durable: each one's entry lives in its parent,
+        // so those are synced, from the deepest created directory up to the first that existed
+        bool SyncCreated(std::string &outError)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (createdSynced || createdDirs.empty())
+                return true;
+            std::vector<fs::path> parents;
+            for (const fs::path &created : createdDirs)
+                parents.push_back(created.parent_path());
+            DirectorySync::Stats stats;
+            createdSynced = DirectorySync::Sync(parents, false, stats, outError);
+            return createdSynced;
+        }
+
+        std::vector<fs::path> UnsyncedCreated()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return createdSynced ? std::vector<fs::path>() : createdDirs;
+        }
+
+        // create: destination directories are created, source directories must exist
+        void Prepare(bool create)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (create && !created)
+            {
+                created = true;
+                std::error_code ec;
+                if (!fs::is_directory(path, ec))
+                {
+                    // Remember what is missing, up to the first ancestor that exists
+                    for (fs::path missing = path; !missing.empty() && !fs::exists(missing, ec);
+                         missing = missing.parent_path())
+                    {
+                        createdDirs.push_back(missing);
+                        if (missing == missing.parent_path())
+                            break;
+                    }
+                    fs::create_directories(path, ec);
+                }
+                if (ec)
+                {
+                    error = "cannot create " + path.string() + ": " + ec.message();
+                    createdDirs.clear();
+                    return;
+                }
+                opened = fd >= 0; // retry if it was missing when first seen as a source
+            }
+            if (opened)
+                return;
+            opened = true;
+#if !defined(_WIN32)
+#if defined(O_PATH)
+            fd = ::open(path.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+#else
+            fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+#endif
+#endif
+        }
+    };
+
+    // Rate limits of one destination device, shared with the batches running against it
+    struct Throttle
+    {
+        RateLimiter bytes;
+        RateLimiter operations;
+
+        void Set(const IoLimits &limits)
+        {
+            bytes.SetRate(limits.bytesPerSecond);
+            operations.SetRate(limits.operationsPerSecond);
+        }
+    };
+
+    struct Submission
+    {
+        Callbacks callbacks;
+        std::atomic<bool> cancelled{false};
+        size_t remaining = 0;
+    };
+
+    struct Batch
+    {
+        uint64_t ticket = 0;
+        std::shared_ptr<Submission> submission;
+        std::shared_ptr<DirState> dir;
+        std::vector<MoveOperation> operations;
+        std::vector<std::shared_ptr<DirState>> sources; // source directory of each operation
+        std::vector<size_t> indices;                    // positions in the submitted operations
+        std::shared_ptr<Throttle> throttle;             // of the destination device, set when taken
+    };
+
+    // Queue for one (source device, destination device) pair
+    struct Lane
+    {
+        uint64_t source = 0;
+        uint64_t destination = 0;
+        std::deque<Batch> batches;
+    };
+
+    struct Device
+    {
+        bool rotational = false;
+        bool pinned = false; // limit set by SetDeviceConcurrency
+        unsigned limit = 1;
+        unsigned active = 0;
+        bool throttlePinned = false; // limits set by SetIoLimits
+        std::shared_ptr<Throttle> throttle = std::make_shared<Throttle>();
+    };
+
+    static constexpr int CONFLICT_RETRIES = 1000; // names tried after the planned one
+
+    unsigned workerCount = 2;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable; // batch queued or device slot freed
+    std::condition_variable ticketDone;
+    bool stopping = false;
+
+    std::vector<Lane> lanes;
+    std::map<std::pair<uint64_t, uint64_t>, size_t> laneIndex;
+    size_t nextLane = 0; // round-robin cursor
+    size_t queuedBatches = 0;
+
+    std::unordered_map<uint64_t, Device> devices;
+    unsigned rotationalLimit = 1;
+    unsigned solidStateLimit = CoreCount();
+    FileCopyOptions copyOptions;
+    IoLimits defaultLimits;
+    std::atomic<bool> idlePriority{false};
+
+    std::unordered_map<std::string, std::weak_ptr<DirState>> dirs;
+    std::unordered_map<uint64_t, std::shared_ptr<Submission>> submissions; // pending only
+    uint64_t nextTicket = 1;
+
+    Device &DeviceEntry(uint64_t id, bool rotational)
+    {
+        auto it = devices.find(id);
+        if (it == devices.end())
+        {
+            Device device;
+            device.rotational = rotational;
+            device.limit = rotational ? rotationalLimit : solidStateLimit;
+            device.throttle->Set(defaultLimits);
+            it = devices.emplace(id, device).first;
+        }
+        return it->second;
+    }
+
+    std::shared_ptr<DirState> DirEntry(const fs::path &path)
+    {
+        auto &slot = dirs[path.string()];
+        std::shared_ptr<DirState> dir = slot.lock();
+        if (!dir)
+        {
+            dir = std::make_shared<DirState>();
+            dir->path = path;
+            slot = dir;
+        }
+        return dir;
+    }
+
+    bool CanRun(const Lane &lane)
+    {
+        const Device &source = devices[lane.source];
+        if (source.active >= source.limit)
+            return false;
+        if (lane.destination == lane.source)
+            return true;
+        const Device &destination = devices[lane.destination];
+        return destination.active < destination.limit;
+    }
+
+    // Claim the device slots, so pass the same lane to Release() afterwards
+    bool TakeBatch(Batch &out, std::pair<uint64_t, uint64_t> &outDevices)
+    {
+        for (size_t i = 0; i < lanes.size(); ++i)
+        {
+            const size_t index = (nextLane + i) % lanes.size();
+            Lane &lane = lanes[index];
+            if (lane.batches.empty() || !CanRun(lane))
+                continue;
+
+            out = std::move(lane.batches.front());
+            lane.batches.pop_front();
+            --queuedBatches;
+            nextLane = index + 1;
+
+            devices[lane.source].active++;
+            if (lane.destination != lane.source)
+                devices[lane.destination].active++;
+            out.throttle = devices[lane.destination].throttle;
+            outDevices = {lane.source, lane.destination};
+            return true;
+        }
+        return false;
+    }
+
+    void Release(const std::pair<uint64_t, uint64_t> &laneDevices)
+    {
+        devices[laneDevices.first].active--;
+        if (laneDevices.second != laneDevices.first)
+            devices[laneDevices.second].active--;
+    }
+
+    void WorkerLoop()
+    {
+        bool idle = false; // this thread's I/O class
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            Batch batch;
+            std::pair<uint64_t, uint64_t> laneDevices;
+            bool taken = false;
+            workAvailable.wait(lock, [&]
+                               { taken = TakeBatch(batch, laneDevices);
+                                 return taken || (stopping && queuedBatches == 0); });
+            if (!taken)
+                return;
+
+            const FileCopyOptions options = copyOptions;
+            lock.unlock();
+            if (idlePriority != idle)
+            {
+                idle = idlePriority;
+                SetThreadIdleIo(idle);
+            }
+            RunBatch(batch, options);
+            lock.lock();
+
+            Release(laneDevices);
+            batch.submission->remaining -= batch.operations.size();
+            if (batch.submission->remaining == 0)
+            {
+                submissions.erase(batch.ticket);
+                ticketDone.notify_all();
+            }
+            if (queuedBatches == 0 && submissions.empty())
+                PruneDirs();
+            workAvailable.notify_all();
+        }
+    }
+
+    void PruneDirs()
+    {
+        for (auto it = dirs.begin(); it != dirs.end();)
+            it = it->second.expired() ? dirs.erase(it) : std::next(it);
+    }
+
+    void RunBatch(const Batch &batch, const FileCopyOptions &copyOptions)
+    {
+        DirState &dir = *batch.dir;
+        dir.Prepare(true);
+        for (const std::shared_ptr<DirState> &source : batch.sources)
+            source->Prepare(false);
+
+        Submission &submission = *batch.submission;
+        Throttle &throttle = *batch.throttle;
+        FileCopyOptions options = copyOptions;
+
+        for (size_t i = 0; i < batch.operations.size(); ++i)
+        {
+            const size_t index = batch.indices[i];
+
+            // Every chunk of a copy waits for its bytes on the destination device, and is
+            // where a cancelled copy stops
+            options.chunkBytes = ThrottledChunk(throttle.bytes.GetRate());
+            options.beforeChunk = [&submission, &throttle, index](uint64_t bytes)
+            {
+                if (submission.cancelled)
+                    return false;
+                throttle.bytes.Acquire(bytes);
+                if (submission.callbacks.onProgress)
+                    submission.callbacks.onProgress(index, bytes);
+                return !submission.cancelled;
+            };
+
+            if (!submission.cancelled)
+                throttle.operations.Acquire(1);
+            MoveResult result = MoveOne(batch.operations[i], index, *batch.sources[i], dir, submission, options);
+            if (submission.callbacks.onComplete)
+                submission.callbacks.onComplete(result);
+        }
+    }
+
+    static void Rename(const fs::path &source, const DirState &sourceDir, const fs::path &destination,
+                       const DirState &dir, std::error_code &ec)
+    {
+#if !defined(_WIN32)
+        if (sourceDir.fd >= 0 && dir.fd >= 0)
+        {
+            FileCopier::RenameNoReplace(sourceDir.fd, source.filename().c_str(), dir.fd,
+                                        destination.filename().c_str(), ec);
+            return;
+        }
+#else
+        (void)sourceDir;
+        (void)dir;
+#endif
+        FileCopier::RenameNoReplace(source, destination, ec);
+    }
+
+    static MoveResult MoveOne(const MoveOperation &op, size_t index, const DirState &sourceDir, DirState &dir,
+                              const Submission &submission, const FileCopyOptions &copyOptions)
+    {
+        MoveResult result;
+        result.index = index;
+        result.fileId = op.fileId;
+        result.source = op.source;
+
+        if (submission.cancelled)
+        {
+            result.cancelled = true;
+            result.error = "cancelled: " + op.source.string();
+            return result;
+        }
+        if (!dir.error.empty())
+        {
+            result.error = dir.error;
+            return result;
+        }
+
+        // Someone else took the planned name since planning: the next suffix, announced first
+        int conflicts = 0;
+        auto onConflict = [&](fs::path &destination)
+        {
+            if (++conflicts > CONFLICT_RETRIES)
+                return false;
+            fs::path next = dir.NextName(op.source.filename());
+            if (submission.callbacks.onRedirect && !submission.callbacks.onRedirect(index, next))
+                return false;
+            destination = std::move(next);
+            return true;
+        };
+
+        result.strategy = op.strategy;
+        if (Deduplicates(op.strategy))
+        {
+            result.ok = Deduplicate(op, result.error);
+            if (result.ok)
+                result.destination = op.destination;
+            return result;
+        }
+
+        // Another strategy than planned runs only once it is announced (the journal must
+        // know what to check); refused, the operation fails with the original error
+        auto fallBack = [&](MoveStrategy strategy)
+        {
+            if (submission.callbacks.onFallback && !submission.callbacks.onFallback(index, strategy))
+                return false;
+            result.strategy = strategy;
+            return true;
+        };
+
+        fs::path destination = op.destination;
+        std::error_code ec;
+        bool copy = false;
+        switch (op.strategy)
+        {
+        case MoveStrategy::Rename:
+            Rename(op.source, sourceDir, destination, dir, ec);
+            while (ec == std::errc::file_exists && onConflict(destination))
+                Rename(op.source, sourceDir, destination, dir, ec);
+            if (ec == std::errc::cross_device_link)
+                copy = fallBack(MoveStrategy::CopyAndUnlink);
+            break;
+        case MoveStrategy::Hardlink:
+        case MoveStrategy::Symlink:
+            Link(op, sourceDir, destination, dir, ec);
+            while (ec == std::errc::file_exists && onConflict(destination))
+                Link(op, sourceDir, destination, dir, ec);
+            // Mirror asked for the cheapest copy, not for a link: a filesystem without
+            // hard links (or a bind mount boundary) still gets one
+            if (op.mode == OrganizeMode::Mirror && op.strategy == MoveStrategy::Hardlink && ec &&
+                ec != std::errc::file_exists && ec != std::errc::no_such_file_or_directory)
+                copy = fallBack(MoveStrategy::Copy);
+            break;
+        default:
+            copy = true;
+            break;
+        }
+
+        bool moved = false;
+        if (copy && !dir.SyncCreated(result.error))
+            copy = false; // the copy must not outlive its directory, nor the source go first
+        else if (copy)
+        {
+            auto copyConflict = [&](fs::path &taken)
+            {
+                if (!onConflict(taken))
+                    return false;
+                destination = taken;
+                return true;
+            };
+            FileCopyOptions options = copyOptions;
+            options.reflinkOnly = result.strategy == MoveStrategy::Reflink;
+            if (KeepsSource(result.strategy))
+                moved = FileCopier::Place(op.source, destination, result.copy, result.error, options, copyConflict);
+            else
+                moved = FileCopier::Move(op.source, destination, result.copy, result.error, options, copyConflict);
+        }
+        else if (ec)
+            result.error = op.source.string() + " -> " + destination.string() + ": " + ec.message();
+        else
+            moved = true;
+
+        if (moved)
+        {
+            result.destination = destination;
+            result.ok = true;
+            result.createdDirs = dir.UnsyncedCreated();
+        }
+        else
+            result.cancelled = submission.cancelled;
+        return result;
+    }
+
+    // The destination already holds the source's content: drop the source, or make it a
+    // link to that file. The plan matched them by hash only, so they are compared byte for
+    // byte first; a file written to meanwhile fails the check
+    static bool Deduplicate(const MoveOperation &op, std::string &outError)
+    {
+        const std::string label = op.source.string() + " -> " + op.destination.string();
+        std::error_code ec;
+        if (!FileCopier::Identical(op.source, op.destination))
+        {
+            outError = label + ": no longer identical, source left in place";
+            return false;
+        }
+
+        if (op.strategy == MoveStrategy::DropDuplicate)
+            fs::remove(op.source, ec);
+        else if (!fs::equivalent(op.source, op.destination, ec))
+            FileCopier::ReplaceWithLink(op.destination, op.source, ec);
+        if (ec)
+            outError = label + ": " + ec.message();
+        return !ec;
+    }
+
+    // Hard or symbolic link at destination; a symlink points at the absolute source path
+    static void Link(const MoveOperation &op, const DirState &sourceDir, const fs::path &destination,
+                     const DirState &dir, std::error_code &ec)
+    {
+        ec.clear();
+        if (op.strategy == MoveStrategy::Symlink)
+        {
+            const fs::path target = fs::absolute(op.source, ec).lexically_normal();
+            if (ec)
+                return;
+#if !defined(_WIN32)
+            const int rc = dir.fd >= 0 ? ::symlinkat(target.c_str(), dir.fd, destination.filename().c_str())
+                                       : ::symlink(target.c_str(), destination.c_str());
+            if (rc != 0)
+                ec.assign(errno, std::generic_category());
+#else
+            (void)dir;
+            fs::create_symlink(target, destination, ec);
+#endif
+            return;
+        }
+
+#if !defined(_WIN32)
+        const int rc = (sourceDir.fd >= 0 && dir.fd >= 0)
+                           ? ::linkat(sourceDir.fd, op.source.filename().c_str(), dir.fd, destination.filename().c_str(), 0)
+                           : ::link(op.source.c_str(), destination.c_str());
+        if (rc != 0)
+            ec.assign(errno, std::generic_category());
+#else
+        (void)sourceDir;
+        fs::create_hard_link(op.source, destination, ec);
+#endif
+    }
+};
+
+MoveExecutor::MoveExecutor(unsigned workers)
+    : m_impl(std::make_unique<Impl>())
+{
+    m_impl->workerCount = workers ? workers : std::max(2u, CoreCount());
+}
+
+MoveExecutor::~MoveExecutor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        m_impl->stopping = true;
+    }
+    m_impl->workAvailable.notify_all();
+    for (std::thread &worker : m_impl->workers)
+        worker.join();
+}
+
+uint64_t MoveExecutor::Submit(std::vector<MoveOperation> operations, CompletionCallback onComplete)
+{
+    Callbacks callbacks;
+    callbacks.onComplete = std::move(onComplete);
+    return Submit(std::move(operations), std::move(callbacks));
+}
+
+uint64_t MoveExecutor::Submit(std::vector<MoveOperation> operations, Callbacks callbacks)
+{
+    // Group by (source device, destination device, destination directory)
+    struct Group
+    {
+        uint64_t source = 0;
+        uint64_t destination = 0;
+        fs::path dir;
+        std::vector<MoveOperation> operations;
+        std::vector<size_t> indices;
+    };
+    std::map<std::tuple<uint64_t, uint64_t, std::string>, Group> groups;
+    std::unordered_map<uint64_t, bool> seenDevices; // device -> rotational
+
+    const size_t total = operations.size();
+    for (size_t index = 0; index < total; ++index)
+    {
+        MoveOperation &op = operations[index];
+        for (uint64_t device : {op.sourceDevice, op.destinationDevice})
+        {
+            if (!seenDevices.count(device))
+                seenDevices[device] = IsRotational(device);
+        }
+        fs::path dir = op.destination.parent_path();
+        Group &group = groups[{op.sourceDevice, op.destinationDevice, dir.string()}];
+        group.source = op.sourceDevice;
+        group.destination = op.destinationDevice;
+        group.dir = std::move(dir);
+        group.operations.push_back(std::move(op));
+        group.indices.push_back(index);
+    }
+
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    const uint64_t ticket = m_impl->nextTicket++;
+    if (total == 0)
+        return ticket;
+
+    auto submission = std::make_shared<Impl::Submission>();
+    submission->callbacks = std::move(callbacks);
+    submission->remaining = total;
+    m_impl->submissions.emplace(ticket, submission);
+
+    for (const auto &entry : seenDevices)
+        m_impl->DeviceEntry(entry.first, entry.second);
+
+    for (auto &entry : groups)
+    {
+        Group &group = entry.second;
+        const auto key = std::make_pair(group.source, group.destination);
+        auto laneIt = m_impl->laneIndex.find(key);
+        if (laneIt == m_impl->laneIndex.end())
+        {
+            Impl::Lane lane;
+            lane.source = group.source;
+            lane.destination = group.destination;
+            m_impl->lanes.push_back(std::move(lane));
+            laneIt = m_impl->laneIndex.emplace(key, m_impl->lanes.size() - 1).first;
+        }
+        Impl::Lane &lane = m_impl->lanes[laneIt->second];
+
+        std::shared_ptr<Impl::DirState> dir = m_impl->DirEntry(group.dir);
+        for (const MoveOperation &op : group.operations)
+        {
+            if (op.suffix > 0)
+                dir->Seed(op.source.filename(), op.suffix);
+        }
+        for (size_t start = 0; start < group.operations.size(); start += BATCH_FILES)
+        {
+            const size_t end = std::min(group.operations.size(), start + BATCH_FILES);
+            Impl::Batch batch;
+            batch.ticket = ticket;
+            batch.submission = submission;
+            batch.dir = dir;
+            for (size_t i = start; i < end; ++i)
+                batch.sources.push_back(m_impl->DirEntry(group.operations[i].source.parent_path()));
+            batch.operations.assign(std::make_move_iterator(group.operations.begin() + start),
+                                    std::make_move_iterator(group.operations.begin() + end));
+            batch.indices.assign(group.indices.begin() + start, group.indices.begin() + end);
+            lane.batches.push_back(std::move(batch));
+            ++m_impl->queuedBatches;
+        }
+    }
+
+    if (m_impl->workers.empty())
+    {
+        for (unsigned i = 0; i < m_impl->workerCount; ++i)
+            m_impl->workers.emplace_back(&Impl::WorkerLoop, m_impl.get());
+    }
+    m_impl->workAvailable.notify_all();
+    return ticket;
+}
+
+void MoveExecutor::Wait(uint64_t ticket)
+{
+    std::unique_lock<std::mutex> lock(m_impl->mutex);
+    m_impl->ticketDone.wait(lock, [&]
+                            { return m_impl->submissions.count(ticket) == 0; });
+}
+
+bool MoveExecutor::Cancel(uint64_t ticket)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    auto found = m_impl->submissions.find(ticket);
+    if (found == m_impl->submissions.end())
+        return false;
+    found->second->cancelled = true;
+    return true;
+}
+
+void MoveExecutor::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(m_impl->mutex);
+    m_impl->ticketDone.wait(lock, [&]
+                            { return m_impl->submissions.empty(); });
+}
+
+bool MoveExecutor::SetDeviceConcurrency(const fs::path &onDevice, unsigned concurrency)
+{
+    uint64_t id = 0;
+    if (!MovePlanner::DeviceOf(onDevice, id))
+        return false;
+    const bool rotational = IsRotational(id);
+
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    Impl::Device &device = m_impl->DeviceEntry(id, rotational);
+    device.limit = std::max(1u, concurrency);
+    device.pinned = true;
+    m_impl->workAvailable.notify_all();
+    return true;
+}
+
+void MoveExecutor::SetDefaultConcurrency(unsigned rotational, unsigned solidState)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->rotationalLimit = std::max(1u, rotational);
+    m_impl->solidStateLimit = std::max(1u, solidState);
+    for (auto &entry : m_impl->devices)
+    {
+        Impl::Device &device = entry.second;
+        if (!device.pinned)
+            device.limit = device.rotational ? m_impl->rotationalLimit : m_impl->solidStateLimit;
+    }
+    m_impl->workAvailable.notify_all();
+}
+
+void MoveExecutor::SetCopyOptions(const FileCopyOptions &options)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->copyOptions = options;
+}
+
+FileCopyOptions MoveExecutor::GetCopyOptions() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->copyOptions;
+}
+
+bool MoveExecutor::SetIoLimits(const fs::path &onDevice, const IoLimits &limits)
+{
+    uint64_t id = 0;
+    if (!MovePlanner::DeviceOf(onDevice, id))
+        return false;
+    const bool rotational = IsRotational(id);
+
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    Impl::Device &device = m_impl->DeviceEntry(id, rotational);
+    device.throttlePinned = true;
+    device.throttle->Set(limits);
+    return true;
+}
+
+void MoveExecutor::SetDefaultIoLimits(const IoLimits &limits)
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    m_impl->defaultLimits = limits;
+    for (auto &entry : m_impl->devices)
+    {
+        if (!entry.second.throttlePinned)
+            entry.second.throttle->Set(limits);
+    }
+}
+
+IoLimits MoveExecutor::GetDefaultIoLimits() const
+{
+    std::lock_guard<std::mutex> lock(m_impl->mutex);
+    return m_impl->defaultLimits;
+}
+
+void MoveExecutor::SetIdlePriority(bool idle)
+{
+    m_impl->idlePriority = idle;
+}
+
+bool MoveExecutor::GetIdlePriority() const
+{
+    return m_impl->idlePriority;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FileCopier.h"
+#include "MovePlanner.h"
+
+/**
+ * Outcome of one MoveOperation, reported as soon as the file is done.
+ */
+struct MoveResult
+{
+    size_t index = 0; // position in the submitted operations
+    size_t fileId = 0;
+    std::filesystem::path source;
+    std::filesystem::path destination; // empty on failure
+    MoveStrategy strategy = MoveStrategy::Rename; // as run (a rename across mounts ends up a copy)
+    bool ok = false;
+    bool cancelled = false; // stopped by MoveExecutor::Cancel (source untouched)
+    std::string error;
+
+    // Directories created for the destination, deepest first, whose entries are not synced yet
+    std::vector<std::filesystem::path> createdDirs;
+
+    // Set when source and destination are on different filesystems (method None otherwise)
+    FileCopier::Result copy;
+};
+
+/**
+ * Rate limits for moves into one destination device; 0 = unlimited.
+ */
+struct IoLimits
+{
+    uint64_t bytesPerSecond = 0;      // data copied (a rename copies none)
+    uint64_t operationsPerSecond = 0; // files moved
+};
+
+/**
+ * MoveExecutor
+ * -------------
+ * Runs planned moves (see MovePlanner) on a worker pool, scheduled per device.
+ *
+ * Operations are queued by (source device, destination device) and split into batches of
+ * one destination directory each, so a directory is created once per batch. Source and
+ * destination directories are opened once and shared between batches; renames go through
+ * renameat2(RENAME_NOREPLACE) relative to those handles, so no existence checks are
+ * needed and an existing file is never replaced. A name taken since planning (another
+ * writer got there first) moves the file to the next stem_N.ext from a per-directory
+ * counter, without probing.
+ * A batch only starts when both of its devices are below their concurrency limit: a
+ * rotational disk gets one operation at a time (concurrent seeks only slow it down), a
+ * solid-state device one per core. Queues are served round-robin, so one large move
+ * cannot starve the others.
+ *
+ * A move across filesystems is a verified copy + unlink (FileCopier); so is a planned
+ * rename that fails with EXDEV (e.g. between two mounts of one filesystem). Operations
+ * that keep their source copy (FileCopier::Place), clone, or create a hard or symbolic
+ * link under the same no-replace rules.
+ *
+ * Each destination device can be rate limited (token buckets for bytes and files per
+ * second, shared by every worker writing to it), and workers can run at idle I/O
+ * priority. Both can be changed while moves are running. A batch waiting for its rate
+ * limit keeps its device slots, so the throttled disks really get that much quieter.
+ *
+ * Completions are reported per file, on the worker that moved it.
+ */
+class MoveExecutor
+{
+public:
+    using CompletionCallback = std::function<void(const MoveResult &)>;
+
+    // Called, from a worker, before operation index moves to another name than planned
+    // because its destination was taken. Return false to fail the operation instead.
+    using RedirectCallback = std::function<bool(size_t index, const std::filesystem::path &destination)>;
+
+    // Called, from a worker, before operation index runs as another strategy than planned
+    // (a rename across mounts copies, a mirror without hard links copies). Return false to
+    // fail the operation instead.
+    using FallbackCallback = std::function<bool(size_t index, MoveStrategy strategy)>;
+
+    // Called, from a worker, as each chunk of a copy for operation index starts
+    using ProgressCallback = std::function<void(size_t index, uint64_t bytes)>;
+
+    /**
+     * What a submission reports back; any member may be empty.
+     */
+    struct Callbacks
+    {
+        CompletionCallback onComplete; // once per operation
+        RedirectCallback onRedirect;
+        FallbackCallback onFallback;
+        ProgressCallback onProgress;
+    };
+
+    static constexpr size_t BATCH_FILES = 64;
+
+    /**
+     * workers = 0 -> one per core (at least 2). Threads start with the first Submit().
+     */
+    explicit MoveExecutor(unsigned workers = 0);
+    ~MoveExecutor(); // finishes queued work
+
+    MoveExecutor(const MoveExecutor &) = delete;
+    MoveExecutor &operator=(const MoveExecutor &) = delete;
+
+    /**
+     * Queue operations; onComplete is called once per operation, from a worker.
+     * Returns a ticket for Wait() and Cancel().
+     */
+    uint64_t Submit(std::vector<MoveOperation> operations, Callbacks callbacks);
+    uint64_t Submit(std::vector<MoveOperation> operations, CompletionCallback onComplete);
+
+    /**
+     * Stop a submission: operations not started yet complete at once, unmoved and marked
+     * cancelled; a running copy stops before its next chunk. Returns false if the ticket
+     * already finished.
+     */
+    bool Cancel(uint64_t ticket);
+
+    /**
+     * Block until every request of the ticket (or, for WaitAll, of every ticket) completed.
+     */
+    void Wait(uint64_t ticket);
+    void WaitAll();
+
+    // ------------------ Tuning ------------------
+
+    /**
+     * Concurrent operations allowed on the device holding path (applies to queued work too).
+     */
+    bool SetDeviceConcurrency(const std::filesystem::path &onDevice, unsigned concurrency);
+
+    /**
+     * Limits for devices without an explicit setting, by kind. Defaults: 1 and one per core.
+     */
+    void SetDefaultConcurrency(unsigned rotational, unsigned solidState);
+
+    /**
+     * Layout of cross-filesystem copies (sparse / preallocated); applies from the next batch.
+     */
+    void SetCopyOptions(const FileCopyOptions &options);
+    FileCopyOptions GetCopyOptions() const;
+
+    // ------------------ Rate limits ------------------
+
+    /**
+     * Limits for moves into the device holding path; apply at once, also to running batches.
+     */
+    bool SetIoLimits(const std::filesystem::path &onDevice, const IoLimits &limits);
+
+    /**
+     * Limits for destination devices without their own setting. Default: unlimited.
+     */
+    void SetDefaultIoLimits(const IoLimits &limits);
+    IoLimits GetDefaultIoLimits() const;
+
+    /**
+     * Run moves in the idle I/O class (Linux ioprio_set; honoured by the BFQ scheduler):
+     * they only get the disk when nobody else uses it. Applies from each worker's next batch.
+     */
+    void SetIdlePriority(bool idle);
+    bool GetIdlePriority() const;
+
+private:
+    class Impl;
+    std::unique_ptr<Impl> m_impl;
+};
@@ -0,0 +1,148 @@
+// MoveJob.cpp
+#include "MoveJob.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr int64_t SAMPLE_NANOS = 500 * 1000 * 1000; // throughput is re-estimated at most twice a second
+    constexpr double SMOOTHING = 0.3;                  // weight of the newest sample
+}
+
+MoveJob::MoveJob(const MovePlan &plan)
+    : m_fileBytes(new std::atomic<uint64_t>[plan.operations.size()]()),
+      m_totalFiles(plan.operations.size()),
+      m_totalBytes(plan.totalBytes),
+      m_start(Clock::now())
+{
+    m_fileSizes.reserve(plan.operations.size());
+    m_deduplicates.reserve(plan.operations.size());
+    uint64_t pendingSaved = 0;
+    for (const MoveOperation &op : plan.operations)
+    {
+        m_fileSizes.push_back(op.bytes);
+        m_deduplicates.push_back(Deduplicates(op.strategy));
+        if (m_deduplicates.back())
+            pendingSaved += op.bytes;
+    }
+    m_duplicates = plan.duplicates - plan.deduplicated;
+    m_savedBytes = plan.duplicateBytes - pendingSaved;
+}
+
+MoveJob::Progress MoveJob::GetProgress() const
+{
+    Progress out;
+    out.state = static_cast<State>(m_state.load(std::memory_order_acquire));
+    out.files = m_files.load(std::memory_order_relaxed);
+    out.failed = m_failed.load(std::memory_order_relaxed);
+    out.totalFiles = m_totalFiles;
+    out.bytes = m_bytes.load(std::memory_order_relaxed);
+    out.totalBytes = m_totalBytes;
+    out.duplicates = m_duplicates.load(std::memory_order_relaxed);
+    out.savedBytes = m_savedBytes.load(std::memory_order_relaxed);
+    out.syncedDirectories = m_syncedDirectories.load(std::memory_order_relaxed);
+    out.syncedFilesystems = m_syncedFilesystems.load(std::memory_order_relaxed);
+    out.syncSeconds = m_syncSeconds.load(std::memory_order_relaxed);
+
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_start).count();
+    out.elapsedSeconds = static_cast<double>(now) / 1e9;
+
+    int64_t sampled = m_sampleNanos.load(std::memory_order_relaxed);
+    if (now - sampled >= SAMPLE_NANOS && m_sampleNanos.compare_exchange_strong(sampled, now))
+    {
+        // The total can shrink (a file that copied more than planned is settled down to its
+        // size); that counts as no progress rather than wrapping around
+        const uint64_t previous = m_sampleBytes.exchange(out.bytes);
+        const uint64_t gained = out.bytes > previous ? out.bytes - previous : 0;
+        const double instant = static_cast<double>(gained) / (static_cast<double>(now - sampled) / 1e9);
+        const double rate = m_rate.load(std::memory_order_relaxed);
+        m_rate.store(sampled == 0 ? instant : rate + SMOOTHING * (instant - rate), std::memory_order_relaxed);
+    }
+    out.bytesPerSecond = m_rate.load(std::memory_order_relaxed);
+
+    if (out.state != State::Running)
+        out.etaSeconds = 0.0;
+    else if (out.bytesPerSecond > 0.0)
+        out.etaSeconds = static_cast<double>(m_totalBytes - std::min(out.bytes, m_totalBytes)) / out.bytesPerSecond;
+    return out;
+}
+
+void MoveJob::Cancel()
+{
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_cancelRequested.exchange(true))
+            return;
+        handler = m_cancelHandler;
+    }
+    if (handler)
+        handler();
+}
+
+void MoveJob::Wait() const
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this]
+                { return IsDone(); });
+}
+
+void MoveJob::SetCancelHandler(std::function<void()> handler)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (IsDone())
+            return; // nothing left to stop
+        if (!m_cancelRequested)
+        {
+            m_cancelHandler = std::move(handler);
+            return;
+        }
+    }
+    if (handler)
+        handler();
+}
+
+void MoveJob::AddBytes(size_t index, uint64_t bytes)
+{
+    m_fileBytes[index].fetch_add(bytes, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+bool MoveJob::FileDone(size_t index, bool moved)
+{
+    // Whatever the chunks added up to (holes are skipped, failures stop early), a
+    // finished file counts exactly its planned size. The difference is applied in one
+    // update, so a reader never sees the total jump past it and back
+    const uint64_t size = m_fileSizes[index];
+    const uint64_t counted = m_fileBytes[index].exchange(size, std::memory_order_relaxed);
+    if (size >= counted)
+        m_bytes.fetch_add(size - counted, std::memory_order_relaxed);
+    else
+        m_bytes.fetch_sub(counted - size, std::memory_order_relaxed);
+
+    (moved ? m_files : m_failed).fetch_add(1, std::memory_order_relaxed);
+    if (moved && m_deduplicates[index])
+    {
+        m_duplicates.fetch_add(1, std::memory_order_relaxed);
+        m_savedBytes.fetch_add(m_fileSizes[index], std::memory_order_relaxed);
+    }
+    return m_completed.fetch_add(1) + 1 == m_totalFiles;
+}
+
+void MoveJob::SetSyncStats(const DirectorySync::Stats &stats)
+{
+    m_syncedDirectories.store(stats.directories, std::memory_order_relaxed);
+    m_syncedFilesystems.store(stats.filesystems, std::memory_order_relaxed);
+    m_syncSeconds.store(stats.seconds, std::memory_order_relaxed);
+}
+
+void MoveJob::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_state.store(uint8_t(m_cancelRequested ? State::Cancelled : State::Finished), std::memory_order_release);
+        m_cancelHandler = nullptr; // may refer to the mover, which can be gone before the handle
+    }
+    m_done.notify_all();
+}
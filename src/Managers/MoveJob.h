@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DirectorySync.h"
+#include "MovePlanner.h"
+
+/**
+ * MoveJob
+ * --------
+ * Handle to a plan running in the background (FileManager::ExecutePlan and the Move* calls).
+ *
+ * Progress is kept in atomics, so GetProgress() never waits for the workers and can be
+ * polled every frame. Bytes advance per copied chunk, and a renamed file counts its whole
+ * size at once. Throughput is smoothed across polls; the ETA is the plan's remaining bytes
+ * at that rate.
+ *
+ * Duplicates the plan skipped count as saved from the start, deduplicated ones once done.
+ * With a batched Durability, the directory syncs at commit are part of the job: it is
+ * done once they are, and their count and time are reported.
+ *
+ * Cancel() stops the job between files, and a large copy between chunks. Files not moved
+ * yet stay where they are, and a partial copy is removed.
+ */
+class MoveJob
+{
+public:
+    enum class State : uint8_t
+    {
+        Running = 0,
+        Finished,
+        Cancelled
+    };
+
+    struct Progress
+    {
+        State state = State::Running;
+        size_t files = 0; // moved
+        size_t failed = 0; // not moved (errors and, after Cancel, the rest)
+        size_t totalFiles = 0;
+        uint64_t bytes = 0; // done, of totalBytes
+        uint64_t totalBytes = 0;
+        double bytesPerSecond = 0.0;
+        double elapsedSeconds = 0.0;
+        double etaSeconds = -1.0; // -1 = no estimate yet
+        size_t duplicates = 0;    // already at their destination: skipped, dropped or linked
+        uint64_t savedBytes = 0;  // their size, not placed again
+        size_t syncedDirectories = 0;  // fsynced at commit (batched durability)
+        size_t syncedFilesystems = 0;  // synced whole with syncfs at commit
+        double syncSeconds = 0.0;      // time the commit spent syncing
+
+        double Fraction() const
+        {
+            if (totalBytes > 0)
+                return static_cast<double>(bytes) / static_cast<double>(totalBytes);
+            return totalFiles > 0 ? static_cast<double>(files + failed) / static_cast<double>(totalFiles) : 1.0;
+        }
+    };
+
+    explicit MoveJob(const MovePlan &plan);
+
+    Progress GetProgress() const;
+    bool IsDone() const { return m_state.load(std::memory_order_acquire) != uint8_t(State::Running); }
+
+    /**
+     * Request a stop; returns at once, the job is done when the running file is.
+     */
+    void Cancel();
+    bool IsCancelRequested() const { return m_cancelRequested.load(std::memory_order_acquire); }
+
+    /**
+     * Block until the job is done.
+     */
+    void Wait() const;
+
+    // ------------------ Reporting (the mover) ------------------
+
+    void SetCancelHandler(std::function<void()> handler); // called at once if already cancelled, dropped by Finish()
+    void AddBytes(size_t index, uint64_t bytes);          // chunk of operation index copied
+    bool FileDone(size_t index, bool moved);              // returns true for the last file
+    void SetSyncStats(const DirectorySync::Stats &stats); // before Finish()
+    void Finish();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<uint64_t> m_fileSizes;                      // planned bytes per operation
+    std::vector<bool> m_deduplicates;                       // operation drops or links a duplicate
+    std::unique_ptr<std::atomic<uint64_t>[]> m_fileBytes;   // bytes counted per operation
+    const size_t m_totalFiles;
+    const uint64_t m_totalBytes;
+    const Clock::time_point m_start;
+
+    std::atomic<size_t> m_files{0};
+    std::atomic<size_t> m_failed{0};
+    std::atomic<size_t> m_completed{0}; // files + failed, counted once per file
+    std::atomic<uint64_t> m_bytes{0};
+    std::atomic<size_t> m_duplicates{0};
+    std::atomic<uint64_t> m_savedBytes{0};
+    std::atomic<size_t> m_syncedDirectories{0};
+    std::atomic<size_t> m_syncedFilesystems{0};
+    std::atomic<double> m_syncSeconds{0.0};
+    std::atomic<uint8_t> m_state{uint8_t(State::Running)};
+    std::atomic<bool> m_cancelRequested{false};
+
+    // Throughput sample, advanced by whichever poll finds it old enough
+    mutable std::atomic<int64_t> m_sampleNanos{0};
+    mutable std::atomic<uint64_t> m_sampleBytes{0};
+    mutable std::atomic<double> m_rate{0.0};
+
+    mutable std::mutex m_mutex; // cancel handler and Wait() only
+    mutable std::condition_variable m_done;
+    std::function<void()> m_cancelHandler;
+};
+
+using MoveJobPtr = std::shared_ptr<MoveJob>;
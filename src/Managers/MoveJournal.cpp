@@ -0,0 +1,785 @@
+// MoveJournal.cpp
+#include "MoveJournal.h"
+#include "FileCopier.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char JOURNAL_MAGIC[4] = {'F', 'S', 'M', 'J'};
+    constexpr uint32_t JOURNAL_VERSION = 1;
+    constexpr size_t HEADER_SIZE = 8;
+
+    // ------------------ Platform file primitives ------------------
+
+    int OpenAppend(const std::string &path)
+    {
+#if defined(_WIN32)
+        return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY | _O_APPEND, _S_IREAD | _S_IWRITE);
+#else
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    }
+
+    bool WriteAll(int fd, const uint8_t *data, size_t size)
+    {
+        while (size > 0)
+        {
+#if defined(_WIN32)
+            const int n = _write(fd, data, static_cast<unsigned>(size));
+#else
+            const ssize_t n = ::write(fd, data, size);
+#endif
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool SyncFile(int fd)
+    {
+#if defined(_WIN32)
+        return _commit(fd) == 0;
+#else
+        return ::fsync(fd) == 0;
+#endif
+    }
+
+    bool TruncateFile(int fd, uint64_t size)
+    {
+#if defined(_WIN32)
+        return _chsize_s(fd, static_cast<__int64>(size)) == 0;
+#else
+        return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    void CloseFile(int fd)
+    {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    // ------------------ Encoding ------------------
+
+    void PutU32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void PutU64(std::vector<uint8_t> &out, uint64_t v)
+    {
+        for (int i = 0; i < 8; ++i)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void PutString(std::vector<uint8_t> &out, const std::string &text)
+    {
+        PutU32(out, static_cast<uint32_t>(text.size()));
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    uint32_t GetU32(const uint8_t *p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t GetU64(const uint8_t *p)
+    {
+        return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+    }
+
+    // FNV-1a, enough to detect torn / garbage tails
+    uint32_t Checksum(const uint8_t *data, size_t size)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= data[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    void PutHeader(std::vector<uint8_t> &out)
+    {
+        out.insert(out.end(), JOURNAL_MAGIC, JOURNAL_MAGIC + 4);
+        PutU32(out, JOURNAL_VERSION);
+    }
+
+    void PutRecord(std::vector<uint8_t> &out, MoveJournal::RecordType type, const std::vector<uint8_t> &payload)
+    {
+        const size_t start = out.size();
+        out.push_back(static_cast<uint8_t>(type));
+        PutU32(out, static_cast<uint32_t>(payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+        PutU32(out, Checksum(out.data() + start, out.size() - start));
+    }
+
+    // ------------------ Recovery ------------------
+
+    struct Intent
+    {
+        MoveStrategy strategy = MoveStrategy::Rename;
+        fs::path source;
+        fs::path destination;
+        fs::path planned;   // destination before a redirect (a partial copy may be staged there)
+        uint8_t status = 0; // 0 = no marker, else RecordType::Done / Failed
+    };
+
+    struct OpenBatch
+    {
+        std::map<uint32_t, Intent> intents;
+        bool ended = false;
+        bool cancelled = false;
+    };
+
+    bool Exists(const fs::path &path)
+    {
+        std::error_code ec;
+        return fs::exists(fs::symlink_status(path, ec));
+    }
+
+    // rename, or a verified copy + unlink across filesystems
+    bool MoveFile(const fs::path &from, const fs::path &to, std::string &outError)
+    {
+        std::error_code ec;
+        FileCopier::RenameNoReplace(from, to, ec);
+        if (ec == std::errc::cross_device_link)
+        {
+            FileCopier::Result copy;
+            return FileCopier::Move(from, to, copy, outError);
+        }
+        if (ec)
+            outError = ec.message();
+        return !ec;
+    }
+
+    // Whether destination is what the operation made of source (so rolling back may remove it)
+    bool MadeFrom(const Intent &op)
+    {
+        std::error_code ec;
+        switch (op.strategy)
+        {
+        case MoveStrategy::Hardlink:
+            return fs::equivalent(op.source, op.destination, ec);
+        case MoveStrategy::Symlink:
+            return fs::is_symlink(fs::symlink_status(op.destination, ec)) &&
+                   fs::read_symlink(op.destination, ec) == fs::absolute(op.source, ec).lexically_normal();
+        default:
+            return FileCopier::Identical(op.source, op.destination);
+        }
+    }
+
+    // Redo an operation that keeps its source
+    bool Recreate(const Intent &op, std::string &outError)
+    {
+        std::error_code ec;
+        if (op.strategy == MoveStrategy::Hardlink)
+            fs::create_hard_link(op.source, op.destination, ec);
+        else if (op.strategy == MoveStrategy::Symlink)
+            fs::create_symlink(fs::absolute(op.source, ec).lexically_normal(), op.destination, ec);
+        else
+        {
+            FileCopyOptions options;
+            options.reflinkOnly = op.strategy == MoveStrategy::Reflink;
+            FileCopier::Result copy;
+            return FileCopier::Place(op.source, op.destination, copy, outError, options);
+        }
+        if (ec)
+            outError = ec.message();
+        return !ec;
+    }
+
+    // Copies and links: the source never changes, only the destination is made or removed
+    bool ResolveKept(const Intent &op, MoveJournal::Recovery mode, bool startNew, std::string &outProblem)
+    {
+        const bool atDestination = Exists(op.destination);
+        const std::string label = op.source.string() + " -> " + op.destination.string();
+        std::error_code ec;
+
+        if (mode == MoveJournal::Recovery::RollForward)
+        {
+            if (atDestination || !startNew)
+                return false; // done, or never started and not to be
+            if (!Exists(op.source))
+            {
+                outProblem = label + ": source is gone";
+                return false;
+            }
+            std::string error;
+            if (!fs::is_directory(op.destination.parent_path(), ec))
+                fs::create_directories(op.destination.parent_path(), ec);
+            if (Recreate(op, error))
+                return true;
+            outProblem = label + ": " + error;
+            return false;
+        }
+
+        if (!atDestination)
+            return false; // never made
+        // Only what this operation made goes; a file someone else put there stays
+        if (Exists(op.source) && MadeFrom(op) && fs::remove(op.destination, ec))
+            return true;
+        outProblem = label + ": destination was not made from the source";
+        return false;
+    }
+
+    // Deduplication: the destination was there before the batch and is never changed.
+    // A dropped source is put back as a copy of it; a linked source has its name and
+    // content either way, so only forward recovery links it
+    bool ResolveDuplicate(const Intent &op, MoveJournal::Recovery mode, bool startNew, std::string &outProblem)
+    {
+        std::error_code ec;
+        fs::remove(FileCopier::TemporaryPath(op.source), ec);
+        const bool atSource = Exists(op.source);
+        const std::string label = op.source.string() + " -> " + op.destination.string();
+
+        if (!fs::is_regular_file(fs::symlink_status(op.destination, ec)))
+        {
+            if (!atSource)
+                outProblem = label + ": file found at neither path";
+            return false;
+        }
+        if (atSource && !fs::equivalent(op.source, op.destination, ec) && !FileCopier::Identical(op.source, op.destination))
+            return false; // changed since: not a duplicate any more, left alone
+
+        if (mode == MoveJournal::Recovery::RollForward)
+        {
+            if (!atSource || fs::equivalent(op.source, op.destination, ec) || !startNew)
+                return false; // done, or never started and not to be
+            if (op.strategy == MoveStrategy::DropDuplicate)
+                fs::remove(op.source, ec);
+            else
+                FileCopier::ReplaceWithLink(op.destination, op.source, ec);
+            if (!ec)
+                return true;
+            outProblem = label + ": " + ec.message();
+            return false;
+        }
+
+        if (atSource || op.strategy == MoveStrategy::LinkDuplicate)
+            return false;
+        std::string error;
+        FileCopier::Result copy;
+        if (FileCopier::Place(op.destination, op.source, copy, error))
+            return true;
+        outProblem = label + ": cannot restore the source: " + error;
+        return false;
+    }
+
+    // Returns true if the operation was repaired, false if it already was as wanted;
+    // problems are reported through outProblem. Without startNew, rolling forward only
+    // finishes an operation that had started (cancelled batches)
+    bool Resolve(const Intent &op, MoveJournal::Recovery mode, bool startNew, std::string &outProblem)
+    {
+        // A staged copy is never renamed into place before it is complete, and the source
+        // is only unlinked after that: a leftover is always safe to drop
+        std::error_code ec;
+        fs::remove(FileCopier::TemporaryPath(op.destination), ec);
+        if (!op.planned.empty())
+            fs::remove(FileCopier::TemporaryPath(op.planned), ec);
+        if (Deduplicates(op.strategy))
+            return ResolveDuplicate(op, mode, startNew, outProblem);
+        if (KeepsSource(op.strategy))
+            return ResolveKept(op, mode, startNew, outProblem);
+
+        const bool atSource = Exists(op.source);
+        const bool atDestination = Exists(op.destination);
+        const std::string label = op.source.string() + " -> " + op.destination.string();
+        std::string error;
+
+        if (!atSource && !atDestination)
+        {
+            outProblem = label + ": file found at neither path";
+            return false;
+        }
+
+        // Linked but not yet unlinked (the rename fallback without RENAME_NOREPLACE)
+        if (atSource && atDestination && fs::equivalent(op.source, op.destination, ec))
+        {
+            fs::remove(mode == MoveJournal::Recovery::RollForward ? op.source : op.destination, ec);
+            if (!ec)
+                return true;
+            outProblem = label + ": " + ec.message();
+            return false;
+        }
+
+        if (mode == MoveJournal::Recovery::RollForward)
+        {
+            if (!atSource)
+                return false; // done
+            if (!atDestination)
+            {
+                if (!startNew)
+                    return false; // never started, and not to be
+                if (!fs::is_directory(op.destination.parent_path(), ec))
+                    fs::create_directories(op.destination.parent_path(), ec);
+                if (MoveFile(op.source, op.destination, error))
+                    return true;
+                outProblem = label + ": " + error;
+                return false;
+            }
+            // Copied and renamed into place, source not yet unlinked
+            if (op.strategy == MoveStrategy::CopyAndUnlink && FileCopier::Identical(op.source, op.destination) &&
+                fs::remove(op.source, ec))
+                return true;
+            outProblem = label + ": both paths exist and differ";
+            return false;
+        }
+
+        // Roll back
+        if (!atDestination)
+            return false; // never moved
+        if (!atSource)
+        {
+            if (!fs::is_directory(op.source.parent_path(), ec))
+                fs::create_directories(op.source.parent_path(), ec);
+            if (MoveFile(op.destination, op.source, error))
+                return true;
+            outProblem = label + ": cannot move back: " + error;
+            return false;
+        }
+        if (op.strategy == MoveStrategy::CopyAndUnlink && FileCopier::Identical(op.source, op.destination) &&
+            fs::remove(op.destination, ec))
+            return true;
+        outProblem = label + ": both paths exist and differ";
+        return false;
+    }
+}
+
+MoveJournal::MoveJournal(std::string path)
+    : m_path(std::move(path))
+{
+}
+
+MoveJournal::~MoveJournal()
+{
+    if (m_fd >= 0)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Flush(lock);
+        CloseFile(m_fd);
+    }
+}
+
+bool MoveJournal::Recover(Recovery mode, RecoveryReport &out)
+{
+    out = RecoveryReport();
+
+    std::ifstream ifs(m_path, std::ios::binary);
+    if (!ifs.is_open())
+        return true; // no journal yet
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    ifs.close();
+    if (data.size() < HEADER_SIZE || !std::equal(JOURNAL_MAGIC, JOURNAL_MAGIC + 4, data.begin()) ||
+        GetU32(data.data() + 4) != JOURNAL_VERSION)
+    {
+        if (!data.empty())
+            std::cerr << "MoveJournal: " << m_path << " has no valid header; ignoring journal\n";
+        return true;
+    }
+
+    // A torn tail can only be buffered markers or an End: the intents of a batch are
+    // durable before its first operation runs
+    std::map<uint64_t, OpenBatch> batches;
+    size_t pos = HEADER_SIZE;
+    while (pos + 5 <= data.size())
+    {
+        const uint8_t *rec = data.data() + pos;
+        const uint32_t payloadLen = GetU32(rec + 1);
+        if (payloadLen < 8 || pos + 5 + payloadLen + 4 > data.size())
+            break;
+        const uint8_t *payload = rec + 5;
+        if (Checksum(rec, 5 + payloadLen) != GetU32(payload + payloadLen))
+            break;
+
+        const uint64_t batch = GetU64(payload);
+        switch (static_cast<RecordType>(rec[0]))
+        {
+        case RecordType::Begin:
+            batches[batch];
+            break;
+        case RecordType::Intent:
+        {
+            if (payloadLen < 8 + 4 + 1 + 4)
+                break;
+            Intent intent;
+            intent.strategy = static_cast<MoveStrategy>(payload[12]);
+            size_t at = 13;
+            const uint32_t sourceLen = GetU32(payload + at);
+            at += 4;
+            if (at + sourceLen + 4 > payloadLen)
+                break;
+            intent.source = std::string(reinterpret_cast<const char *>(payload + at), sourceLen);
+            at += sourceLen;
+            const uint32_t destinationLen = GetU32(payload + at);
+            at += 4;
+            if (at + destinationLen != payloadLen)
+                break;
+            intent.destination = std::string(reinterpret_cast<const char *>(payload + at), destinationLen);
+            batches[batch].intents[GetU32(payload + 8)] = std::move(intent);
+            break;
+        }
+        case RecordType::Done:
+        case RecordType::Failed:
+            if (payloadLen >= 12)
+            {
+                auto found = batches.find(batch);
+                if (found != batches.end())
+                {
+                    auto intent = found->second.intents.find(GetU32(payload + 8));
+                    if (intent != found->second.intents.end())
+                        intent->second.status = rec[0];
+                }
+            }
+            break;
+        case RecordType::Redirect:
+        {
+            if (payloadLen < 8 + 4 + 4 || 16 + GetU32(payload + 12) != payloadLen)
+                break;
+            auto found = batches.find(batch);
+            if (found == batches.end())
+                break;
+            auto intent = found->second.intents.find(GetU32(payload + 8));
+            if (intent == found->second.intents.end())
+                break;
+            if (intent->second.planned.empty())
+                intent->second.planned = intent->second.destination;
+            intent->second.destination = std::string(reinterpret_cast<const char *>(payload + 16), payloadLen - 16);
+            break;
+        }
+        case RecordType::Fallback:
+        {
+            if (payloadLen != 8 + 4 + 1)
+                break;
+            auto found = batches.find(batch);
+            if (found == batches.end())
+                break;
+            auto intent = found->second.intents.find(GetU32(payload + 8));
+            if (intent != found->second.intents.end())
+                intent->second.strategy = static_cast<MoveStrategy>(payload[12]);
+            break;
+        }
+        case RecordType::Cancel:
+            batches[batch].cancelled = true;
+            break;
+        case RecordType::End:
+            batches[batch].ended = true;
+            break;
+        }
+        pos += 5 + payloadLen + 4;
+    }
+
+    // Unresolved operations are journaled again under their batch, as recovery knows them
+    std::vector<uint8_t> kept;
+    PutHeader(kept);
+    std::set<uint64_t> keptBatches;
+    std::vector<uint8_t> payload;
+    auto keep = [&](uint64_t batchId, const OpenBatch &batch, uint32_t index, const Intent &intent)
+    {
+        if (keptBatches.insert(batchId).second)
+        {
+            payload.clear();
+            PutU64(payload, batchId);
+            PutU32(payload, static_cast<uint32_t>(batch.intents.size()));
+            PutRecord(kept, RecordType::Begin, payload);
+            if (batch.cancelled)
+            {
+                payload.resize(8);
+                PutRecord(kept, RecordType::Cancel, payload);
+            }
+        }
+        payload.clear();
+        PutU64(payload, batchId);
+        PutU32(payload, index);
+        payload.push_back(static_cast<uint8_t>(intent.strategy));
+        PutString(payload, intent.source.string());
+        PutString(payload, (intent.planned.empty() ? intent.destination : intent.planned).string());
+        PutRecord(kept, RecordType::Intent, payload);
+        if (!intent.planned.empty())
+        {
+            payload.resize(12);
+            PutString(payload, intent.destination.string());
+            PutRecord(kept, RecordType::Redirect, payload);
+        }
+    };
+
+    for (const auto &entry : batches)
+    {
+        const OpenBatch &batch = entry.second;
+        if (batch.ended)
+            continue;
+        out.batches++;
+
+        for (const auto &op : batch.intents)
+        {
+            const Intent &intent = op.second;
+            // A failure (or a cancellation) left the source alone and is final either way;
+            // rolling forward, an operation known to be finished needs no look either
+            if (intent.status == uint8_t(RecordType::Failed) ||
+                (intent.status == uint8_t(RecordType::Done) && mode == Recovery::RollForward))
+            {
+                out.intact++;
+                continue;
+            }
+
+            std::string problem;
+            if (Resolve(intent, mode, !batch.cancelled, problem))
+                out.repaired++;
+            else if (problem.empty())
+                out.intact++;
+            else
+            {
+                out.problems.push_back(problem);
+                keep(entry.first, batch, op.first, intent);
+            }
+        }
+    }
+
+    for (const std::string &problem : out.problems)
+        std::cerr << "MoveJournal: unresolved " << problem << "\n";
+
+    {
+        // Kept batches stay open for this session, so Open() and EndBatch() never truncate
+        // them; new batches are numbered past every batch the journal held
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_openBatches = keptBatches;
+        if (!batches.empty())
+            m_nextBatch = std::max(m_nextBatch, batches.rbegin()->first + 1);
+    }
+
+    std::error_code ec;
+    if (keptBatches.empty())
+    {
+        // Everything the journal knew is resolved: start empty
+        fs::remove(m_path, ec);
+        return !ec;
+    }
+
+    // Only the unresolved operations remain, for the next Recover() to retry. Written aside
+    // and renamed over the journal: a crash before the rename leaves the old one, which
+    // recovers to the same result
+    const std::string rewritten = m_path + ".tmp";
+    fs::remove(rewritten, ec);
+    const int fd = OpenAppend(rewritten);
+    bool ok = fd >= 0 && WriteAll(fd, kept.data(), kept.size()) && SyncFile(fd);
+    if (fd >= 0)
+        CloseFile(fd);
+    if (ok)
+    {
+        fs::rename(rewritten, m_path, ec);
+        ok = !ec;
+    }
+    if (!ok)
+    {
+        std::cerr << "MoveJournal: failed to rewrite " << m_path << "; it is kept as it was\n";
+        fs::remove(rewritten, ec);
+    }
+    return ok;
+}
+
+bool MoveJournal::Open()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd >= 0)
+        return true;
+
+    m_fd = OpenAppend(m_path);
+    if (m_fd < 0)
+    {
+        std::cerr << "MoveJournal: failed to open " << m_path << " for appending\n";
+        return false;
+    }
+    return Reset(lock);
+}
+
+void MoveJournal::Append(RecordType type, const std::vector<uint8_t> &payload)
+{
+    PutRecord(m_buffer, type, payload);
+}
+
+uint64_t MoveJournal::BeginBatch(const std::vector<MoveOperation> &operations)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+        return 0;
+
+    const uint64_t batch = m_nextBatch++;
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    PutU32(payload, static_cast<uint32_t>(operations.size()));
+    Append(RecordType::Begin, payload);
+
+    for (size_t i = 0; i < operations.size(); ++i)
+    {
+        const MoveOperation &op = operations[i];
+        payload.clear();
+        PutU64(payload, batch);
+        PutU32(payload, static_cast<uint32_t>(i));
+        payload.push_back(static_cast<uint8_t>(op.strategy));
+        PutString(payload, op.source.string());
+        PutString(payload, op.destination.string());
+        Append(RecordType::Intent, payload);
+    }
+
+    // Open before the flush lets go of the lock, so a concurrent EndBatch cannot take
+    // the journal for empty and truncate these intents away
+    m_openBatches.insert(batch);
+
+    // The intents must be on disk before the first file moves
+    if (!Flush(lock))
+    {
+        m_openBatches.erase(batch);
+        return 0;
+    }
+    return batch;
+}
+
+void MoveJournal::MarkDone(uint64_t batch, size_t index, bool moved)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+        return;
+
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    PutU32(payload, static_cast<uint32_t>(index));
+    Append(moved ? RecordType::Done : RecordType::Failed, payload);
+
+    // Markers only spare recovery work, so nobody waits for them: whoever crosses the
+    // threshold while no flush is running writes them all
+    if (++m_pendingMarkers >= GROUP_COMMIT && !m_flushing)
+        Flush(lock);
+}
+
+bool MoveJournal::Redirect(uint64_t batch, size_t index, const fs::path &destination)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+        return false;
+
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    PutU32(payload, static_cast<uint32_t>(index));
+    PutString(payload, destination.string());
+    Append(RecordType::Redirect, payload);
+
+    // Rare (the plan already avoided every name it saw), so it is synced on its own
+    return Flush(lock);
+}
+
+bool MoveJournal::Fallback(uint64_t batch, size_t index, MoveStrategy strategy)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0)
+        return false;
+
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    PutU32(payload, static_cast<uint32_t>(index));
+    payload.push_back(static_cast<uint8_t>(strategy));
+    Append(RecordType::Fallback, payload);
+
+    // As rare as a redirect, and as binding: synced before the fallback runs
+    return Flush(lock);
+}
+
+bool MoveJournal::Cancel(uint64_t batch)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0 || !m_openBatches.count(batch))
+        return false;
+
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    Append(RecordType::Cancel, payload);
+
+    // Synced before anything is stopped, as a fallback is before it runs
+    return Flush(lock);
+}
+
+bool MoveJournal::EndBatch(uint64_t batch)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_fd < 0 || !m_openBatches.erase(batch))
+        return false;
+
+    // A running flush lets go of the lock: wait it out before deciding, since a batch
+    // begun meanwhile has its intents in the buffer and must not be truncated away
+    m_flushed.wait(lock, [this]()
+                   { return !m_flushing; });
+    if (m_openBatches.empty())
+        return Reset(lock); // nothing left to recover
+
+    std::vector<uint8_t> payload;
+    PutU64(payload, batch);
+    Append(RecordType::End, payload);
+    return Flush(lock);
+}
+
+bool MoveJournal::Flush(std::unique_lock<std::mutex> &lock)
+{
+    m_flushed.wait(lock, [this]()
+                   { return !m_flushing; });
+    if (m_buffer.empty())
+        return true;
+
+    m_flushing = true;
+    std::vector<uint8_t> batch;
+    batch.swap(m_buffer);
+    m_pendingMarkers = 0;
+    lock.unlock();
+
+    const bool ok = WriteAll(m_fd, batch.data(), batch.size()) && SyncFile(m_fd);
+
+    lock.lock();
+    m_flushing = false;
+    m_flushed.notify_all();
+    if (!ok)
+        std::cerr << "MoveJournal: failed to write " << m_path << "\n";
+    return ok;
+}
+
+bool MoveJournal::Reset(std::unique_lock<std::mutex> &lock)
+{
+    m_flushed.wait(lock, [this]()
+                   { return !m_flushing; });
+    if (!m_openBatches.empty())
+        return Flush(lock); // a batch opened while waiting: keep its records
+
+    std::vector<uint8_t> header;
+    PutHeader(header);
+    if (!TruncateFile(m_fd, 0) || !WriteAll(m_fd, header.data(), header.size()) || !SyncFile(m_fd))
+    {
+        std::cerr << "MoveJournal: failed to reset " << m_path << "\n";
+        return false;
+    }
+
+    // Buffered records belong to batches that are all closed now
+    m_buffer.clear();
+    m_pendingMarkers = 0;
+    return true;
+}
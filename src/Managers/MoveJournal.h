@@ -0,0 +1,136 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "MovePlanner.h"
+
+/**
+ * MoveJournal
+ * ------------
+ * Append-only intent journal for move batches (moves.journal).
+ *
+ * Before a plan runs, every operation is written as an intent record and fsynced in one
+ * go; while it runs, each finished operation appends a completion marker. Markers are
+ * group-committed (every GROUP_COMMIT markers, and at the end of a batch) and only save
+ * recovery work: recovery looks at the filesystem, so a marker lost in a crash just
+ * means that operation is examined again. The file is truncated whenever no batch is open.
+ *
+ * A batch without an end record was interrupted. Recover() either rolls it forward
+ * (finishes the operations that did not happen) or rolls it back (moves completed
+ * operations back to their source). Partial copies are always removed. Operations marked
+ * failed left their source alone and stay that way in both directions; in a cancelled
+ * batch, rolling forward only finishes operations that had started. Operations that
+ * keep their source (copies, links) are redone forward; rolling back removes their
+ * destination only if it provably came from the source. A dropped duplicate is rolled
+ * back by copying the identical destination file back to its source.
+ *
+ * Record layout (little-endian), as in TagStore:
+ *   u8 type | u32 payloadLength | payload | u32 checksum(type + payload)
+ * payload = u64 batch [| u32 index [| u8 strategy | u32 len | source | u32 len | destination]]
+ * A redirect payload is u64 batch | u32 index | u32 len | destination; a fallback
+ * payload is u64 batch | u32 index | u8 strategy.
+ */
+class MoveJournal
+{
+public:
+    static constexpr size_t GROUP_COMMIT = 256; // completion markers per fsync
+
+    enum class RecordType : uint8_t
+    {
+        Begin = 1,  // batch, u32 operation count
+        Intent = 2, // batch, index, strategy, source, destination
+        Done = 3,   // batch, index
+        Failed = 4,  // batch, index (source left in place)
+        End = 5,      // batch
+        Redirect = 6, // batch, index, destination (planned name was taken)
+        Fallback = 7, // batch, index, strategy (the planned one was impossible)
+        Cancel = 8    // batch (operations not started yet never will be)
+    };
+
+    enum class Recovery : uint8_t
+    {
+        RollForward = 0, // finish what the batch intended
+        RollBack         // put every file of the batch back where it was
+    };
+
+    struct RecoveryReport
+    {
+        size_t batches = 0;  // interrupted batches found
+        size_t repaired = 0; // operations finished (forward) or reverted (back)
+        size_t intact = 0;   // operations already in the wanted state
+        std::vector<std::string> problems; // operations left alone, with the reason
+    };
+
+    explicit MoveJournal(std::string path);
+    ~MoveJournal();
+
+    /**
+     * Resolve batches left open by a crash, then empty the journal except for the operations
+     * reported as problems: those stay journaled (their batches open) for the next Recover().
+     * Call before Open(). A missing journal is not an error.
+     */
+    bool Recover(Recovery mode, RecoveryReport &out);
+
+    /**
+     * Open the journal for appending (creates it; an existing one is truncated, so Recover() first).
+     */
+    bool Open();
+
+    /**
+     * Durably record the intent to run operations (one write + one fsync).
+     * Returns the batch ID, or 0 if the intent could not be made durable (do not run the batch).
+     */
+    uint64_t BeginBatch(const std::vector<MoveOperation> &operations);
+
+    /**
+     * Completion marker for operation index of batch (moved = false: source left in place).
+     * Buffered; written with the next group commit.
+     */
+    void MarkDone(uint64_t batch, size_t index, bool moved);
+
+    /**
+     * Durably record that operation index of batch will move to destination instead of
+     * its planned name. Must be called before that move: recovery only knows what is here.
+     */
+    bool Redirect(uint64_t batch, size_t index, const std::filesystem::path &destination);
+
+    /**
+     * Durably record that operation index of batch runs as strategy instead of the planned
+     * one. Must be called before it does: recovery checks the strategy recorded here.
+     */
+    bool Fallback(uint64_t batch, size_t index, MoveStrategy strategy);
+
+    /**
+     * Durably record that batch was cancelled, before the executor is told: recovery must
+     * not start its remaining operations even if their failure markers were lost.
+     */
+    bool Cancel(uint64_t batch);
+
+    /**
+     * Close a batch once every operation reported. Truncates the journal when it was the last open one.
+     */
+    bool EndBatch(uint64_t batch);
+
+private:
+    std::string m_path;
+    int m_fd = -1;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_flushed;
+    std::vector<uint8_t> m_buffer; // appended, not yet written
+    bool m_flushing = false;
+    size_t m_pendingMarkers = 0;
+    uint64_t m_nextBatch = 1;
+    std::set<uint64_t> m_openBatches;
+
+    void Append(RecordType type, const std::vector<uint8_t> &payload);
+    bool Flush(std::unique_lock<std::mutex> &lock); // write + fsync the buffer
+    bool Reset(std::unique_lock<std::mutex> &lock); // truncate to the header
+};
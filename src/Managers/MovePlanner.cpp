@@ -0,0 +1,516 @@
+// MovePlanner.cpp
+#include "MovePlanner.h"
+#include "FileFingerprint.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct SourceInfo
+    {
+        uint64_t device = 0;
+        uint64_t inode = 0; // 0 where the platform has none
+        uint64_t size = 0;
+        uint64_t allocated = 0; // bytes backed by blocks (less than size for sparse files)
+        bool regular = false;
+    };
+
+    bool StatSource(const fs::path &source, SourceInfo &out, std::string &outReason)
+    {
+#if defined(_WIN32)
+        std::error_code ec;
+        const fs::file_status status = fs::symlink_status(source, ec);
+        if (!fs::exists(status))
+        {
+            outReason = "missing source";
+            return false;
+        }
+        if (!fs::is_regular_file(status) && !fs::is_symlink(status))
+        {
+            outReason = "not a regular file";
+            return false;
+        }
+        out.regular = fs::is_regular_file(status);
+        out.size = out.regular ? fs::file_size(source, ec) : 0;
+        out.allocated = out.size;
+        return MovePlanner::DeviceOf(source.parent_path(), out.device);
+#else
+        struct stat st;
+        if (::lstat(source.c_str(), &st) != 0)
+        {
+            outReason = "missing source";
+            return false;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISLNK(st.st_mode))
+        {
+            outReason = "not a regular file";
+            return false;
+        }
+        out.device = static_cast<uint64_t>(st.st_dev);
+        out.inode = static_cast<uint64_t>(st.st_ino);
+        out.regular = S_ISREG(st.st_mode);
+        out.size = static_cast<uint64_t>(st.st_size);
+        out.allocated = std::min(out.size, static_cast<uint64_t>(st.st_blocks) * 512);
+        return true;
+#endif
+    }
+
+    // Names in one destination directory: listed once, plus every name this plan hands out
+    struct DirNames
+    {
+        std::unordered_set<std::string> taken;
+        std::unordered_map<std::string, int> nextSuffix; // file name -> next _N to try
+
+        void List(const fs::path &dir)
+        {
+            std::error_code ec;
+            for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+                taken.insert(it->path().filename().string());
+        }
+
+        // Conflict: stem_N.ext, continuing after the last suffix handed out for this name
+        std::string Claim(const fs::path &fileName, int &outSuffix)
+        {
+            std::string name = fileName.string();
+            outSuffix = 0;
+            if (taken.insert(name).second)
+                return name;
+
+            const std::string stem = fileName.stem().string();
+            const std::string ext = fileName.extension().string();
+            int &next = nextSuffix[name];
+            do
+            {
+                name = stem + "_" + std::to_string(++next) + ext;
+            } while (!taken.insert(name).second);
+            outSuffix = next;
+            return name;
+        }
+    };
+
+    // Regular files already in the destination directory (before this plan) named fileName
+    // or one of its _N suffixes, with the size of source: the ones that may be duplicates
+    void FindCandidates(const DirNames &names, const fs::path &dir, const fs::path &fileName, const SourceInfo &source,
+                        std::vector<fs::path> &outCandidates, fs::path &outSameFile)
+    {
+        const std::string stem = fileName.stem().string();
+        const std::string ext = fileName.extension().string();
+        std::string name = fileName.string();
+        for (int suffix = 1; names.taken.count(name); ++suffix)
+        {
+            SourceInfo info;
+            std::string ignored;
+            const fs::path path = dir / name;
+            if (StatSource(path, info, ignored) && info.regular && info.size == source.size)
+            {
+                if (source.inode != 0 && info.inode == source.inode && info.device == source.device)
+                {
+                    outSameFile = path;
+                    outCandidates.clear();
+                    return;
+                }
+                outCandidates.push_back(path);
+            }
+            name = stem + "_" + std::to_string(suffix) + ext;
+        }
+    }
+
+    // Cheapest strategy that does what mode asks for this file pair; false if none can
+    bool ChooseStrategy(OrganizeMode mode, bool sameDevice, MoveStrategy &out, std::string &outReason)
+    {
+        switch (mode)
+        {
+        case OrganizeMode::Move:
+            out = sameDevice ? MoveStrategy::Rename : MoveStrategy::CopyAndUnlink;
+            return true;
+        case OrganizeMode::Mirror:
+            out = sameDevice ? MoveStrategy::Hardlink : MoveStrategy::Copy;
+            return true;
+        case OrganizeMode::Copy:
+            out = MoveStrategy::Copy;
+            return true;
+        case OrganizeMode::Symlink:
+            out = MoveStrategy::Symlink;
+            return true;
+        case OrganizeMode::Reflink:
+            out = MoveStrategy::Reflink;
+            break;
+        case OrganizeMode::Hardlink:
+            out = MoveStrategy::Hardlink;
+            break;
+        }
+        if (!sameDevice)
+            outReason = std::string(OrganizeModeName(mode)) + " needs source and destination on one filesystem";
+        return sameDevice;
+    }
+
+    const char *StrategyLabel(MoveStrategy strategy)
+    {
+        switch (strategy)
+        {
+        case MoveStrategy::Rename:
+            return "rename";
+        case MoveStrategy::CopyAndUnlink:
+            return "copy+unlink";
+        case MoveStrategy::Copy:
+            return "copy";
+        case MoveStrategy::Reflink:
+            return "reflink";
+        case MoveStrategy::Hardlink:
+            return "hardlink";
+        case MoveStrategy::DropDuplicate:
+            return "drop duplicate";
+        case MoveStrategy::LinkDuplicate:
+            return "link duplicate";
+        default:
+            return "symlink";
+        }
+    }
+
+    std::string FormatBytes(uint64_t bytes)
+    {
+        static const char *units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+        double value = static_cast<double>(bytes);
+        size_t unit = 0;
+        while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0]))
+        {
+            value /= 1024.0;
+            ++unit;
+        }
+        std::ostringstream out;
+        out.precision(unit == 0 ? 0 : 1);
+        out << std::fixed << value << " " << units[unit];
+        return out.str();
+    }
+}
+
+MovePlan MovePlanner::Plan(const std::vector<MoveRequest> &requests, const FileCopyOptions &copyOptions,
+                           DuplicatePolicy duplicates)
+{
+    MovePlan plan;
+
+    struct Destination
+    {
+        fs::path dir;
+        uint64_t device = 0;
+        DirNames names;
+    };
+    std::unordered_map<std::string, Destination> destinations; // by normalized directory
+
+    // Requests share a handful of directories: normalize each distinct one once
+    std::unordered_map<std::string, fs::path> normalDirs;
+    auto normalDir = [&normalDirs](const fs::path &dir) -> const fs::path &
+    {
+        auto found = normalDirs.find(dir.string());
+        if (found == normalDirs.end())
+            found = normalDirs.emplace(dir.string(), MovePlanner::NormalDirectory(dir)).first;
+        return found->second;
+    };
+
+    // Copies per destination device, for the free space check
+    struct DeviceNeed
+    {
+        fs::path dir;
+        uint64_t required = 0;
+        std::vector<size_t> operations;
+    };
+    std::map<uint64_t, DeviceNeed> needs;
+
+    // Requests that passed the checks; names are claimed once duplicates are known
+    struct Pending
+    {
+        const MoveRequest *request = nullptr;
+        SourceInfo info;
+        Destination *destination = nullptr;
+        MoveStrategy strategy = MoveStrategy::Rename;
+        std::vector<fs::path> candidates; // same name pattern and size, at the destination
+        fs::path duplicateOf;
+        bool sameFile = false; // duplicateOf is a hard link of the source already
+    };
+    std::vector<Pending> pending;
+    pending.reserve(requests.size());
+
+    for (const MoveRequest &request : requests)
+    {
+        SourceInfo info;
+        std::string reason;
+        if (!StatSource(request.source, info, reason))
+        {
+            plan.skipped.push_back({request.fileId, request.source, reason});
+            continue;
+        }
+
+        const fs::path &destDir = normalDir(request.destinationDir);
+        if (normalDir(request.source.parent_path()) == destDir)
+        {
+            plan.skipped.push_back({request.fileId, request.source, "already in destination"});
+            continue;
+        }
+
+        auto found = destinations.find(destDir.string());
+        if (found == destinations.end())
+        {
+            Destination destination;
+            destination.dir = destDir;
+            MovePlanner::DeviceOf(destDir, destination.device);
+            destination.names.List(destDir);
+            found = destinations.emplace(destDir.string(), std::move(destination)).first;
+        }
+
+        Pending entry;
+        entry.request = &request;
+        entry.info = info;
+        entry.destination = &found->second;
+        if (!ChooseStrategy(request.mode, info.device == entry.destination->device, entry.strategy, reason))
+        {
+            plan.skipped.push_back({request.fileId, request.source, reason});
+            continue;
+        }
+        if (duplicates != DuplicatePolicy::KeepBoth && info.regular)
+        {
+            fs::path sameFile;
+            FindCandidates(entry.destination->names, destDir, request.source.filename(), info, entry.candidates, sameFile);
+            entry.sameFile = !sameFile.empty();
+            entry.duplicateOf = std::move(sameFile);
+        }
+        pending.push_back(std::move(entry));
+    }
+
+    // Candidates that survive the sampled hash are read in full, all of them at once. A
+    // matching hash only plans the deduplication: the executor compares bytes before acting
+    FingerprintCache fingerprints;
+    std::vector<std::pair<size_t, fs::path>> alike; // pending entry, candidate
+    for (size_t i = 0; i < pending.size(); ++i)
+    {
+        FileFingerprint source;
+        if (pending[i].candidates.empty() || !fingerprints.GetSample(pending[i].request->source, source))
+            continue;
+        for (const fs::path &candidate : pending[i].candidates)
+        {
+            FileFingerprint other;
+            if (fingerprints.GetSample(candidate, other) && other.SameSample(source))
+                alike.emplace_back(i, candidate);
+        }
+    }
+    if (!alike.empty())
+    {
+        std::vector<fs::path> paths;
+        std::unordered_map<std::string, size_t> slots;
+        auto slot = [&](const fs::path &path)
+        {
+            auto found = slots.emplace(path.string(), paths.size());
+            if (found.second)
+                paths.push_back(path);
+            return found.first->second;
+        };
+        std::vector<std::pair<size_t, size_t>> pairs;
+        pairs.reserve(alike.size());
+        for (const auto &entry : alike)
+            pairs.emplace_back(slot(pending[entry.first].request->source), slot(entry.second));
+
+        std::vector<FileFingerprint> full;
+        fingerprints.GetFullAll(paths, full);
+        for (size_t k = 0; k < alike.size(); ++k)
+        {
+            const FileFingerprint &a = full[pairs[k].first];
+            const FileFingerprint &b = full[pairs[k].second];
+            Pending &entry = pending[alike[k].first];
+            if (entry.duplicateOf.empty() && a.full != 0 && a.full == b.full && a.SameSample(b))
+                entry.duplicateOf = alike[k].second;
+        }
+    }
+
+    std::vector<MoveOperation> operations;
+    std::vector<bool> conflicted;
+    operations.reserve(pending.size());
+    conflicted.reserve(pending.size());
+
+    for (Pending &entry : pending)
+    {
+        const MoveRequest &request = *entry.request;
+        Destination &destination = *entry.destination;
+
+        MoveOperation op;
+        op.fileId = request.fileId;
+        op.source = request.source;
+        op.mode = request.mode;
+        op.strategy = entry.strategy;
+        op.bytes = entry.info.size;
+        op.sourceDevice = entry.info.device;
+        op.destinationDevice = destination.device;
+
+        if (!entry.duplicateOf.empty())
+        {
+            plan.duplicates++;
+            plan.duplicateBytes += entry.info.size;
+
+            std::string reason = "identical to " + entry.duplicateOf.string();
+            if (duplicates == DuplicatePolicy::Delete && !KeepsSource(entry.strategy))
+                op.strategy = MoveStrategy::DropDuplicate;
+            else if (duplicates == DuplicatePolicy::Hardlink && !entry.sameFile && op.sourceDevice == op.destinationDevice)
+                op.strategy = MoveStrategy::LinkDuplicate;
+            else if (duplicates == DuplicatePolicy::Hardlink && !entry.sameFile)
+                reason += " on another filesystem";
+            else if (entry.sameFile)
+                reason = "already linked as " + entry.duplicateOf.string();
+
+            if (!Deduplicates(op.strategy))
+            {
+                plan.skipped.push_back({request.fileId, request.source, reason});
+                continue;
+            }
+            op.destination = entry.duplicateOf;
+            operations.push_back(std::move(op));
+            conflicted.push_back(false);
+            continue;
+        }
+
+        op.destination = destination.dir / destination.names.Claim(request.source.filename(), op.suffix);
+        const bool renamed = op.suffix != 0;
+        if (CopiesData(op.strategy))
+        {
+            DeviceNeed &need = needs[destination.device];
+            if (need.dir.empty())
+                need.dir = destination.dir;
+            need.required += copyOptions.sparse ? entry.info.allocated : entry.info.size;
+            need.operations.push_back(operations.size());
+        }
+        operations.push_back(std::move(op));
+        conflicted.push_back(renamed);
+    }
+
+    // A device short on space gets none of its copies, rather than the first few
+    std::vector<bool> dropped(operations.size(), false);
+    for (auto &entry : needs)
+    {
+        DeviceNeed &need = entry.second;
+        MovePlan::Space space;
+        space.directory = need.dir;
+        space.device = entry.first;
+        space.required = need.required;
+
+        // Closest existing ancestor: the directory itself may only be created by the move
+        fs::path probe = need.dir;
+        std::error_code ec;
+        while (!fs::exists(probe, ec) && probe.has_relative_path())
+            probe = probe.parent_path();
+        const fs::space_info info = fs::space(probe, ec);
+        space.available = ec ? 0 : static_cast<uint64_t>(info.available);
+
+        if (!space.Fits())
+        {
+            const std::string reason = "not enough space on " + need.dir.string() + " (" + FormatBytes(space.required) +
+                                       " needed, " + FormatBytes(space.available) + " free)";
+            for (size_t index : need.operations)
+            {
+                dropped[index] = true;
+                plan.skipped.push_back({operations[index].fileId, operations[index].source, reason});
+            }
+        }
+        plan.space.push_back(space);
+    }
+
+    for (size_t i = 0; i < operations.size(); ++i)
+    {
+        if (dropped[i])
+            continue;
+        MoveOperation &op = operations[i];
+        plan.totalBytes += op.bytes;
+        if (op.strategy == MoveStrategy::Rename)
+            plan.renames++;
+        else if (Deduplicates(op.strategy))
+            plan.deduplicated++;
+        else if (CopiesData(op.strategy))
+            plan.copyBytes += op.bytes;
+        else
+            plan.links++;
+        if (conflicted[i])
+            plan.conflicts++;
+        plan.operations.push_back(std::move(op));
+    }
+
+    return plan;
+}
+
+std::string MovePlan::Describe() const
+{
+    std::ostringstream out;
+    for (const MoveOperation &op : operations)
+    {
+        out << "[" << StrategyLabel(op.strategy);
+        if (CopiesData(op.strategy))
+            out << " " << FormatBytes(op.bytes);
+        out << "] ";
+        out << op.source.string() << " -> " << op.destination.string() << "\n";
+    }
+    for (const Skipped &skip : skipped)
+        out << "[skip] " << skip.source.string() << ": " << skip.reason << "\n";
+    for (const Space &device : space)
+    {
+        out << "[space] " << device.directory.string() << ": " << FormatBytes(device.required) << " needed, "
+            << FormatBytes(device.available) << " free" << (device.Fits() ? "" : " (too little)") << "\n";
+    }
+
+    out << operations.size() << " files (" << renames << " renamed in place, " << links << " linked, "
+        << (operations.size() - renames - links - deduplicated) << " copied, " << FormatBytes(copyBytes)
+        << " to copy of " << FormatBytes(totalBytes) << ")";
+    if (conflicts)
+        out << ", " << conflicts << " renamed to avoid a name conflict";
+    if (duplicates)
+        out << ", " << duplicates << " already there (" << deduplicated << " deduplicated, "
+            << FormatBytes(duplicateBytes) << " not placed again)";
+    if (!skipped.empty())
+        out << ", " << skipped.size() << " skipped";
+    out << "\n";
+    return out.str();
+}
+
+fs::path MovePlanner::NormalDirectory(const fs::path &dir)
+{
+    std::error_code ec;
+    fs::path normal = fs::absolute(dir, ec).lexically_normal();
+    if (!normal.has_filename() && normal.has_relative_path())
+        normal = normal.parent_path(); // trailing separator
+    return normal;
+}
+
+bool MovePlanner::DeviceOf(const fs::path &path, uint64_t &outDevice)
+{
+#if defined(_WIN32)
+    // One device per drive / share
+    std::error_code ec;
+    const fs::path absolute = fs::absolute(path, ec);
+    if (ec)
+        return false;
+    outDevice = std::hash<std::string>{}(absolute.root_name().string());
+    return true;
+#else
+    fs::path probe = path.empty() ? fs::path(".") : path;
+    while (true)
+    {
+        struct stat st;
+        if (::stat(probe.c_str(), &st) == 0)
+        {
+            outDevice = static_cast<uint64_t>(st.st_dev);
+            return true;
+        }
+        fs::path parent = probe.parent_path();
+        if (parent.empty())
+            parent = "."; // relative path: the working directory
+        if (parent == probe)
+            return false;
+        probe = parent;
+    }
+#endif
+}
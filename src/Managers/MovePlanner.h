@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "FileCopier.h"
+#include "OrganizeMode.h"
+
+/**
+ * One file to move into a destination directory (planner input).
+ */
+struct MoveRequest
+{
+    size_t fileId = 0;
+    std::filesystem::path source;
+    std::filesystem::path destinationDir;
+    OrganizeMode mode = OrganizeMode::Move;
+};
+
+enum class MoveStrategy : uint8_t
+{
+    Rename = 0,    // same filesystem: metadata only
+    CopyAndUnlink, // across filesystems: FileCopier::Move
+    Copy,          // source kept: FileCopier::Place
+    Reflink,       // source kept: FileCopier::Place, clone only (same filesystem)
+    Hardlink,      // source kept: link() (same filesystem)
+    Symlink,       // source kept: symlink to the absolute source path
+    DropDuplicate, // destination already holds the same content: unlink the source
+    LinkDuplicate  // destination already holds the same content: source becomes a hard link to it
+};
+
+// Whether the operation leaves its source in place
+inline bool KeepsSource(MoveStrategy strategy)
+{
+    return strategy != MoveStrategy::Rename && strategy != MoveStrategy::CopyAndUnlink &&
+           strategy != MoveStrategy::DropDuplicate;
+}
+
+// Whether the operation only deduplicates against a file that was already at its destination
+inline bool Deduplicates(MoveStrategy strategy)
+{
+    return strategy == MoveStrategy::DropDuplicate || strategy == MoveStrategy::LinkDuplicate;
+}
+
+/**
+ * What to do when a file with the same name and the same content is already at the destination.
+ */
+enum class DuplicatePolicy : uint8_t
+{
+    KeepBoth = 0, // place the file under a _N suffix, as for any name conflict
+    Skip,         // leave the source alone
+    Delete,       // unlink the source (Move only; modes that keep their source skip instead)
+    Hardlink      // make the source a hard link to the existing file (one filesystem, else skip)
+};
+
+// Whether the operation writes file data (and needs the space for it)
+inline bool CopiesData(MoveStrategy strategy)
+{
+    return strategy == MoveStrategy::CopyAndUnlink || strategy == MoveStrategy::Copy;
+}
+
+/**
+ * One planned move: the destination name is final, collisions are already resolved.
+ * For DropDuplicate / LinkDuplicate, destination is the identical file already there.
+ */
+struct MoveOperation
+{
+    size_t fileId = 0;
+    std::filesystem::path source;
+    std::filesystem::path destination;
+    MoveStrategy strategy = MoveStrategy::Rename;
+    OrganizeMode mode = OrganizeMode::Move; // what was asked for (Mirror may fall back at run time)
+    uint64_t bytes = 0; // file size
+    int suffix = 0;     // _N added to the source's name to avoid a conflict, 0 = none
+    uint64_t sourceDevice = 0;
+    uint64_t destinationDevice = 0;
+};
+
+/**
+ * Result of MovePlanner::Plan: what would happen, without anything having happened.
+ */
+struct MovePlan
+{
+    struct Skipped
+    {
+        size_t fileId = 0;
+        std::filesystem::path source;
+        std::string reason;
+    };
+
+    // Free space on a destination filesystem that receives copies
+    struct Space
+    {
+        std::filesystem::path directory; // a destination directory on the device
+        uint64_t device = 0;
+        uint64_t required = 0;  // bytes the copies will allocate there
+        uint64_t available = 0; // free for this user, at planning time
+        bool Fits() const { return required <= available; }
+    };
+
+    std::vector<MoveOperation> operations;
+    std::vector<Skipped> skipped;
+    std::vector<Space> space;
+
+    size_t renames = 0;          // operations that only rename
+    size_t links = 0;            // operations that write no data (hard / symbolic links, reflinks)
+    size_t conflicts = 0;        // operations whose destination name got a _N suffix
+    size_t deduplicated = 0;     // operations that drop or link a duplicate
+    size_t duplicates = 0;       // sources identical to a file at their destination (deduplicated or skipped)
+    uint64_t duplicateBytes = 0; // their size: data that is not placed again
+    uint64_t totalBytes = 0;     // size of every planned file
+    uint64_t copyBytes = 0;      // size of the files that will be copied
+
+    bool Empty() const { return operations.empty(); }
+
+    /**
+     * Human-readable dry run: one line per operation and skipped file, then the totals.
+     */
+    std::string Describe() const;
+};
+
+/**
+ * MovePlanner
+ * ------------
+ * Turns move requests into a MovePlan before anything touches the disk.
+ *
+ * Each destination directory is listed once into an in-memory name set; collisions are
+ * resolved against that set (stem_N.ext, counting up from the last suffix handed out), so
+ * planning costs one directory scan per destination plus one lstat per source instead
+ * of a stat per candidate name. Files that would not fit on their destination filesystem
+ * are skipped as a whole device, so a plan never starts a copy it cannot finish.
+ *
+ * Each request's OrganizeMode becomes a strategy by device identity: Move renames on one
+ * filesystem and copies + unlinks across; Mirror hard links on one filesystem and copies
+ * across. Hardlink and Reflink need one filesystem and skip the file otherwise.
+ *
+ * When a name is taken, the DuplicatePolicy may compare contents before adding a suffix:
+ * size first (one lstat), then a sampled hash of head and tail, then a full hash of the
+ * files that still match, read in parallel. Only regular files count as duplicates.
+ *
+ * The plan is a snapshot: it is only as current as the directories when they were listed.
+ */
+class MovePlanner
+{
+public:
+    /**
+     * copyOptions decide how much space a copy will allocate (sparse copies skip holes).
+     */
+    static MovePlan Plan(const std::vector<MoveRequest> &requests, const FileCopyOptions &copyOptions = FileCopyOptions(),
+                         DuplicatePolicy duplicates = DuplicatePolicy::KeepBoth);
+
+    /**
+     * Device identity of path, or of its closest existing ancestor (destinations may not
+     * exist yet). Returns false if nothing along the path can be stat'ed.
+     */
+    static bool DeviceOf(const std::filesystem::path &path, uint64_t &outDevice);
+
+    /**
+     * Absolute, normalized, without a trailing separator: the one form in which directories
+     * are compared (a tag's destination, a request's, a source's parent).
+     */
+    static std::filesystem::path NormalDirectory(const std::filesystem::path &dir);
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/**
+ * What organizing a file into its destination does to it, set per tag or per job.
+ *
+ * Only Move takes the file away from its source; every other mode leaves the source as it
+ * is, for read-only archives and backups. The planner turns a mode into a MoveStrategy per
+ * file, by whether source and destination share a filesystem.
+ */
+enum class OrganizeMode : uint8_t
+{
+    Move = 0, // rename, or copy + unlink across filesystems
+    Mirror,   // keep the source, cheapest way: hard link on one filesystem, else a copy
+    Copy,     // keep the source: a copy (reflinked where the filesystem can clone)
+    Reflink,  // keep the source: copy-on-write clone, shares the data (one filesystem)
+    Hardlink, // keep the source: second name for the same file (one filesystem)
+    Symlink   // keep the source: symbolic link to it (a "symlink farm")
+};
+
+inline const char *OrganizeModeName(OrganizeMode mode)
+{
+    switch (mode)
+    {
+    case OrganizeMode::Mirror:
+        return "mirror";
+    case OrganizeMode::Copy:
+        return "copy";
+    case OrganizeMode::Reflink:
+        return "reflink";
+    case OrganizeMode::Hardlink:
+        return "hardlink";
+    case OrganizeMode::Symlink:
+        return "symlink";
+    default:
+        return "move";
+    }
+}
+
+inline bool ParseOrganizeMode(const std::string &name, OrganizeMode &out)
+{
+    for (OrganizeMode mode : {OrganizeMode::Move, OrganizeMode::Mirror, OrganizeMode::Copy, OrganizeMode::Reflink,
+                              OrganizeMode::Hardlink, OrganizeMode::Symlink})
+    {
+        if (name == OrganizeModeName(mode))
+        {
+            out = mode;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,56 @@
+// RateLimiter.cpp
+#include "RateLimiter.h"
+
+#include <algorithm>
+
+RateLimiter::RateLimiter(uint64_t perSecond)
+    : m_rate(perSecond), m_tokens(static_cast<double>(perSecond)), m_last(Clock::now())
+{
+}
+
+void RateLimiter::SetRate(uint64_t perSecond)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Refill(Clock::now());
+        if (m_rate == 0)
+            m_tokens = static_cast<double>(perSecond); // start limiting with a full bucket
+        m_rate = perSecond;
+        m_tokens = std::min(m_tokens, static_cast<double>(perSecond));
+    }
+    m_rateChanged.notify_all();
+}
+
+uint64_t RateLimiter::GetRate() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_rate;
+}
+
+void RateLimiter::Acquire(uint64_t tokens)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_rate != 0)
+    {
+        Refill(Clock::now());
+
+        // Wait for the request, or for a full bucket if it is larger than that
+        const double need = std::min(static_cast<double>(tokens), static_cast<double>(m_rate));
+        if (m_tokens >= need)
+        {
+            m_tokens -= static_cast<double>(tokens);
+            return;
+        }
+        const std::chrono::duration<double> wait((need - m_tokens) / static_cast<double>(m_rate));
+        m_rateChanged.wait_for(lock, wait);
+    }
+}
+
+void RateLimiter::Refill(Clock::time_point now)
+{
+    const std::chrono::duration<double> elapsed = now - m_last;
+    m_last = now;
+    if (m_rate == 0)
+        return;
+    m_tokens = std::min(static_cast<double>(m_rate), m_tokens + elapsed.count() * static_cast<double>(m_rate));
+}
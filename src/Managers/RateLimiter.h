@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/**
+ * RateLimiter
+ * ------------
+ * Token bucket: tokens (bytes, operations, ...) refill at a rate per second, and up to one
+ * second's worth can be saved up as a burst.
+ *
+ * Acquire() blocks until its tokens are there. A request larger than the burst puts the
+ * bucket into debt that later callers wait off, so the long-run rate holds for any request
+ * size. The rate can change at any time; waiting callers pick up the new rate at once.
+ */
+class RateLimiter
+{
+public:
+    explicit RateLimiter(uint64_t perSecond = 0); // 0 = unlimited
+
+    void SetRate(uint64_t perSecond);
+    uint64_t GetRate() const;
+
+    void Acquire(uint64_t tokens);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_rateChanged;
+    uint64_t m_rate = 0;
+    double m_tokens = 0.0; // negative while in debt
+    Clock::time_point m_last;
+
+    void Refill(Clock::time_point now);
+};
@@ -1,10 +1,41 @@
 #include "SearchManager.h"
+#include "XattrTagStore.h"
 #include <iostream>
+#include <cstring>
+#include <iterator>
+
+#if !defined(_WIN32)
+#include <sys/stat.h>
+#endif
 
 namespace fs = std::filesystem;
 
+// ------------------ Identity keys ------------------
+
+// Path key: used where the platform gives us no inode, and for second links to one inode
+static std::string MakePathKey(const fs::path &path)
+{
+    return "P" + path.string();
+}
+
+// Device + inode key, so a file keeps its handle when renamed inside the tree
+static std::string MakeIdentityKey(const fs::path &path)
+{
+#if !defined(_WIN32)
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0)
+    {
+        std::string key(1 + sizeof(st.st_dev) + sizeof(st.st_ino), 'I');
+        std::memcpy(&key[1], &st.st_dev, sizeof(st.st_dev));
+        std::memcpy(&key[1 + sizeof(st.st_dev)], &st.st_ino, sizeof(st.st_ino));
+        return key;
+    }
+#endif
+    return MakePathKey(path);
+}
+
 SearchManager::SearchManager(SearchMode mode)
-    : m_NextFileID(0), m_lastMode(mode)
+    : m_scanEpoch(0), m_lastMode(mode)
 {
 }
 
@@ -14,10 +45,15 @@ bool SearchManager::LoadMetaData(const std::string &path, SearchMode mode)
 
     currentDirectoryPath = filePath;
     m_lastMode = mode;
-    m_NextFileID = 0;
-    m_files.clear();
+    ++m_scanEpoch;
+    m_lastDelta.Clear();
+
+    // Keep the previous records so files found again keep their handle and tags
+    std::vector<FileData> previous;
+    previous.swap(m_files);
     m_filePathIndexMap.clear();
 
+    bool ok = true;
     if (mode == SearchMode::TOP_LEVEL)
     {
         for (const auto &entry : fs::directory_iterator(filePath))
@@ -26,18 +62,11 @@ bool SearchManager::LoadMetaData(const std::string &path, SearchMode mode)
             FileData file = getFileData(entry);
             if (file.fileID == -1)
             {
-                return false;
+                ok = false;
+                break;
             }
-            file.fileID = m_NextFileID;
-            m_NextFileID++;
-
-            // pushing the actual file data to vector
-            m_files.push_back(file);
-            // pushing file ID as key and its index to value (for fast look ups in the vector)
-            m_filePathIndexMap[file.path.string()] = m_files.size() - 1;
+            IndexScannedFile(file, previous);
         }
-
-        return true;
     }
     else if (mode == SearchMode::RECURSIVE)
     {
@@ -46,23 +75,21 @@ bool SearchManager::LoadMetaData(const std::string &path, SearchMode mode)
             FileData file = getFileData(entry);
             if (file.fileID == -1)
             {
-                return false;
+                ok = false;
+                break;
             }
-            file.fileID = m_NextFileID;
-            m_NextFileID++;
-
-            // pushing the actual file data to vector
-            m_files.push_back(file);
-            // pushing file ID as key and its index to value (for fast look ups in the vector)
-            m_filePathIndexMap[file.path.string()] = m_files.size() - 1;
+            IndexScannedFile(file, previous);
         }
-        return true;
     }
     else
     {
         std::cout << "Unexpected error occured in mode search";
-        return false;
+        ok = false;
     }
+
+    // Files of the previous scan that were not found again; their records went away with `previous`
+    DropUnseenFiles(false);
+    return ok;
 }
 
 FileData SearchManager::getFileData(const fs::directory_entry &entry)
@@ -70,9 +97,7 @@ FileData SearchManager::getFileData(const fs::directory_entry &entry)
     FileData file;
     try
     {
-        // setting File ID
-        // file.fileID = m_NextFileID;
-        // m_NextFileID++;
+        // File ID / handle are assigned by the caller (AcquireSlot)
 
         // Setting File Name
         file.name = entry.path().stem().string();
@@ -98,6 +123,20 @@ FileData SearchManager::getFileData(const fs::directory_entry &entry)
             file.type = FileType::MISC;
         }
 
+        // Setting size (regular files only)
+        if (file.type == FileType::REGULAR_FILE)
+        {
+            std::error_code ec;
+            file.size = entry.file_size(ec);
+            if (ec)
+                file.size = 0;
+        }
+
+        // Setting stored tags (xattr backend), in the same pass that stats the entry
+        // (a file whose attribute cannot be read just has none)
+        if (m_readXattrTags && (file.type == FileType::REGULAR_FILE || file.type == FileType::DIRECTORY))
+            XattrTagStore::Read(file.path, file.xattrTags);
+
         // Setting modified time
 
         fs::file_time_type lastWriteTime = fs::last_write_time(entry.path());
@@ -118,9 +157,12 @@ FileData SearchManager::getFileData(const fs::directory_entry &entry)
     }
 }
 
+
 bool SearchManager::Refresh()
 {
     const bool isRecursive = (m_lastMode == SearchMode::RECURSIVE);
+    ++m_scanEpoch;
+    m_lastDelta.Clear();
 
     try
     {
@@ -129,58 +171,16 @@ bool SearchManager::Refresh()
         {
             for (const auto &entry : fs::recursive_directory_iterator(currentDirectoryPath))
             {
-                auto pathStr = entry.path().string();
-                auto it = m_filePathIndexMap.find(pathStr);
-
-                if (it != m_filePathIndexMap.end())
-                {
-                    FileData refreshFile = getFileData(entry);
-                    auto &stored = m_files[it->second];
-
-                    if (refreshFile.modifiedTime != stored.modifiedTime)
-                    {
-                        refreshFile.fileID = stored.fileID;
-                        stored = refreshFile;
-                    }
-                }
-                else
-                {
-                    FileData file = getFileData(entry);
-                    if (file.fileID == -1)
-                        return false;
-
-                    file.fileID = m_NextFileID++;
-                    m_files.push_back(file);
-                }
+                if (!RefreshEntry(entry))
+                    return false;
             }
         }
         else
         {
             for (const auto &entry : fs::directory_iterator(currentDirectoryPath))
             {
-                auto pathStr = entry.path().string();
-                auto it = m_filePathIndexMap.find(pathStr);
-
-                if (it != m_filePathIndexMap.end())
-                {
-                    FileData refreshFile = getFileData(entry);
-                    auto &stored = m_files[it->second];
-
-                    if (refreshFile.modifiedTime != stored.modifiedTime)
-                    {
-                        refreshFile.fileID = stored.fileID;
-                        stored = refreshFile;
-                    }
-                }
-                else
-                {
-                    FileData file = getFileData(entry);
-                    if (file.fileID == -1)
-                        return false;
-
-                    file.fileID = m_NextFileID++;
-                    m_files.push_back(file);
-                }
+                if (!RefreshEntry(entry))
+                    return false;
             }
         }
     }
@@ -190,36 +190,397 @@ bool SearchManager::Refresh()
         return false;
     }
 
+    DropUnseenFiles(true);
     return true;
 }
 
-const std::vector<FileData> &SearchManager::GetAllFiles() const
+// ------------------ Handle helpers ------------------
+
+uint32_t SearchManager::AcquireSlot(const FileData &file, const std::vector<FileData> &records, bool &isNew)
 {
-    return m_files;
+    std::string key = MakeIdentityKey(file.path);
+    auto it = m_slotByKey.find(key);
+    if (it != m_slotByKey.end() && m_slots[it->second].seenEpoch == m_scanEpoch)
+    {
+        // Inode already claimed in this scan (hard link, or a symlink to an indexed file)
+        key = MakePathKey(file.path);
+        it = m_slotByKey.find(key);
+    }
+    else if (it != m_slotByKey.end())
+    {
+        // A rename keeps size and mtime; anything else under a known inode means the
+        // old file was deleted and the inode reused, so the old slot must not be inherited
+        HandleSlot &hs = m_slots[it->second];
+        if (hs.fileIndex < records.size())
+        {
+            const FileData &old = records[hs.fileIndex];
+            if (old.path != file.path && (old.size != file.size || old.modifiedTime != file.modifiedTime))
+            {
+                m_slotByKey.erase(it);
+                hs.key.clear();
+                it = m_slotByKey.end();
+            }
+        }
+    }
+
+    if (it != m_slotByKey.end())
+    {
+        m_slots[it->second].seenEpoch = m_scanEpoch;
+        isNew = false;
+        return it->second;
+    }
+
+    uint32_t slot;
+    if (!m_freeSlots.empty())
+    {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    }
+    else
+    {
+        slot = static_cast<uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+    }
+
+    HandleSlot &hs = m_slots[slot];
+    hs.used = true;
+    hs.seenEpoch = m_scanEpoch;
+    hs.fileIndex = SIZE_MAX;
+    hs.key = key;
+    m_slotByKey.emplace(std::move(key), slot);
+    isNew = true;
+    return slot;
 }
 
-const FileData *SearchManager::FindFileByID(int id) const
+void SearchManager::ReleaseSlot(uint32_t slot)
 {
-    for (auto &file : m_files)
+    HandleSlot &hs = m_slots[slot];
+    if (!hs.key.empty())
+        m_slotByKey.erase(hs.key);
+    hs.key.clear();
+    hs.used = false;
+    hs.fileIndex = SIZE_MAX;
+    ++hs.generation; // invalidates every outstanding handle to this slot
+    m_freeSlots.push_back(slot);
+}
+
+void SearchManager::IndexScannedFile(FileData &file, const std::vector<FileData> &previous)
+{
+    bool isNew = false;
+    const uint32_t slot = AcquireSlot(file, previous, isNew);
+    HandleSlot &hs = m_slots[slot];
+
+    file.handle = {slot, hs.generation};
+    file.fileID = static_cast<int>(slot);
+
+    if (!isNew && hs.fileIndex < previous.size())
+    {
+        const FileData &old = previous[hs.fileIndex];
+        file.tags = old.tags;
+        if (old.path != file.path)
+            m_lastDelta.renamed.emplace_back(file.handle, old.path);
+        else if (old.modifiedTime != file.modifiedTime)
+            m_lastDelta.modified.push_back(file.handle);
+    }
+    else
+    {
+        m_lastDelta.added.push_back(file.handle);
+    }
+
+    m_files.push_back(std::move(file));
+    hs.fileIndex = m_files.size() - 1;
+    m_filePathIndexMap[m_files.back().path.string()] = hs.fileIndex;
+}
+
+bool SearchManager::RefreshEntry(const fs::directory_entry &entry)
+{
+    auto pathStr = entry.path().string();
+    auto it = m_filePathIndexMap.find(pathStr);
+
+    if (it != m_filePathIndexMap.end())
     {
-        if (file.fileID == id)
+        auto &stored = m_files[it->second];
+        HandleSlot &hs = m_slots[stored.handle.slot];
+        hs.seenEpoch = m_scanEpoch;
+
+        FileData refreshFile = getFileData(entry);
+        if (refreshFile.modifiedTime != stored.modifiedTime)
         {
-            return &file;
+            // Editors often save by replacing the file; follow the new inode
+            std::string key = MakeIdentityKey(refreshFile.path);
+            if (key != hs.key && m_slotByKey.find(key) == m_slotByKey.end())
+            {
+                m_slotByKey.erase(hs.key);
+                hs.key = key;
+                m_slotByKey.emplace(std::move(key), stored.handle.slot);
+            }
+
+            refreshFile.fileID = stored.fileID;
+            refreshFile.handle = stored.handle;
+            refreshFile.tags = stored.tags;
+            stored = refreshFile;
+            m_lastDelta.modified.push_back(stored.handle);
         }
+        return true;
     }
-    return nullptr;
+
+    FileData file = getFileData(entry);
+    if (file.fileID == -1)
+        return false;
+
+    bool isNew = false;
+    const uint32_t slot = AcquireSlot(file, m_files, isNew);
+    HandleSlot &hs = m_slots[slot];
+
+    if (!isNew && hs.fileIndex < m_files.size())
+    {
+        // Known inode under a new path: renamed / moved inside the tree
+        auto &stored = m_files[hs.fileIndex];
+        fs::path oldPath = stored.path;
+        m_filePathIndexMap.erase(oldPath.string());
+
+        file.fileID = stored.fileID;
+        file.handle = stored.handle;
+        file.tags = stored.tags;
+        stored = std::move(file);
+        m_filePathIndexMap[pathStr] = hs.fileIndex;
+        m_lastDelta.renamed.emplace_back(stored.handle, std::move(oldPath));
+        return true;
+    }
+
+    file.handle = {slot, hs.generation};
+    file.fileID = static_cast<int>(slot);
+    m_files.push_back(std::move(file));
+    hs.fileIndex = m_files.size() - 1;
+    m_filePathIndexMap[pathStr] = hs.fileIndex;
+    m_lastDelta.added.push_back(m_files.back().handle);
+    return true;
 }
 
-FileData *SearchManager::FindFileByID(int id)
+void SearchManager::DropUnseenFiles(bool recordsInIndex)
 {
-    for (auto &file : m_files)
+    for (uint32_t slot = 0; slot < m_slots.size(); ++slot)
     {
-        if (file.fileID == id)
+        HandleSlot &hs = m_slots[slot];
+        if (!hs.used || hs.seenEpoch == m_scanEpoch)
+            continue;
+
+        if (recordsInIndex && hs.fileIndex < m_files.size())
+            EraseRecord(hs.fileIndex);
+
+        m_lastDelta.removed.push_back({slot, hs.generation});
+        ReleaseSlot(slot);
+    }
+}
+
+// Swap-remove; the record moved into the hole keeps its handle, only its index changes
+void SearchManager::EraseRecord(std::size_t index)
+{
+    m_filePathIndexMap.erase(m_files[index].path.string());
+    if (index != m_files.size() - 1)
+    {
+        m_files[index] = std::move(m_files.back());
+        m_slots[m_files[index].handle.slot].fileIndex = index;
+        m_filePathIndexMap[m_files[index].path.string()] = index;
+    }
+    m_files.pop_back();
+}
+
+// ------------------ Moves ------------------
+
+// target spelled the way a scan of currentDirectoryPath would list it, or empty if a scan
+// in the current mode would not list it. indexParents adds the directories a move created
+// between the root and target that such a scan would list.
+fs::path SearchManager::ScannedPath(const fs::path &target, bool indexParents)
+{
+    std::error_code ec;
+    fs::path root = fs::absolute(currentDirectoryPath, ec).lexically_normal();
+    if (!root.has_filename() && root.has_relative_path())
+        root = root.parent_path();
+    const fs::path relative = fs::absolute(target, ec).lexically_normal().lexically_relative(root);
+    if (ec || relative.empty() || *relative.begin() == ".." || *relative.begin() == ".")
+        return fs::path();
+
+    const bool recursive = m_lastMode == SearchMode::RECURSIVE;
+    fs::path scanned = currentDirectoryPath;
+    size_t depth = 0;
+    for (auto it = relative.begin(); it != relative.end(); ++it)
+    {
+        scanned /= *it;
+        ++depth;
+        if (std::next(it) == relative.end())
+            break;
+        if (indexParents && (recursive || depth == 1) && !m_filePathIndexMap.count(scanned.string()))
         {
-            return &file;
+            const fs::directory_entry entry(scanned, ec);
+            if (!ec)
+                RefreshEntry(entry);
         }
     }
-    return nullptr;
+    return (recursive || depth == 1) ? scanned : fs::path();
+}
+
+void SearchManager::ApplyMoves(const std::vector<IndexMove> &moves)
+{
+    m_lastDelta.Clear();
+    for (const IndexMove &move : moves)
+    {
+        const fs::path to = ScannedPath(move.to, true);
+        auto found = move.keepsSource ? m_filePathIndexMap.end() : m_filePathIndexMap.find(move.from.string());
+        if (found == m_filePathIndexMap.end())
+        {
+            // A copy or link, or a move of a file this index never had
+            std::error_code ec;
+            const fs::directory_entry entry(to, ec);
+            if (!to.empty() && !ec && !m_filePathIndexMap.count(to.string()))
+                RefreshEntry(entry);
+            continue;
+        }
+
+        const std::size_t index = found->second;
+        const uint32_t slot = m_files[index].handle.slot;
+        HandleSlot &hs = m_slots[slot];
+        FileData moved;
+        moved.fileID = -1;
+        if (!to.empty() && !m_filePathIndexMap.count(to.string()))
+        {
+            std::error_code ec;
+            const fs::directory_entry entry(to, ec);
+            if (!ec)
+                moved = getFileData(entry);
+        }
+        if (moved.fileID == -1)
+        {
+            // Out of the tree, or onto a file indexed already: the tags follow the path
+            m_lastDelta.relocated.emplace_back(move.from, to.empty() ? move.to : to);
+            m_lastDelta.removed.push_back(m_files[index].handle);
+            EraseRecord(index);
+            ReleaseSlot(slot);
+            continue;
+        }
+
+        // A copy across filesystems is a new inode; a second link to one keeps the path key
+        std::string key = MakeIdentityKey(to);
+        auto owner = m_slotByKey.find(key);
+        if (owner != m_slotByKey.end() && owner->second != slot)
+            key = MakePathKey(to);
+        if (key != hs.key)
+        {
+            m_slotByKey.erase(hs.key);
+            hs.key = key;
+            m_slotByKey.emplace(std::move(key), slot);
+        }
+
+        FileData &stored = m_files[index];
+        moved.fileID = stored.fileID;
+        moved.handle = stored.handle;
+        moved.tags = stored.tags;
+        fs::path oldPath = std::move(stored.path);
+        stored = std::move(moved);
+        m_filePathIndexMap.erase(found);
+        m_filePathIndexMap[to.string()] = index;
+        m_lastDelta.renamed.emplace_back(stored.handle, std::move(oldPath));
+    }
+}
+
+// ------------------ Queries ------------------
+
+const std::vector<FileData> &SearchManager::GetAllFiles() const
+{
+    return m_files;
+}
+
+void SearchManager::SetReadXattrTags(bool enabled)
+{
+    m_readXattrTags = enabled;
+}
+
+bool SearchManager::GetReadXattrTags() const
+{
+    return m_readXattrTags;
+}
+
+const IndexDelta &SearchManager::GetLastDelta() const
+{
+    return m_lastDelta;
+}
+
+std::vector<std::size_t> SearchManager::GetLastRefreshDelta() const
+{
+    std::vector<std::size_t> indices;
+    indices.reserve(m_lastDelta.added.size() + m_lastDelta.modified.size() + m_lastDelta.renamed.size());
+
+    auto push = [&](FileHandle handle)
+    {
+        if (auto index = GetFileIndex(handle))
+            indices.push_back(*index);
+    };
+    for (const auto &h : m_lastDelta.added)
+        push(h);
+    for (const auto &h : m_lastDelta.modified)
+        push(h);
+    for (const auto &r : m_lastDelta.renamed)
+        push(r.first);
+    return indices;
+}
+
+const FileData *SearchManager::Resolve(FileHandle handle) const
+{
+    auto index = GetFileIndex(handle);
+    return index ? &m_files[*index] : nullptr;
+}
+
+FileData *SearchManager::Resolve(FileHandle handle)
+{
+    auto index = GetFileIndex(handle);
+    return index ? &m_files[*index] : nullptr;
+}
+
+std::optional<std::size_t> SearchManager::GetFileIndex(FileHandle handle) const
+{
+    if (handle.slot >= m_slots.size())
+        return std::nullopt;
+    const HandleSlot &hs = m_slots[handle.slot];
+    if (!hs.used || hs.generation != handle.generation || hs.fileIndex >= m_files.size())
+        return std::nullopt;
+    return hs.fileIndex;
+}
+
+FileHandle SearchManager::GetHandle(const fs::path &path) const
+{
+    const FileData *file = FindFileByPath(path);
+    return file ? file->handle : FileHandle{};
+}
+
+std::size_t SearchManager::GetSlotCount() const
+{
+    return m_slots.size();
+}
+
+const FileData *SearchManager::GetFileByIndex(std::size_t index) const
+{
+    return index < m_files.size() ? &m_files[index] : nullptr;
+}
+
+FileData *SearchManager::GetFileByIndex(std::size_t index)
+{
+    return index < m_files.size() ? &m_files[index] : nullptr;
+}
+
+const FileData *SearchManager::FindFileByID(int id) const
+{
+    if (id < 0 || static_cast<std::size_t>(id) >= m_slots.size())
+        return nullptr;
+    const HandleSlot &hs = m_slots[id];
+    return (hs.used && hs.fileIndex < m_files.size()) ? &m_files[hs.fileIndex] : nullptr;
+}
+
+FileData *SearchManager::FindFileByID(int id)
+{
+    if (id < 0 || static_cast<std::size_t>(id) >= m_slots.size())
+        return nullptr;
+    const HandleSlot &hs = m_slots[id];
+    return (hs.used && hs.fileIndex < m_files.size()) ? &m_files[hs.fileIndex] : nullptr;
 }
 
 const FileData *SearchManager::FindFileByName(const std::string &name) const
@@ -5,6 +5,11 @@
 #include <unordered_map>
 #include <chrono>
 #include <filesystem>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "TagSet.h"
 
 enum class SearchMode
 {
@@ -20,13 +25,66 @@ enum class FileType
     MISC
 };
 
+/**
+ * Stable reference to an indexed file.
+ *
+ * Stays valid across Refresh() and LoadMetaData() for as long as the same file
+ * (same device + inode where available, same path otherwise) remains indexed,
+ * including when it is renamed inside the scanned tree. Once the file drops out
+ * of the index its slot's generation is bumped, so a stale handle resolves to nullptr
+ * even after the slot is reused.
+ */
+struct FileHandle
+{
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool IsValid() const { return slot != UINT32_MAX; }
+    bool operator==(const FileHandle &other) const { return slot == other.slot && generation == other.generation; }
+    bool operator!=(const FileHandle &other) const { return !(*this == other); }
+};
+
+/**
+ * Changes made to the index by the last LoadMetaData() / Refresh() / ApplyMoves().
+ */
+struct IndexDelta
+{
+    std::vector<FileHandle> added;                                        // newly indexed files
+    std::vector<FileHandle> modified;                                     // same file, new mtime
+    std::vector<std::pair<FileHandle, std::filesystem::path>> renamed;    // same file, new path (old path kept here)
+    std::vector<FileHandle> removed;                                      // dropped from the index (handles now stale)
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> relocated; // moved, record removed: old, new path
+
+    void Clear()
+    {
+        added.clear();
+        modified.clear();
+        renamed.clear();
+        removed.clear();
+        relocated.clear();
+    }
+};
+
+/**
+ * A file FileManager moved, copied or linked, for SearchManager::ApplyMoves.
+ */
+struct IndexMove
+{
+    std::filesystem::path from;
+    std::filesystem::path to;
+    bool keepsSource = false; // to is a new file (copy or link), from is unchanged
+};
+
 struct FileData
 {
-    int fileID;
+    int fileID = 0; // == handle.slot; stable across rescans, dense (usable as a bitmap index)
+    FileHandle handle;
     std::string name;
     std::filesystem::path path;
     FileType type;
-    std::string tag;
+    std::uintmax_t size = 0; // bytes, regular files only
+    TagSet tags; // forward index (file -> tags), maintained by TagManager
+    TagSet xattrTags; // tags stored on the file itself, read by the scan (xattr backend only)
     std::chrono::system_clock::time_point modifiedTime;
 };
 
@@ -40,6 +98,38 @@ public:
 
     const std::vector<FileData> &GetAllFiles() const;
 
+    // Read each file's user.foldersort.tags attribute during the scan (see XattrTagStore)
+    void SetReadXattrTags(bool enabled);
+    bool GetReadXattrTags() const;
+
+    /**
+     * Apply finished moves without a rescan. A moved file keeps its record, handle and tags
+     * under its new path when a scan would list that path; otherwise (moved out of the tree,
+     * or onto a file indexed already) the record goes and the move is reported as relocated.
+     * Copies and links that a scan would list are added, as are new destination directories.
+     * Replaces the last IndexDelta, so follow with TagManager::SyncWithIndex.
+     */
+    void ApplyMoves(const std::vector<IndexMove> &moves);
+
+    // Changes applied by the last LoadMetaData() / Refresh() / ApplyMoves()
+    const IndexDelta &GetLastDelta() const;
+
+    // Indices of files added, modified or renamed by the last Refresh()
+    std::vector<std::size_t> GetLastRefreshDelta() const;
+
+    // ------------------ Stable handles (O(1)) ------------------
+
+    const FileData *Resolve(FileHandle handle) const; // nullptr if stale
+    FileData *Resolve(FileHandle handle);
+    std::optional<std::size_t> GetFileIndex(FileHandle handle) const;
+    FileHandle GetHandle(const std::filesystem::path &path) const; // invalid if not indexed
+
+    // Upper bound (exclusive) of fileID / handle slots; size for ID-keyed bitmaps
+    std::size_t GetSlotCount() const;
+
+    const FileData *GetFileByIndex(std::size_t index) const; // nullptr if out of range
+    FileData *GetFileByIndex(std::size_t index);
+
     const FileData *FindFileByID(int id) const; // for immutable data
     FileData *FindFileByID(int id);             // for tag marking
 
@@ -52,11 +142,36 @@ public:
 private:
     std::vector<FileData> m_files;
     std::unordered_map<std::string, std::size_t> m_filePathIndexMap;
+    IndexDelta m_lastDelta;
+
+    // Handle table: slot -> current record. Identity key is (device, inode) where
+    // available, else the path; m_slotByKey maps it back to the slot.
+    struct HandleSlot
+    {
+        uint32_t generation = 0;
+        std::size_t fileIndex = SIZE_MAX;
+        uint64_t seenEpoch = 0;
+        bool used = false;
+        std::string key;
+    };
+    std::vector<HandleSlot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    std::unordered_map<std::string, uint32_t> m_slotByKey;
+    uint64_t m_scanEpoch;
 
-    int m_NextFileID;
     SearchMode m_lastMode;
     std::filesystem::path currentDirectoryPath;
+    bool m_readXattrTags = false;
 
     // utils method
     FileData getFileData(const std ::filesystem::directory_entry &entry);
+
+    // handle helpers
+    uint32_t AcquireSlot(const FileData &file, const std::vector<FileData> &records, bool &isNew);
+    void ReleaseSlot(uint32_t slot);
+    void IndexScannedFile(FileData &file, const std::vector<FileData> &previous);
+    bool RefreshEntry(const std::filesystem::directory_entry &entry);
+    void DropUnseenFiles(bool recordsInIndex);
+    void EraseRecord(std::size_t index);
+    std::filesystem::path ScannedPath(const std::filesystem::path &target, bool indexParents);
 };
\ No newline at end of file
@@ -0,0 +1,533 @@
+// TagHistory.cpp
+#include "TagHistory.h"
+#include "TagStore.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char HISTORY_MAGIC[4] = {'F', 'S', 'U', 'H'};
+    constexpr uint32_t HISTORY_VERSION = 2;
+
+    // ------------------ Encoding ------------------
+
+    void PutVarint(std::vector<uint8_t> &out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(v));
+    }
+
+    bool GetVarint(const std::vector<uint8_t> &in, size_t &pos, uint64_t &out)
+    {
+        out = 0;
+        for (int shift = 0; shift < 64 && pos < in.size(); shift += 7)
+        {
+            const uint8_t b = in[pos++];
+            out |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void PutU32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    uint32_t GetU32(const uint8_t *p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    // FNV-1a, enough to detect a torn or foreign file
+    uint32_t Checksum(const uint8_t *data, size_t size)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= data[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    // Sorted indices as count + gaps
+    void PutIndices(std::vector<uint8_t> &out, std::vector<uint32_t> &indices)
+    {
+        std::sort(indices.begin(), indices.end());
+        PutVarint(out, indices.size());
+        uint32_t previous = 0;
+        for (uint32_t index : indices)
+        {
+            PutVarint(out, index - previous);
+            previous = index;
+        }
+    }
+
+    bool GetIndices(const std::vector<uint8_t> &in, size_t &pos, size_t limit, std::vector<uint32_t> &out)
+    {
+        uint64_t count = 0;
+        if (!GetVarint(in, pos, count) || count > limit)
+            return false;
+        out.clear();
+        out.reserve(static_cast<size_t>(count));
+        uint64_t value = 0;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            uint64_t gap = 0;
+            if (!GetVarint(in, pos, gap))
+                return false;
+            value += gap;
+            if (value >= limit)
+                return false;
+            out.push_back(static_cast<uint32_t>(value));
+        }
+        return true;
+    }
+}
+
+// ------------------ FileSet ------------------
+
+TagHistory::FileSet TagHistory::FileSet::From(const FileBitmap &files)
+{
+    std::vector<uint32_t> ids;
+    files.ForEach([&](size_t id)
+                  { ids.push_back(static_cast<uint32_t>(id)); });
+    return FromSorted(std::move(ids));
+}
+
+TagHistory::FileSet TagHistory::FileSet::FromSorted(std::vector<uint32_t> ids)
+{
+    FileSet set;
+    set.m_count = ids.size();
+    if (ids.empty())
+        return set;
+
+    // 4 bytes per ID vs. 1 bit per ID up to the highest one
+    const size_t bitmapBytes = (size_t(ids.back()) / 64 + 1) * 8;
+    if (bitmapBytes < ids.size() * sizeof(uint32_t))
+    {
+        set.m_dense = true;
+        set.m_bitmap.Resize(size_t(ids.back()) + 1);
+        for (uint32_t id : ids)
+            set.m_bitmap.Set(id);
+    }
+    else
+    {
+        set.m_ids = std::move(ids);
+        set.m_ids.shrink_to_fit();
+    }
+    return set;
+}
+
+size_t TagHistory::FileSet::Bytes() const
+{
+    return sizeof(FileSet) + (m_dense ? m_bitmap.Words().size() * sizeof(uint64_t) : m_ids.size() * sizeof(uint32_t));
+}
+
+FileBitmap TagHistory::FileSet::ToBitmap() const
+{
+    if (m_dense)
+        return m_bitmap;
+    FileBitmap out(m_ids.empty() ? 0 : size_t(m_ids.back()) + 1);
+    for (uint32_t id : m_ids)
+        out.Set(id);
+    return out;
+}
+
+void TagHistory::FileSet::Subtract(const FileBitmap &files)
+{
+    std::vector<uint32_t> kept;
+    ForEach([&](size_t id)
+            {
+        if (!files.Test(id))
+            kept.push_back(static_cast<uint32_t>(id)); });
+    if (kept.size() != m_count)
+        *this = FromSorted(std::move(kept));
+}
+
+size_t TagHistory::Step::Bytes() const
+{
+    size_t bytes = sizeof(Step);
+    for (const Change &change : changes)
+        bytes += sizeof(TagId) + change.added.Bytes() + change.removed.Bytes();
+    return bytes;
+}
+
+// ------------------ Recording ------------------
+
+void TagHistory::Record(TagId tag, size_t fileId, bool added)
+{
+    auto &entry = m_pending[tag];
+    FileBitmap &same = added ? entry.first : entry.second;
+    FileBitmap &opposite = added ? entry.second : entry.first;
+    if (opposite.Test(fileId))
+        opposite.Reset(fileId); // e.g. retag back and forth within one step
+    else
+        same.Set(fileId);
+}
+
+bool TagHistory::CommitStep()
+{
+    return PushPending(nullptr);
+}
+
+// The pending changes as one step (over paths, if given) on the undo stack
+bool TagHistory::PushPending(std::shared_ptr<const std::vector<std::string>> paths)
+{
+    Step step;
+    step.paths = std::move(paths);
+    for (auto &entry : m_pending)
+    {
+        Change change;
+        change.tag = entry.first;
+        change.added = FileSet::From(entry.second.first);
+        change.removed = FileSet::From(entry.second.second);
+        if (!change.added.Empty() || !change.removed.Empty())
+            step.changes.push_back(std::move(change));
+    }
+    m_pending.clear();
+    if (step.changes.empty())
+        return false;
+
+    // Deterministic order (the pending map is unordered)
+    std::sort(step.changes.begin(), step.changes.end(), [](const Change &a, const Change &b)
+              { return a.tag < b.tag; });
+
+    for (const Step &redo : m_redo)
+        Account(redo, false);
+    m_redo.clear();
+    PushUndo(std::move(step));
+    ++m_events;
+    return true;
+}
+
+// ------------------ Undo / redo ------------------
+
+bool TagHistory::PopUndo(Step &out)
+{
+    if (m_undo.empty())
+        return false;
+    out = std::move(m_undo.back());
+    m_undo.pop_back();
+    Account(out, false);
+    return true;
+}
+
+bool TagHistory::PopRedo(Step &out)
+{
+    if (m_redo.empty())
+        return false;
+    out = std::move(m_redo.back());
+    m_redo.pop_back();
+    Account(out, false);
+    return true;
+}
+
+void TagHistory::PushUndo(Step step)
+{
+    Account(step, true);
+    m_undo.push_back(std::move(step));
+    Evict();
+}
+
+void TagHistory::PushRedo(Step step)
+{
+    Account(step, true);
+    m_redo.push_back(std::move(step));
+    Evict();
+}
+
+void TagHistory::ForgetFiles(const FileBitmap &files)
+{
+    for (std::deque<Step> *stack : {&m_undo, &m_redo})
+    {
+        for (Step &step : *stack)
+        {
+            if (step.paths)
+                continue; // indexes a path table, not file IDs
+            m_bytes -= step.Bytes();
+            for (Change &change : step.changes)
+            {
+                change.added.Subtract(files);
+                change.removed.Subtract(files);
+            }
+            m_bytes += step.Bytes();
+        }
+    }
+}
+
+void TagHistory::SetBudget(size_t bytes)
+{
+    m_budget = bytes;
+    Evict();
+}
+
+// A step entering or leaving the stacks. The path table of loaded steps is shared, so it
+// counts once, for as long as any stacked step still indexes it
+void TagHistory::Account(const Step &step, bool entering)
+{
+    const size_t bytes = step.Bytes();
+    if (entering)
+        m_bytes += bytes;
+    else
+        m_bytes -= bytes;
+    if (!step.paths)
+        return;
+    if (entering && m_pathSteps++ == 0)
+        m_bytes += m_pathBytes;
+    else if (!entering && --m_pathSteps == 0)
+        m_bytes -= m_pathBytes;
+}
+
+// Oldest undo steps go first, then the redo steps furthest from the present
+void TagHistory::Evict()
+{
+    while (m_bytes > m_budget && !m_undo.empty())
+    {
+        Account(m_undo.front(), false);
+        m_undo.pop_front();
+    }
+    while (m_bytes > m_budget && !m_redo.empty())
+    {
+        Account(m_redo.front(), false);
+        m_redo.pop_front();
+    }
+}
+
+// ------------------ Persistence ------------------
+
+// Layout (after magic + u32 version; varints unless noted):
+//   events, pathCount, { length, bytes }*
+//   undoCount, step*, redoCount, step*        step = changeCount, { tag, added, removed }*
+//   set = count, gap*  (indices into the path table)
+//   u32 checksum of everything before it
+bool TagHistory::Save(const std::string &path, const std::function<std::string(size_t fileId)> &pathOf) const
+{
+    // One path table for every step: live steps resolve IDs now, loaded steps bring their own table
+    std::vector<std::string> table;
+    std::unordered_map<std::string, uint32_t> tableIndex;
+    auto intern = [&](const std::string &filePath) -> uint32_t
+    {
+        auto it = tableIndex.find(filePath);
+        if (it != tableIndex.end())
+            return it->second;
+        const uint32_t index = static_cast<uint32_t>(table.size());
+        table.push_back(filePath);
+        tableIndex.emplace(filePath, index);
+        return index;
+    };
+
+    std::vector<uint8_t> body;
+    auto putSet = [&](const Step &step, const FileSet &set)
+    {
+        std::vector<uint32_t> indices;
+        set.ForEach([&](size_t id)
+                    {
+            const std::string filePath = step.paths ? (id < step.paths->size() ? (*step.paths)[id] : std::string())
+                                                    : pathOf(id);
+            if (!filePath.empty())
+                indices.push_back(intern(filePath)); });
+        PutIndices(body, indices);
+    };
+    for (const std::deque<Step> *stack : {&m_undo, &m_redo})
+    {
+        PutVarint(body, stack->size());
+        for (const Step &step : *stack)
+        {
+            PutVarint(body, step.changes.size());
+            for (const Change &change : step.changes)
+            {
+                PutVarint(body, change.tag);
+                putSet(step, change.added);
+                putSet(step, change.removed);
+            }
+        }
+    }
+
+    std::vector<uint8_t> data(HISTORY_MAGIC, HISTORY_MAGIC + 4);
+    PutU32(data, HISTORY_VERSION);
+    PutVarint(data, m_events);
+    PutVarint(data, table.size());
+    for (const std::string &filePath : table)
+    {
+        PutVarint(data, filePath.size());
+        data.insert(data.end(), filePath.begin(), filePath.end());
+    }
+    data.insert(data.end(), body.begin(), body.end());
+    PutU32(data, Checksum(data.data(), data.size()));
+
+    // Durable before the log it covers is reset
+    return TagStore::WriteSnapshot(path, std::string(data.begin(), data.end()));
+}
+
+bool TagHistory::Load(const std::string &path)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open())
+        return true; // no history yet
+
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    if (data.size() < 12 || !std::equal(HISTORY_MAGIC, HISTORY_MAGIC + 4, data.begin()) ||
+        GetU32(data.data() + 4) != HISTORY_VERSION ||
+        Checksum(data.data(), data.size() - 4) != GetU32(data.data() + data.size() - 4))
+    {
+        std::cerr << "TagHistory: " << path << " is corrupt or from another version; ignoring it\n";
+        return false;
+    }
+
+    const std::vector<uint8_t> content(data.begin(), data.end() - 4);
+    size_t pos = 8;
+    uint64_t events = 0;
+    uint64_t pathCount = 0;
+    if (!GetVarint(content, pos, events) || !GetVarint(content, pos, pathCount) || pathCount > content.size())
+        return false;
+    auto table = std::make_shared<std::vector<std::string>>();
+    table->reserve(static_cast<size_t>(pathCount));
+    for (uint64_t i = 0; i < pathCount; ++i)
+    {
+        uint64_t length = 0;
+        if (!GetVarint(content, pos, length) || length > content.size() - pos)
+            return false;
+        table->emplace_back(reinterpret_cast<const char *>(content.data() + pos), static_cast<size_t>(length));
+        pos += static_cast<size_t>(length);
+    }
+
+    std::deque<Step> stacks[2];
+    for (std::deque<Step> &stack : stacks)
+    {
+        uint64_t stepCount = 0;
+        if (!GetVarint(content, pos, stepCount))
+            return false;
+        for (uint64_t s = 0; s < stepCount; ++s)
+        {
+            Step step;
+            step.paths = table;
+            uint64_t changeCount = 0;
+            if (!GetVarint(content, pos, changeCount))
+                return false;
+            for (uint64_t c = 0; c < changeCount; ++c)
+            {
+                uint64_t tag = 0;
+                std::vector<uint32_t> added;
+                std::vector<uint32_t> removed;
+                if (!GetVarint(content, pos, tag) || !GetIndices(content, pos, table->size(), added) ||
+                    !GetIndices(content, pos, table->size(), removed))
+                {
+                    std::cerr << "TagHistory: " << path << " is truncated; ignoring it\n";
+                    return false;
+                }
+                Change change;
+                change.tag = static_cast<TagId>(tag);
+                change.added = FileSet::FromSorted(std::move(added));
+                change.removed = FileSet::FromSorted(std::move(removed));
+                step.changes.push_back(std::move(change));
+            }
+            stack.push_back(std::move(step));
+        }
+    }
+
+    m_undo = std::move(stacks[0]);
+    m_redo = std::move(stacks[1]);
+    m_events = events;
+    m_replayTable = table;
+    m_pending.clear();
+    m_bytes = 0;
+    m_pathSteps = 0;
+    m_pathBytes = sizeof(*table);
+    for (const std::string &entry : *table)
+        m_pathBytes += sizeof(std::string) + entry.capacity();
+    for (const std::deque<Step> *stack : {&m_undo, &m_redo})
+        for (const Step &step : *stack)
+            Account(step, true);
+    Evict();
+    return true;
+}
+
+// ------------------ Log replay ------------------
+
+void TagHistory::ReplayRecord(TagId tag, const std::string &path, bool added)
+{
+    if (!m_replayTable)
+    {
+        m_replayTable = std::make_shared<std::vector<std::string>>();
+        m_pathBytes = sizeof(*m_replayTable);
+    }
+    if (m_replayIndex.empty())
+    {
+        for (size_t i = 0; i < m_replayTable->size(); ++i)
+            m_replayIndex.emplace((*m_replayTable)[i], static_cast<uint32_t>(i));
+    }
+
+    auto it = m_replayIndex.find(path);
+    if (it == m_replayIndex.end())
+    {
+        it = m_replayIndex.emplace(path, static_cast<uint32_t>(m_replayTable->size())).first;
+        m_replayTable->push_back(path);
+        const size_t bytes = sizeof(std::string) + m_replayTable->back().capacity();
+        m_pathBytes += bytes;
+        if (m_pathSteps > 0)
+            m_bytes += bytes;
+    }
+    m_replayRecords.push_back({tag, {it->second, added}});
+}
+
+// A step may be committed in several parts (one explicit batch, several log commits):
+// parts with the same event are collected into one step
+void TagHistory::ReplayStepEnd(uint64_t event)
+{
+    if (event > m_events)
+    {
+        if (event != m_replayStep)
+        {
+            CloseReplayedStep();
+            m_replayStep = event;
+        }
+        for (const auto &record : m_replayRecords)
+            Record(record.first, record.second.first, record.second.second);
+    }
+    m_replayRecords.clear(); // otherwise in the file already
+}
+
+void TagHistory::ReplayMove(uint64_t event, bool undo)
+{
+    CloseReplayedStep();
+    if (event <= m_events)
+        return;
+
+    Step step;
+    if (undo && PopUndo(step))
+        PushRedo(std::move(step));
+    else if (!undo && PopRedo(step))
+        PushUndo(std::move(step));
+    m_events = event;
+}
+
+void TagHistory::FinishReplay()
+{
+    CloseReplayedStep();
+    m_replayRecords.clear();
+    m_replayIndex.clear();
+    m_replayTable.reset(); // the steps keep what they index
+}
+
+void TagHistory::CloseReplayedStep()
+{
+    if (m_replayStep == 0)
+        return;
+    if (PushPending(m_replayTable))
+        m_events = m_replayStep;
+    m_replayStep = 0;
+}
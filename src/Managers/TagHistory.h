@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "FileBitmap.h"
+#include "TagSet.h"
+
+/**
+ * TagHistory
+ * -----------
+ * Bounded undo / redo stacks of tag assignment changes (tags.history).
+ *
+ * A step records, per tag it touched, the files (by ID) that gained and lost the tag;
+ * undoing it is "remove from gained, add to lost" for each tag. File sets are kept as
+ * sorted IDs or as a bitmap, whichever is smaller, so a one-file change costs a few bytes
+ * and a 1M-file assignment about 128 KiB. The oldest steps are evicted once the history
+ * exceeds its byte budget.
+ *
+ * On disk, file IDs (runtime-only) are replaced by paths: one path table, then every
+ * set as delta-encoded varints into it. Loaded steps keep that table and are mapped
+ * back to file IDs when they are undone or redone (see Step::paths).
+ *
+ * Every committed step and every move between the stacks is a numbered event. The file
+ * holds the stacks as of one event; TagManager logs the events after it in the tag log
+ * and replays them on top (see the Replay* calls), skipping those the file already covers.
+ */
+class TagHistory
+{
+public:
+    static constexpr size_t DEFAULT_BUDGET_BYTES = 64ull * 1024 * 1024;
+
+    /**
+     * Set of file IDs in the smaller of two encodings.
+     */
+    class FileSet
+    {
+    public:
+        static FileSet From(const FileBitmap &files);
+        static FileSet FromSorted(std::vector<uint32_t> ids);
+
+        bool Empty() const { return m_count == 0; }
+        size_t Count() const { return m_count; }
+        size_t Bytes() const;
+
+        FileBitmap ToBitmap() const;
+        void Subtract(const FileBitmap &files); // re-encodes
+
+        template <typename Fn>
+        void ForEach(Fn &&fn) const
+        {
+            if (m_dense)
+                m_bitmap.ForEach(fn);
+            else
+                for (uint32_t id : m_ids)
+                    fn(size_t(id));
+        }
+
+    private:
+        std::vector<uint32_t> m_ids; // sparse: sorted IDs
+        FileBitmap m_bitmap;         // dense: bitmap trimmed to the highest ID
+        bool m_dense = false;
+        size_t m_count = 0;
+    };
+
+    struct Change
+    {
+        TagId tag = INVALID_TAG_ID;
+        FileSet added;   // files that gained the tag
+        FileSet removed; // files that lost the tag
+    };
+
+    struct Step
+    {
+        std::vector<Change> changes;
+        // Set for steps loaded from disk: their sets index this path table, not file IDs
+        std::shared_ptr<const std::vector<std::string>> paths;
+
+        size_t Bytes() const;
+    };
+
+    // ------------------ Recording ------------------
+
+    /**
+     * Note that a file gained (added = true) or lost a tag. A change that cancels an
+     * earlier one in the same step removes it instead.
+     */
+    void Record(TagId tag, size_t fileId, bool added);
+
+    /**
+     * Close the step being recorded: push it onto the undo stack and clear the redo stack.
+     * Returns false (nothing pushed) if the step is empty; otherwise it is the next event.
+     */
+    bool CommitStep();
+
+    /**
+     * Number of events so far (committed steps, undos, redos). Undo / redo moves are
+     * counted by the caller, which may take a failed one back.
+     */
+    uint64_t Events() const { return m_events; }
+    void SetEvents(uint64_t events) { m_events = events; }
+
+    // ------------------ Undo / redo ------------------
+
+    bool CanUndo() const { return !m_undo.empty(); }
+    bool CanRedo() const { return !m_redo.empty(); }
+    const Step *PeekUndo() const { return m_undo.empty() ? nullptr : &m_undo.back(); }
+    const Step *PeekRedo() const { return m_redo.empty() ? nullptr : &m_redo.back(); }
+
+    bool PopUndo(Step &out);
+    bool PopRedo(Step &out);
+    void PushUndo(Step step); // keeps the redo stack
+    void PushRedo(Step step);
+
+    /**
+     * Drop files that left the index from every in-memory step, so a reused file ID
+     * never inherits another file's history.
+     */
+    void ForgetFiles(const FileBitmap &files);
+
+    void SetBudget(size_t bytes);
+    size_t GetBudget() const { return m_budget; }
+    size_t Bytes() const { return m_bytes; }
+
+    // ------------------ Persistence ------------------
+
+    /**
+     * Write both stacks and the event count to path (atomically and durably).
+     * pathOf maps a file ID of an in-memory step to its path; empty = skip the file.
+     * Commit the open step first: it is not saved.
+     */
+    bool Save(const std::string &path, const std::function<std::string(size_t fileId)> &pathOf) const;
+
+    /**
+     * Replace both stacks with the contents of path. A missing file is not an error;
+     * a corrupt one is ignored (and reported).
+     */
+    bool Load(const std::string &path);
+
+    // ------------------ Log replay ------------------
+    // After Load(): the events logged since the file was saved, in log order. Replayed
+    // steps index the loaded path table (extended as needed), like loaded steps.
+
+    void ReplayRecord(TagId tag, const std::string &path, bool added);
+    void ReplayStepEnd(uint64_t event);         // the records since the last call belong to step event
+    void ReplayMove(uint64_t event, bool undo); // an undo (redo) moved the newest step across
+    void FinishReplay();
+
+private:
+    std::deque<Step> m_undo; // back = most recent
+    std::deque<Step> m_redo; // back = next to redo
+    size_t m_bytes = 0; // steps, plus the path table while a loaded step is stacked
+    size_t m_budget = DEFAULT_BUDGET_BYTES;
+    size_t m_pathBytes = 0; // path table of the loaded steps
+    size_t m_pathSteps = 0; // stacked steps that index it
+    uint64_t m_events = 0;
+
+    // Step being recorded: tag -> (gained, lost)
+    std::unordered_map<TagId, std::pair<FileBitmap, FileBitmap>> m_pending;
+
+    // Replay state: the path table being extended, records not yet claimed by a step end,
+    // and the event of the step collecting them in m_pending (0 = none)
+    std::shared_ptr<std::vector<std::string>> m_replayTable;
+    std::unordered_map<std::string, uint32_t> m_replayIndex;
+    std::vector<std::pair<TagId, std::pair<uint32_t, bool>>> m_replayRecords;
+    uint64_t m_replayStep = 0;
+
+    bool PushPending(std::shared_ptr<const std::vector<std::string>> paths);
+    void CloseReplayedStep();
+    void Account(const Step &step, bool entering);
+    void Evict();
+};
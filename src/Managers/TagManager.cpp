@@ -1,11 +1,21 @@
 // TagManager.cpp
 #include "TagManager.h"
+#include "TagRuleEngine.h"
+#include "TagStore.h"
+#include "XattrTagStore.h"
+#include "FileFingerprint.h"
+#include "TagQuery.h"
+#include "MovePlanner.h"
 
 #include <filesystem>
 #include <fstream>
 #include <optional>
 #include <iostream> // only for debugging/logging, remove or replace with engine logger
 #include <cstdio>   // std::remove / std::rename
+#include <cstdlib>  // std::strtoull
+#include <algorithm>
+#include <atomic>
+#include <deque>
 
 // nlohmann json
 #include "../../include/json/json.hpp"
@@ -15,30 +25,496 @@ using json = nlohmann::json;
 namespace fs = std::filesystem;
 
 static constexpr const char *TAG_JSON_FILENAME = "tags.json";
+static constexpr const char *TAG_LOG_FILENAME = "tags.wal";
+static constexpr const char *TAG_HISTORY_FILENAME = "tags.history";
+
+// Fold the log into a fresh tags.json snapshot once it grows past this size
+static constexpr uint64_t COMPACT_LOG_BYTES = 4ull * 1024 * 1024;
+
+static json RuleToJson(const TagRule &rule)
+{
+    json r;
+    r["tag"] = rule.tag;
+    r["priority"] = rule.priority;
+    if (!rule.extensions.empty())
+        r["extensions"] = rule.extensions;
+    if (!rule.globs.empty())
+        r["globs"] = rule.globs;
+    if (rule.minSize)
+        r["minSize"] = rule.minSize;
+    if (rule.maxSize)
+        r["maxSize"] = rule.maxSize;
+    if (rule.minAgeDays)
+        r["minAgeDays"] = rule.minAgeDays;
+    if (rule.maxAgeDays)
+        r["maxAgeDays"] = rule.maxAgeDays;
+    if (rule.stop)
+        r["stop"] = true;
+    return r;
+}
+
+static TagRule RuleFromJson(const json &r)
+{
+    TagRule rule;
+    rule.tag = r.value("tag", "");
+    rule.priority = r.value("priority", 0);
+    rule.extensions = r.value("extensions", std::vector<std::string>());
+    rule.globs = r.value("globs", std::vector<std::string>());
+    rule.minSize = r.value("minSize", std::uintmax_t(0));
+    rule.maxSize = r.value("maxSize", std::uintmax_t(0));
+    rule.minAgeDays = r.value("minAgeDays", uint32_t(0));
+    rule.maxAgeDays = r.value("maxAgeDays", uint32_t(0));
+    rule.stop = r.value("stop", false);
+    return rule;
+}
+
+// SetFingerprint log record text: path '\0' size | sample | full (little-endian u64)
+static std::string EncodeFingerprintRecord(const std::string &path, const FileFingerprint &fp)
+{
+    std::string text = path;
+    text.push_back('\0');
+    for (uint64_t v : {fp.size, fp.sample, fp.full})
+    {
+        for (int i = 0; i < 8; ++i)
+            text.push_back(static_cast<char>(v >> (8 * i)));
+    }
+    return text;
+}
+
+static bool DecodeFingerprintRecord(const std::string &text, std::string &outPath, FileFingerprint &outFp)
+{
+    const size_t sep = text.find('\0');
+    if (sep == std::string::npos || text.size() != sep + 1 + 24)
+        return false;
+
+    outPath = text.substr(0, sep);
+    uint64_t values[3] = {};
+    for (int v = 0; v < 3; ++v)
+    {
+        for (int i = 0; i < 8; ++i)
+            values[v] |= uint64_t(static_cast<uint8_t>(text[sep + 1 + 8 * v + i])) << (8 * i);
+    }
+    outFp.size = values[0];
+    outFp.sample = values[1];
+    outFp.full = values[2];
+    return true;
+}
+
+// Normalized directory of an effective destination, resolved once per snapshot
+static fs::path DestinationDirectory(const std::string &destination)
+{
+    return destination.empty() ? fs::path() : MovePlanner::NormalDirectory(destination);
+}
+
+// Expand a destination template: {parent} = parent's effective destination,
+// {name} = last path segment, {tag} = full tag path. Empty if {parent} is unresolved.
+static std::string ExpandDestinationTemplate(const std::string &pattern, const std::string &parent,
+                                             const std::string &leaf, const std::string &tagPath)
+{
+    std::string out;
+    size_t pos = 0;
+    while (pos < pattern.size())
+    {
+        const size_t open = pattern.find('{', pos);
+        const size_t close = (open == std::string::npos) ? open : pattern.find('}', open);
+        if (close == std::string::npos)
+        {
+            out.append(pattern, pos, std::string::npos);
+            break;
+        }
+
+        out.append(pattern, pos, open - pos);
+        const std::string key = pattern.substr(open + 1, close - open - 1);
+        if (key == "parent")
+        {
+            if (parent.empty())
+                return std::string();
+            out += parent;
+        }
+        else if (key == "name")
+            out += leaf;
+        else if (key == "tag")
+            out += tagPath;
+        else
+            out.append(pattern, open, close - open + 1); // unknown: keep literally
+        pos = close + 1;
+    }
+    return out;
+}
 
 struct TagInfo
 {
-    std::string destination;
-    std::vector<size_t> fileIndices;
+    // Position in the tag tree. The full name ("media/photo/raw") is derived from the
+    // parent chain, so renaming a tag never touches its descendants.
+    std::string leaf; // last path segment (empty once deleted)
+    TagId parent = INVALID_TAG_ID;
+    std::unordered_map<std::string, TagId> children; // leaf -> ID
+
+    std::string destination; // path, template, or empty = inherit (see EffectiveDestination)
+    std::optional<OrganizeMode> organize; // empty = inherit
+    // Reverse index (tag -> file IDs). Shared with published snapshots; write through Impl::EditFiles
+    std::shared_ptr<FileBitmap> files = std::make_shared<FileBitmap>();
+    bool alive = true;
+
+    // Cached full name, valid while pathGeneration == Impl::renameGeneration
+    mutable std::string path;
+    mutable uint64_t pathGeneration = 0;
 };
 
-// Internal storage: normalized tag -> TagInfo
-// We'll expose the original map view through the existing header's GetTagMap signature
-// by converting to the expected type when required.
+// Internal storage: tags are interned into dense IDs and arranged in a prefix tree of
+// '/'-separated segments. tags[id] holds the tag record; roots maps top-level segments to IDs.
+// Deleted IDs are tombstoned rather than reused so stale references never alias a new tag.
 class TagManager::Impl
 {
 public:
-    std::unordered_map<std::string, TagInfo> tags;
+    std::vector<TagInfo> tags;
+    std::unordered_map<std::string, TagId> roots;
+    uint64_t renameGeneration = 1; // bumped by every rename; invalidates cached paths
+
+    // Writer lock (see WriteBatch), nesting depth, and the last published snapshot
+    std::recursive_mutex mutex;
+    int batchDepth = 0;
+    TagSnapshotPtr published;
+    std::atomic<uint64_t> generation{0}; // published->version, readable without touching the pointer
+    uint64_t tagSetGeneration = 1;       // bumped when a tag is attached, detached or re-pointed
+
+    // Change subscribers. notifyMutex keeps deliveries in version order across writers.
+    std::mutex subscriberMutex;
+    std::vector<std::pair<size_t, ChangeCallback>> subscribers;
+    size_t nextSubscriber = 1;
+    std::mutex notifyMutex;
+    uint64_t notifiedVersion = 0;
+    std::shared_ptr<const FileBitmap> indexedFiles = std::make_shared<FileBitmap>(); // rebuilt by SyncWithIndex
+
+    // Copy-on-write: a bitmap still referenced by a published snapshot is cloned before
+    // the first write. Only writers (under the lock) add references, so a stale count
+    // can only cause a needless copy, never a write to a shared bitmap.
+    FileBitmap &EditFiles(TagInfo &info)
+    {
+        if (info.files.use_count() > 1)
+            info.files = std::make_shared<FileBitmap>(*info.files);
+        return *info.files;
+    }
+
+    // Undo / redo of assignment changes; nothing is recorded while a step is being applied.
+    // Recorded changes are logged as Step* records; stepLogged = a StepEnd is due at the next commit.
+    TagHistory history;
+    bool applyingHistory = false;
+    bool stepLogged = false;
+
+    // In-memory changes whose log records are not durable yet, in the order they were made.
+    // A failed commit undoes them in reverse and discards their records (TagManager::RollBack),
+    // so an operation whose commit fails leaves nothing behind, in memory or on disk.
+    struct PendingChange
+    {
+        enum class Kind : uint8_t
+        {
+            Linked,   // LinkTag(index, tag)
+            Unlinked, // UnlinkTag(index, tag)
+            Created,  // tag interned by EnsureTag
+            Other     // pendingUndo[index] reverts it
+        };
+        Kind kind;
+        bool recorded; // Linked / Unlinked: entered the undo history
+        TagId tag;
+        size_t index;
+    };
+    std::vector<PendingChange> pending;
+    std::vector<std::function<void()>> pendingUndo;
+    uint64_t pendingMark = 0; // log position where the pending records begin
+    bool rollingBack = false; // the inverse changes are not remembered themselves
+
+    void Remember(PendingChange::Kind kind, TagId tag, size_t index)
+    {
+        if (!rollingBack)
+            pending.push_back({kind, !applyingHistory, tag, index});
+    }
+    void RememberUndo(std::function<void()> undo)
+    {
+        if (rollingBack)
+            return;
+        pending.push_back({PendingChange::Kind::Other, false, INVALID_TAG_ID, pendingUndo.size()});
+        pendingUndo.push_back(std::move(undo));
+    }
+    // The pending changes became durable (or are kept for the next commit): forget them
+    void Settle()
+    {
+        pending.clear();
+        pendingUndo.clear();
+        pendingMark = store.Mark();
+    }
+
+    // Auto-tagging rules as declared (persisted) and compiled
+    std::vector<TagRule> rules;
+    TagRuleEngine ruleEngine;
+
+    // Persisted assignments: file path -> tags. Covers files that are not currently
+    // indexed too; the live view is kept in sync with it by SyncWithIndex().
+    std::unordered_map<std::string, TagSet> assignments;
+
+    // Write-ahead log of mutations since the last tags.json snapshot
+    TagStore store{TAG_LOG_FILENAME};
+
+    // Optional xattr mirror: files (by ID) whose tag set changed since the last commit
+    bool xattrBackend = false;
+    FileBitmap xattrDirty;
+
+    // Optional content identity of tagged files (persisted next to the assignments).
+    // pathsBySize narrows an orphan lookup to files of the same size; entries whose
+    // path has no assignment any more are ignored and dropped at the next snapshot.
+    bool fingerprints = false;
+    std::unordered_map<std::string, FileFingerprint> fingerprintsByPath;
+    std::unordered_map<uint64_t, std::vector<std::string>> pathsBySize;
+    FingerprintCache fingerprintCache;
+    FileBitmap fingerprintDirty; // tagged files (by ID) whose fingerprint must be (re)computed
+
+    void StoreFingerprint(const std::string &path, const FileFingerprint &fp)
+    {
+        auto it = fingerprintsByPath.find(path);
+        if (it != fingerprintsByPath.end())
+        {
+            if (it->second.size == fp.size)
+            {
+                it->second = fp;
+                return;
+            }
+            auto &bucket = pathsBySize[it->second.size];
+            bucket.erase(std::remove(bucket.begin(), bucket.end(), path), bucket.end());
+            it->second = fp;
+        }
+        else
+        {
+            fingerprintsByPath.emplace(path, fp);
+        }
+        pathsBySize[fp.size].push_back(path);
+    }
+
+    void EraseFingerprint(const std::string &path)
+    {
+        auto it = fingerprintsByPath.find(path);
+        if (it == fingerprintsByPath.end())
+            return;
+        auto &bucket = pathsBySize[it->second.size];
+        bucket.erase(std::remove(bucket.begin(), bucket.end(), path), bucket.end());
+        fingerprintsByPath.erase(it);
+    }
+
+    // ------------------ Tag tree ------------------
+
+    std::unordered_map<std::string, TagId> &ChildrenOf(TagId parent)
+    {
+        return parent == INVALID_TAG_ID ? roots : tags[parent].children;
+    }
+    const std::unordered_map<std::string, TagId> &ChildrenOf(TagId parent) const
+    {
+        return parent == INVALID_TAG_ID ? roots : tags[parent].children;
+    }
+
+    // A name as passed to a public call: normalized once here, then walked
+    std::optional<TagId> FindName(const std::string &tagName) const
+    {
+        return Find(NormalizeTag(tagName));
+    }
+
+    // Walk a normalized path one segment at a time: O(depth)
+    std::optional<TagId> Find(const std::string &tagPath) const
+    {
+        if (tagPath.empty())
+            return std::nullopt;
+
+        TagId node = INVALID_TAG_ID;
+        size_t start = 0;
+        while (true)
+        {
+            const size_t end = tagPath.find('/', start);
+            const auto &children = ChildrenOf(node);
+            auto it = children.find(tagPath.substr(start, end - start));
+            if (it == children.end())
+                return std::nullopt;
+            node = it->second;
+            if (end == std::string::npos)
+                return node;
+            start = end + 1;
+        }
+    }
+
+    void Attach(TagId id, TagId parent, const std::string &leaf)
+    {
+        TagInfo &info = tags[id];
+        info.parent = parent;
+        info.leaf = leaf;
+        info.pathGeneration = 0;
+        ChildrenOf(parent)[leaf] = id;
+        ++tagSetGeneration;
+    }
+
+    void Detach(TagId id)
+    {
+        const TagInfo &info = tags[id];
+        auto &siblings = ChildrenOf(info.parent);
+        auto it = siblings.find(info.leaf);
+        if (it != siblings.end() && it->second == id)
+            siblings.erase(it);
+        ++tagSetGeneration;
+    }
+
+    const std::string &PathOf(TagId id) const
+    {
+        const TagInfo &info = tags[id];
+        if (info.pathGeneration != renameGeneration)
+        {
+            info.path = (info.parent == INVALID_TAG_ID) ? info.leaf : PathOf(info.parent) + "/" + info.leaf;
+            info.pathGeneration = renameGeneration;
+        }
+        return info.path;
+    }
+
+    // Own destination, else the parent's effective destination + this tag's segment
+    std::string EffectiveDestination(TagId id) const
+    {
+        const TagInfo &info = tags[id];
+        const std::string inherited = (info.parent == INVALID_TAG_ID) ? std::string() : EffectiveDestination(info.parent);
+        if (info.destination.empty())
+            return inherited.empty() ? inherited : (fs::path(inherited) / info.leaf).string();
+        if (info.destination.find('{') == std::string::npos)
+            return info.destination;
+        return ExpandDestinationTemplate(info.destination, inherited, info.leaf, PathOf(id));
+    }
+
+    std::optional<OrganizeMode> EffectiveOrganizeMode(TagId id) const
+    {
+        for (; id != INVALID_TAG_ID; id = tags[id].parent)
+        {
+            if (tags[id].organize)
+                return tags[id].organize;
+        }
+        return std::nullopt;
+    }
+
+    TagInfo *Get(TagId id)
+    {
+        return (id < tags.size() && tags[id].alive) ? &tags[id] : nullptr;
+    }
+    const TagInfo *Get(TagId id) const
+    {
+        return (id < tags.size() && tags[id].alive) ? &tags[id] : nullptr;
+    }
 };
 
 TagManager::TagManager(SearchManager &searchManager)
     : m_searchManager(searchManager), m_impl(std::make_unique<Impl>())
 {
-    // Attempt to load existing tags from JSON on construction
+    // Startup = snapshot (tags.json) + every mutation logged since (tags.wal)
+    // History = tags.history + the events logged since it was saved
     LoadTagsFromJson();
+    m_impl->history.Load(TAG_HISTORY_FILENAME);
+    m_impl->store.Replay([this](const TagStore::Record &rec)
+                         {
+        switch (rec.type)
+        {
+        case TagStore::RecordType::CreateTag:
+            RestoreTag(rec.tag, rec.text);
+            break;
+        case TagStore::RecordType::DeleteTag:
+            DropTag(rec.tag);
+            break;
+        case TagStore::RecordType::SetDestination:
+            if (TagInfo *info = m_impl->Get(rec.tag))
+                info->destination = rec.text;
+            break;
+        case TagStore::RecordType::Assign:
+        case TagStore::RecordType::StepAssign:
+            if (m_impl->Get(rec.tag))
+                m_impl->assignments[rec.text].Insert(rec.tag);
+            if (rec.type == TagStore::RecordType::StepAssign)
+                m_impl->history.ReplayRecord(rec.tag, rec.text, true);
+            break;
+        case TagStore::RecordType::Unassign:
+        case TagStore::RecordType::StepUnassign:
+        {
+            auto it = m_impl->assignments.find(rec.text);
+            if (it != m_impl->assignments.end() && it->second.Erase(rec.tag) && it->second.Empty())
+                m_impl->assignments.erase(it);
+            if (rec.type == TagStore::RecordType::StepUnassign)
+                m_impl->history.ReplayRecord(rec.tag, rec.text, false);
+            break;
+        }
+        case TagStore::RecordType::AssignMany:
+        case TagStore::RecordType::UnassignMany:
+        {
+            const bool assign = rec.type == TagStore::RecordType::AssignMany;
+            if (assign && !m_impl->Get(rec.tag))
+                break;
+            for (size_t start = 0; start < rec.text.size();)
+            {
+                size_t end = rec.text.find('\0', start);
+                if (end == std::string::npos)
+                    end = rec.text.size();
+                const std::string path = rec.text.substr(start, end - start);
+                start = end + 1;
+                if (assign)
+                {
+                    m_impl->assignments[path].Insert(rec.tag);
+                    continue;
+                }
+                auto it = m_impl->assignments.find(path);
+                if (it != m_impl->assignments.end() && it->second.Erase(rec.tag) && it->second.Empty())
+                    m_impl->assignments.erase(it);
+            }
+            break;
+        }
+        case TagStore::RecordType::StepEnd:
+            m_impl->history.ReplayStepEnd(std::strtoull(rec.text.c_str(), nullptr, 10));
+            break;
+        case TagStore::RecordType::Undo:
+        case TagStore::RecordType::Redo:
+            m_impl->history.ReplayMove(std::strtoull(rec.text.c_str(), nullptr, 10),
+                                       rec.type == TagStore::RecordType::Undo);
+            break;
+        case TagStore::RecordType::UnassignAll:
+            m_impl->assignments.erase(rec.text);
+            break;
+        case TagStore::RecordType::SetFingerprint:
+        {
+            std::string path;
+            FileFingerprint fp;
+            if (DecodeFingerprintRecord(rec.text, path, fp))
+                m_impl->StoreFingerprint(path, fp);
+            break;
+        }
+        case TagStore::RecordType::RenameTag:
+        {
+            const std::string newPath = NormalizeTag(rec.text);
+            if (m_impl->Get(rec.tag) && !newPath.empty())
+            {
+                const std::string oldPath = m_impl->PathOf(rec.tag);
+                RelinkTag(rec.tag, newPath);
+                RetargetRules(oldPath, newPath);
+            }
+            break;
+        }
+        case TagStore::RecordType::SetOrganize:
+            if (TagInfo *info = m_impl->Get(rec.tag))
+            {
+                OrganizeMode mode;
+                info->organize = ParseOrganizeMode(rec.text, mode) ? std::optional<OrganizeMode>(mode) : std::nullopt;
+            }
+            break;
+        } });
+    m_impl->history.FinishReplay();
+    m_impl->store.Open();
+    m_impl->Settle();
+
+    RebuildFromAssignments();
+    Publish();
 }
 
-TagManager::~TagManager() = default;
+TagManager::~TagManager()
+{
+    // Leave a compact snapshot behind so the next startup replays an empty log
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    Compact();
+}
 
 // --------------------- Private helper declarations ---------------------
 // Note: these helpers are implemented below the public methods
@@ -50,49 +526,58 @@ bool TagManager::SaveTagsToJson() const
     {
         json j;
         j["tags"] = json::object();
+        j["nextTagId"] = m_impl->tags.size();
+
+        // Assignments are persisted by path (indices are runtime-only)
+        std::vector<json> files(m_impl->tags.size(), json::array());
+        for (const auto &entry : m_impl->assignments)
+        {
+            for (TagId id : entry.second)
+            {
+                if (m_impl->Get(id))
+                    files[id].push_back(entry.first);
+            }
+        }
 
-        for (const auto &pair : m_impl->tags)
+        for (TagId id = 0; id < m_impl->tags.size(); ++id)
         {
-            const std::string &tag = pair.first;
-            const TagInfo &info = pair.second;
+            const TagInfo &info = m_impl->tags[id];
+            if (!info.alive)
+                continue;
 
             json tagObj;
+            tagObj["id"] = id;
             tagObj["destination"] = info.destination;
-            // We do not persist file indices (they are runtime associations),
-            // but if you prefer to persist associations too, add them here.
-            j["tags"][tag] = tagObj;
+            if (info.organize)
+                tagObj["organize"] = OrganizeModeName(*info.organize);
+            if (!files[id].empty())
+                tagObj["files"] = std::move(files[id]);
+            j["tags"][m_impl->PathOf(id)] = tagObj;
         }
 
-        // Atomic write: write to temp file then rename
-        const std::string tmpName = std::string(TAG_JSON_FILENAME) + ".tmp";
-        {
-            std::ofstream ofs(tmpName, std::ios::out | std::ios::trunc);
-            if (!ofs.is_open())
-            {
-                // Logging - replace with engine logger if available
-                std::cerr << "TagManager: failed to open temp json file for writing: " << tmpName << "\n";
-                return false;
-            }
-            ofs << j.dump(4);
-            ofs.close();
-        }
+        j["rules"] = json::array();
+        for (const TagRule &rule : m_impl->rules)
+            j["rules"].push_back(RuleToJson(rule));
 
-        // rename tmp -> final (replace if exists)
-        std::error_code ec;
-        fs::rename(tmpName, TAG_JSON_FILENAME, ec);
-        if (ec)
+        if (m_impl->xattrBackend)
+            j["xattrBackend"] = true;
+        if (m_impl->history.GetBudget() != TagHistory::DEFAULT_BUDGET_BYTES)
+            j["historyBudget"] = m_impl->history.GetBudget();
+
+        // Fingerprints of files that still carry tags: "path": [size, sample, full]
+        if (m_impl->fingerprints)
+            j["contentFingerprints"] = true;
+        json fingerprints = json::object();
+        for (const auto &entry : m_impl->fingerprintsByPath)
         {
-            // On some platforms rename fails when target exists; try remove+rename
-            fs::remove(TAG_JSON_FILENAME, ec); // ignore error
-            fs::rename(tmpName, TAG_JSON_FILENAME, ec);
-            if (ec)
-            {
-                std::cerr << "TagManager: failed to finalize json save: " << ec.message() << "\n";
-                return false;
-            }
+            if (m_impl->assignments.count(entry.first))
+                fingerprints[entry.first] = {entry.second.size, entry.second.sample, entry.second.full};
         }
+        if (!fingerprints.empty())
+            j["fingerprints"] = std::move(fingerprints);
 
-        return true;
+        // Atomic, durable write: the log is only reset once this snapshot is on disk
+        return TagStore::WriteSnapshot(TAG_JSON_FILENAME, j.dump(4));
     }
     catch (const std::exception &ex)
     {
@@ -131,14 +616,65 @@ bool TagManager::LoadTagsFromJson()
         {
             std::cerr << "TagManager: tags.json missing 'tags' object; reinitializing\n";
             m_impl->tags.clear();
+            m_impl->roots.clear();
             return SaveTagsToJson();
         }
 
-        for (auto it = j["tags"].begin(); it != j["tags"].end(); ++it)
+        // Tags with a persisted ID first, so older ID-less entries cannot take their slot.
+        // Every persisted ID is reserved up front (this also keeps IDs of deleted tags retired
+        // across restarts; a parent missing from the file gets a fresh one) and parents are
+        // restored before children.
+        std::vector<std::pair<size_t, json::const_iterator>> withId;
+        size_t idLimit = j.value("nextTagId", size_t(0));
+        for (auto it = j["tags"].cbegin(); it != j["tags"].cend(); ++it)
         {
-            const std::string tag = it.key();
             const json &tagObj = it.value();
-            TagInfo info;
+            if (!tagObj.contains("id") || !tagObj["id"].is_number_unsigned())
+                continue;
+            const TagId id = tagObj["id"].get<TagId>();
+            if (id == INVALID_TAG_ID)
+                continue;
+            idLimit = std::max(idLimit, size_t(id) + 1);
+            withId.emplace_back(std::count(it.key().begin(), it.key().end(), '/'), it);
+        }
+        if (idLimit > m_impl->tags.size())
+        {
+            TagInfo retired;
+            retired.alive = false;
+            m_impl->tags.resize(idLimit, retired);
+        }
+        std::stable_sort(withId.begin(), withId.end(), [](const auto &a, const auto &b)
+                         { return a.first < b.first; });
+
+        std::vector<json::const_iterator> order;
+        for (const auto &entry : withId)
+            order.push_back(entry.second);
+        for (auto it = j["tags"].cbegin(); it != j["tags"].cend(); ++it)
+        {
+            if (!it.value().contains("id") || !it.value()["id"].is_number_unsigned())
+                order.push_back(it);
+        }
+
+        for (const auto &it : order)
+        {
+            const json &tagObj = it.value();
+            const bool hasId = tagObj.contains("id") && tagObj["id"].is_number_unsigned();
+
+            TagId id;
+            if (hasId)
+            {
+                id = tagObj["id"].get<TagId>();
+                RestoreTag(id, it.key());
+            }
+            else
+            {
+                bool created = false;
+                id = InternTag(it.key(), created);
+            }
+            if (!m_impl->Get(id))
+                continue; // empty name
+
+            TagInfo &info = m_impl->tags[id];
             if (tagObj.contains("destination") && tagObj["destination"].is_string())
             {
                 info.destination = tagObj["destination"].get<std::string>();
@@ -147,9 +683,61 @@ bool TagManager::LoadTagsFromJson()
             {
                 info.destination = "";
             }
-            // fileIndices remain empty on load (runtime association)
-            info.fileIndices.clear();
-            m_impl->tags.emplace(tag, std::move(info));
+
+            OrganizeMode mode;
+            if (tagObj.contains("organize") && tagObj["organize"].is_string() &&
+                ParseOrganizeMode(tagObj["organize"].get<std::string>(), mode))
+                info.organize = mode;
+            else
+                info.organize.reset();
+
+            if (tagObj.contains("files") && tagObj["files"].is_array())
+            {
+                for (const json &path : tagObj["files"])
+                {
+                    if (path.is_string())
+                        m_impl->assignments[path.get<std::string>()].Insert(id);
+                }
+            }
+        }
+
+        if (j.contains("rules") && j["rules"].is_array())
+        {
+            for (const json &r : j["rules"])
+            {
+                if (r.is_object())
+                    m_impl->rules.push_back(RuleFromJson(r));
+            }
+
+            std::string error;
+            if (!m_impl->ruleEngine.Compile(m_impl->rules, error))
+                std::cerr << "TagManager: failed to compile rules from tags.json: " << error << "\n";
+        }
+
+        if (j.value("xattrBackend", false))
+        {
+            m_impl->xattrBackend = XattrTagStore::IsSupported();
+            if (!m_impl->xattrBackend)
+                std::cerr << "TagManager: xattr backend enabled in tags.json but unsupported here; ignoring\n";
+            m_searchManager.SetReadXattrTags(m_impl->xattrBackend);
+        }
+
+        m_impl->history.SetBudget(j.value("historyBudget", TagHistory::DEFAULT_BUDGET_BYTES));
+
+        m_impl->fingerprints = j.value("contentFingerprints", false);
+        if (j.contains("fingerprints") && j["fingerprints"].is_object())
+        {
+            for (auto it = j["fingerprints"].begin(); it != j["fingerprints"].end(); ++it)
+            {
+                const json &v = it.value();
+                if (!v.is_array() || v.size() != 3)
+                    continue;
+                FileFingerprint fp;
+                fp.size = v[0].get<uint64_t>();
+                fp.sample = v[1].get<uint64_t>();
+                fp.full = v[2].get<uint64_t>();
+                m_impl->StoreFingerprint(it.key(), fp);
+            }
         }
 
         return true;
@@ -194,248 +782,1781 @@ bool TagManager::ValidateDestination(const std::string &path, std::string &outAb
     }
 }
 
-// Resolve file index from path using SearchManager.
-// NOTE: adapt this to the actual SearchManager API in your project.
-// The current implementation tries two common patterns. If they don't match your SearchManager,
-// replace the body by the proper call.
+// Path -> current index through the handle table (O(1))
 std::optional<size_t> TagManager::ResolveFileIndex(const std::filesystem::path &filePath) const
 {
-    // Attempt 1: SearchManager has a method named GetFileIndex or FindFileIndex which returns optional<size_t>
-    // Attempt 2: SearchManager can provide FileData* for a path and that FileData contains an index
-    // If neither exists, you must adapt this function to your SearchManager's API.
+    return m_searchManager.GetFileIndex(m_searchManager.GetHandle(filePath));
+}
 
-    // --- BEGIN: ADAPT THIS SECTION IF NECESSARY ---
-    // Example assumed APIs (uncomment and adapt if they exist):
-    // if (auto idxOpt = m_searchManager.GetFileIndex(filePath); idxOpt.has_value()) return idxOpt;
-    // if (auto idxOpt = m_searchManager.FindFileIndex(filePath); idxOpt.has_value()) return idxOpt;
+// Intern a tag name: normalization happens here, once; everything past this point uses TagId.
+// Missing ancestors are created along the way (parents get lower IDs than their children).
+// Returns INVALID_TAG_ID for a name that normalizes to nothing.
+TagId TagManager::InternTag(const std::string &tagName, bool &created)
+{
+    const std::string tag = NormalizeTag(tagName);
+    created = false;
+    if (tag.empty())
+        return INVALID_TAG_ID;
 
-    // Fallback: try to find a FileData* for the path and extract its index
-    // Assumes SearchManager::GetFileDataByPath(const path&) -> FileData*
-    try
+    TagId node = INVALID_TAG_ID;
+    size_t start = 0;
+    while (true)
     {
-        // The following call likely does not exist verbatim; adapt to real API:
-        if constexpr (true)
+        const size_t end = tag.find('/', start);
+        const std::string leaf = tag.substr(start, end - start);
+        const auto &children = m_impl->ChildrenOf(node);
+        auto it = children.find(leaf);
+        if (it != children.end())
         {
-            // TODO: Replace this pseudo-call with real SearchManager call:
-            // FileData* fd = m_searchManager.GetFileDataByPath(filePath);
-            // if (fd) return fd->index;
+            node = it->second;
+        }
+        else
+        {
+            const TagId id = static_cast<TagId>(m_impl->tags.size());
+            m_impl->tags.emplace_back();
+            m_impl->Attach(id, node, leaf);
+            node = id;
+            created = true;
         }
-    }
-    catch (...)
-    {
-        // swallow - will return nullopt below
-    }
 
-    // If you can't resolve fileIndex here, return nullopt
-    return std::nullopt;
+        if (end == std::string::npos)
+            return node;
+        start = end + 1;
+    }
 }
 
-// Safe add unique index into vector
-static void push_unique_index(std::vector<size_t> &vec, size_t idx)
+// Drop a tag and its whole subtree (delete, or undo an InternTag that could not be persisted).
+// The dropped IDs leave the persisted assignments too, in one pass over them; a path left
+// without live tags loses its entry. dropped (optional) receives those entries as they were.
+void TagManager::DropTag(TagId id, std::vector<std::pair<std::string, TagSet>> *dropped)
 {
-    if (std::find(vec.begin(), vec.end(), idx) == vec.end())
+    if (!m_impl->Get(id))
+        return;
+
+    // Subtree, parents first
+    std::vector<TagId> subtree{id};
+    for (size_t i = 0; i < subtree.size(); ++i)
     {
-        vec.push_back(idx);
+        for (const auto &child : m_impl->tags[subtree[i]].children)
+            subtree.push_back(child.second);
     }
-}
 
-// --------------------- Public API implementations ---------------------
-
-bool TagManager::CreateTag(const std::string tagName)
-{
-    const std::string tag = NormalizeTag(tagName);
-    if (m_impl->tags.find(tag) != m_impl->tags.end())
+    for (auto it = subtree.rbegin(); it != subtree.rend(); ++it)
     {
-        return false; // already exists
-    }
+        TagInfo &info = m_impl->tags[*it];
+
+        // keep forward index (FileData::tags) in sync
+        info.files->ForEach([&](size_t fileId)
+                            {
+            if (FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId)))
+            {
+                fd->tags.Erase(*it);
+                MarkXattrDirty(fileId);
+            } });
 
-    // For create without destination: set empty destination (user may set later)
-    TagInfo info;
-    info.destination.clear();
-    info.fileIndices.clear();
-    m_impl->tags.emplace(tag, std::move(info));
+        m_impl->Detach(*it);
+        info.leaf.clear();
+        info.parent = INVALID_TAG_ID;
+        info.children.clear();
+        info.destination.clear();
+        info.files = std::make_shared<FileBitmap>();
+        info.alive = false;
+    }
 
-    return SaveTagsToJson();
+    std::vector<TagId> dead;
+    for (auto it = m_impl->assignments.begin(); it != m_impl->assignments.end();)
+    {
+        TagSet &tagSet = it->second;
+        dead.clear();
+        for (TagId tag : tagSet)
+        {
+            if (!m_impl->Get(tag))
+                dead.push_back(tag);
+        }
+        if (dead.empty())
+        {
+            ++it;
+            continue;
+        }
+        if (dropped)
+            dropped->emplace_back(it->first, tagSet);
+        for (TagId tag : dead)
+            tagSet.Erase(tag);
+        if (tagSet.Empty())
+            it = m_impl->assignments.erase(it);
+        else
+            ++it;
+    }
 }
 
-bool TagManager::DeleteTag(const std::string tagName)
+// Recreate a tag under a known ID (snapshot load / log replay)
+void TagManager::RestoreTag(TagId id, const std::string &tagName)
 {
     const std::string tag = NormalizeTag(tagName);
-    auto it = m_impl->tags.find(tag);
-    if (it == m_impl->tags.end())
+    if (id == INVALID_TAG_ID || tag.empty())
+        return;
+    if (m_impl->tags.size() <= id)
     {
-        return false;
+        TagInfo retired;
+        retired.alive = false;
+        m_impl->tags.resize(size_t(id) + 1, retired);
     }
 
-    // erase mapping (removes tag -> fileIndices association)
-    m_impl->tags.erase(it);
+    if (m_impl->tags[id].alive)
+        m_impl->Detach(id);
+    m_impl->tags[id].alive = true;
 
-    return SaveTagsToJson();
+    // Parents are normally restored already; otherwise they are interned under fresh IDs
+    const size_t slash = tag.rfind('/');
+    TagId parent = INVALID_TAG_ID;
+    if (slash != std::string::npos)
+    {
+        bool created = false;
+        parent = InternTag(tag.substr(0, slash), created);
+    }
+    m_impl->Attach(id, parent, tag.substr(slash == std::string::npos ? 0 : slash + 1));
 }
 
-bool TagManager::AssignTag(const std::filesystem::path &filePath, const std::string &tagName)
+// Move a tag to a new normalized path (creating missing parents, unlogged).
+// Descendants hang off the node itself, so they follow without being touched.
+void TagManager::RelinkTag(TagId id, const std::string &newPath)
 {
-    // Resolve file index via SearchManager
-    auto idxOpt = ResolveFileIndex(filePath);
-    if (!idxOpt.has_value())
+    const size_t slash = newPath.rfind('/');
+    TagId parent = INVALID_TAG_ID;
+    if (slash != std::string::npos)
     {
-        // Failed to find file in search manager
-        return false;
+        bool created = false;
+        parent = InternTag(newPath.substr(0, slash), created);
     }
-    return AssignTagByIndex(idxOpt.value(), tagName);
+
+    m_impl->Detach(id);
+    m_impl->Attach(id, parent, newPath.substr(slash == std::string::npos ? 0 : slash + 1));
+    ++m_impl->renameGeneration;
 }
 
-bool TagManager::RemoveTag(const std::filesystem::path &filepath)
+// InternTag + log the creation of every node it added (parents first)
+TagId TagManager::EnsureTag(const std::string &tagName, bool &created)
 {
-    auto idxOpt = ResolveFileIndex(filepath);
-    if (!idxOpt.has_value())
+    const TagId firstNew = static_cast<TagId>(m_impl->tags.size());
+    const TagId id = InternTag(tagName, created);
+    for (TagId newId = firstNew; newId < m_impl->tags.size(); ++newId)
     {
-        return false;
+        m_impl->store.Append({TagStore::RecordType::CreateTag, newId, m_impl->PathOf(newId)});
+        m_impl->Remember(Impl::PendingChange::Kind::Created, newId, 0);
     }
-    return RemoveTagByIndex(idxOpt.value());
+    return id;
 }
 
-bool TagManager::AssignTagByIndex(size_t fileIndex, const std::string &tagName)
+// Add / remove one association in every index (forward, reverse, persisted) and log it.
+// Returns false if nothing changed.
+bool TagManager::LinkTag(size_t fileId, TagId id)
 {
-    const std::string tag = NormalizeTag(tagName);
+    FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+    if (!fd || !m_impl->Get(id) || !fd->tags.Insert(id))
+        return false;
 
-    // Ensure tag exists. If not, create with empty destination.
-    auto it = m_impl->tags.find(tag);
-    if (it == m_impl->tags.end())
-    {
-        TagInfo info;
-        info.destination.clear();
-        info.fileIndices.clear();
-        it = m_impl->tags.emplace(tag, std::move(info)).first;
+    m_impl->EditFiles(m_impl->tags[id]).Set(fileId);
+    const bool recorded = !m_impl->applyingHistory;
+    if (recorded)
+        m_impl->history.Record(id, fileId, true);
+    MarkXattrDirty(fileId);
+    std::string key = fd->path.string();
+    if (m_impl->fingerprints && !m_impl->fingerprintsByPath.count(key))
+        m_impl->fingerprintDirty.Set(fileId);
+    m_impl->assignments[key].Insert(id);
+    m_impl->store.Append({recorded ? TagStore::RecordType::StepAssign : TagStore::RecordType::Assign, id, std::move(key)});
+    m_impl->stepLogged |= recorded;
+    m_impl->Remember(Impl::PendingChange::Kind::Linked, id, fileId);
+    return true;
+}
 
-        // Persist creation
-        if (!SaveTagsToJson())
-        {
-            // If save failed, remove the inserted tag to keep memory/JSON consistent
-            m_impl->tags.erase(tag);
-            return false;
-        }
-    }
+bool TagManager::UnlinkTag(size_t fileId, TagId id)
+{
+    FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+    if (!fd || !fd->tags.Erase(id))
+        return false;
 
-    // Insert unique index
-    push_unique_index(it->second.fileIndices, fileIndex);
+    m_impl->EditFiles(m_impl->tags[id]).Reset(fileId);
+    const bool recorded = !m_impl->applyingHistory;
+    if (recorded)
+        m_impl->history.Record(id, fileId, false);
+    MarkXattrDirty(fileId);
+    std::string key = fd->path.string();
+    auto it = m_impl->assignments.find(key);
+    if (it != m_impl->assignments.end() && it->second.Erase(id) && it->second.Empty())
+        m_impl->assignments.erase(it);
+    m_impl->store.Append({recorded ? TagStore::RecordType::StepUnassign : TagStore::RecordType::Unassign, id, std::move(key)});
+    m_impl->stepLogged |= recorded;
+    m_impl->Remember(Impl::PendingChange::Kind::Unlinked, id, fileId);
     return true;
 }
 
-bool TagManager::RemoveTagByIndex(size_t fileIndex)
+// LinkTag / UnlinkTag for many files at once, outside the undo history: the tag's bitmap
+// changes with one OR / AND-NOT and the log gets one record for all of them. Only the
+// per-file indexes (tag set, persisted assignments) are still walked file by file.
+FileBitmap TagManager::LinkFiles(const FileBitmap &files, TagId id, bool link)
 {
-    bool anyRemoved = false;
-    std::vector<std::string> emptyTags;
+    FileBitmap changed(m_searchManager.GetSlotCount());
+    TagInfo *info = m_impl->Get(id);
+    if (!info)
+        return changed;
 
-    for (auto &pair : m_impl->tags)
-    {
-        auto &vec = pair.second.fileIndices;
-        auto oldSize = vec.size();
-        vec.erase(std::remove(vec.begin(), vec.end(), fileIndex), vec.end());
-        if (vec.size() != oldSize)
+    std::string paths;
+    files.ForEach([&](size_t fileId)
+                  {
+        FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+        if (!fd || !(link ? fd->tags.Insert(id) : fd->tags.Erase(id)))
+            return;
+        changed.Set(fileId);
+        std::string key = fd->path.string();
+        if (link)
         {
-            anyRemoved = true;
+            if (m_impl->fingerprints && !m_impl->fingerprintsByPath.count(key))
+                m_impl->fingerprintDirty.Set(fileId);
+            m_impl->assignments[key].Insert(id);
         }
-        // Optionally, if the tag has no more files, we leave it in place (per earlier rules).
-        // If you prefer to remove tag entries when empty, collect them:
-        // if (vec.empty()) emptyTags.push_back(pair.first);
-    }
-
-    // optional: remove tags that have no destinations & no files (not required)
-    (void)emptyTags;
+        else
+        {
+            auto it = m_impl->assignments.find(key);
+            if (it != m_impl->assignments.end() && it->second.Erase(id) && it->second.Empty())
+                m_impl->assignments.erase(it);
+        }
+        if (!paths.empty())
+            paths += '\0';
+        paths += key; });
+    if (paths.empty())
+        return changed;
 
-    return anyRemoved;
+    FileBitmap &bits = m_impl->EditFiles(*info);
+    if (link)
+        bits |= changed;
+    else
+        bits.AndNot(changed);
+    if (m_impl->xattrBackend)
+        m_impl->xattrDirty |= changed;
+    m_impl->store.Append({link ? TagStore::RecordType::AssignMany : TagStore::RecordType::UnassignMany, id, std::move(paths)});
+    m_impl->RememberUndo([this, changed, id, link]
+                         { LinkFiles(changed, id, !link); });
+    return changed;
 }
 
-std::vector<FileData *> TagManager::GetFilesByTag(const std::string &tagName)
+// Durably commit everything logged by the current operation (one fsync),
+// compacting into a snapshot when the log has grown large. If the commit fails the
+// operation is rolled back (see RollBack), unless keepOnFailure leaves its records
+// queued for the next commit instead.
+bool TagManager::CommitLog(bool keepOnFailure)
 {
-    std::vector<FileData *> out;
-    const std::string tag = NormalizeTag(tagName);
-    auto it = m_impl->tags.find(tag);
-    if (it == m_impl->tags.end())
-        return out;
-
-    for (size_t idx : it->second.fileIndices)
+    // The recorded changes logged so far belong to the open undo step, the next history event
+    if (m_impl->stepLogged)
     {
-        // TODO: adapt to your SearchManager's API to fetch FileData* by index
-        // Example assumed API:
-        // FileData* fd = m_searchManager.GetFileDataByIndex(idx);
-        FileData *fd = nullptr;
-        if (fd)
-            out.push_back(fd);
+        m_impl->store.Append({TagStore::RecordType::StepEnd, INVALID_TAG_ID, std::to_string(m_impl->history.Events() + 1)});
+        m_impl->stepLogged = false;
     }
 
-    return out;
-}
+    // Fingerprints of newly tagged files ride along in the same commit
+    FlushFingerprints();
 
-// const std::unordered_map<std::string, std::vector<size_t>> &TagManager::GetTagMap() const
-// {
-//     // Build a temporary view to match header signature would require copying.
-//     // The header returns a const reference to internal storage type:
-//     // const std::unordered_map<std::string, std::vector<size_t>> &
-//     // But we internally store TagInfo. To honor the header without changing it,
-//     // we maintain a static cache mapping view. Simpler approach is to adapt header
-//     // to return TagInfo map directly. For now, we create a persistent member-level
-//     // view to return a reference to. (This is a small shim — if you prefer, change the header.)
-//     if (!m_tagMapCacheInitialized)
-//     {
-//         m_tagMapCache.clear();
-//         for (const auto &pair : m_impl->tags)
-//         {
-//             m_tagMapCache.emplace(pair.first, pair.second.fileIndices);
-//         }
-//         m_tagMapCacheInitialized = true;
-//     }
-//     return m_tagMapCache;
-// }
+    if (!m_impl->store.Commit())
+    {
+        if (keepOnFailure)
+            m_impl->Settle();
+        else
+            RollBack();
+        return false;
+    }
+    m_impl->Settle();
+
+    // The central store is authoritative; attributes are mirrored once it is durable
+    FlushXattrTags();
+
+    if (m_impl->store.LogBytes() > COMPACT_LOG_BYTES)
+        Compact();
+    return true;
+}
+
+bool TagManager::Compact()
+{
+    if (!SaveTagsToJson())
+        return false;
+
+    // The history rides along with the snapshot (losing it never affects the tags themselves).
+    // The log about to be reset holds the open step's records: it is closed so it is saved.
+    m_impl->history.CommitStep();
+    m_impl->history.Save(TAG_HISTORY_FILENAME, [this](size_t fileId)
+                         {
+        const FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+        return fd ? fd->path.string() : std::string(); });
+    if (!m_impl->store.Reset())
+        return false;
+    m_impl->Settle(); // folded into the snapshot
+    return true;
+}
+
+// Nothing logged since the last durable commit reached the disk: undo those changes in
+// memory, newest first, then take back their records so a later commit does not write
+// them after all. Links are reverted through LinkTag / UnlinkTag with the history
+// recording they had, so the open undo step cancels out as well.
+void TagManager::RollBack()
+{
+    Impl &impl = *m_impl;
+    const bool applyingHistory = impl.applyingHistory;
+    impl.rollingBack = true;
+    for (auto it = impl.pending.rbegin(); it != impl.pending.rend(); ++it)
+    {
+        impl.applyingHistory = !it->recorded;
+        switch (it->kind)
+        {
+        case Impl::PendingChange::Kind::Linked:
+            UnlinkTag(it->index, it->tag);
+            break;
+        case Impl::PendingChange::Kind::Unlinked:
+            LinkTag(it->index, it->tag);
+            break;
+        case Impl::PendingChange::Kind::Created:
+            DropTag(it->tag);
+            break;
+        case Impl::PendingChange::Kind::Other:
+            impl.pendingUndo[it->index]();
+            break;
+        }
+    }
+    impl.applyingHistory = applyingHistory;
+    impl.rollingBack = false;
+    impl.stepLogged = false;
+
+    impl.store.Discard(impl.pendingMark);
+    impl.Settle();
+}
+
+// Load the persisted tags of one indexed file into the live indexes (no logging)
+void TagManager::LoadFileTags(FileData &fd)
+{
+    auto it = m_impl->assignments.find(fd.path.string());
+    if (it == m_impl->assignments.end())
+        return;
+
+    for (TagId id : it->second)
+    {
+        if (TagInfo *info = m_impl->Get(id))
+        {
+            fd.tags.Insert(id);
+            m_impl->EditFiles(*info).Set(fd.handle.slot);
+        }
+    }
+}
+
+// --------------------- Content fingerprints ---------------------
+
+// Record a fingerprint in memory and in the log (no-op if unchanged)
+void TagManager::LogFingerprint(const std::string &path, const FileFingerprint &fp)
+{
+    auto it = m_impl->fingerprintsByPath.find(path);
+    if (it != m_impl->fingerprintsByPath.end() && it->second.SameSample(fp) && it->second.full == fp.full)
+        return;
+    if (it != m_impl->fingerprintsByPath.end())
+        m_impl->RememberUndo([this, path, previous = it->second]()
+                             { m_impl->StoreFingerprint(path, previous); });
+    else
+        m_impl->RememberUndo([this, path]()
+                             { m_impl->EraseFingerprint(path); });
+    m_impl->StoreFingerprint(path, fp);
+    m_impl->store.Append({TagStore::RecordType::SetFingerprint, INVALID_TAG_ID, EncodeFingerprintRecord(path, fp)});
+}
+
+// Fingerprint tagged files marked since the last commit. Sample hashes only; a full hash
+// is added (to both sides) when another tagged file already has the same sample.
+void TagManager::FlushFingerprints()
+{
+    if (!m_impl->fingerprints || m_impl->fingerprintDirty.None())
+        return;
+
+    m_impl->fingerprintDirty.ForEach([&](size_t fileId)
+                                     {
+        const FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+        if (!fd || fd->type != FileType::REGULAR_FILE)
+            return;
+        const std::string path = fd->path.string();
+        if (!m_impl->assignments.count(path))
+            return; // untagged files need no identity
+
+        FileFingerprint fp;
+        if (!m_impl->fingerprintCache.GetSample(fd->path, fp))
+            return;
+
+        std::vector<std::string> twins;
+        auto bucket = m_impl->pathsBySize.find(fp.size);
+        if (bucket != m_impl->pathsBySize.end())
+        {
+            for (const std::string &other : bucket->second)
+            {
+                auto otherFp = m_impl->fingerprintsByPath.find(other);
+                if (other != path && otherFp != m_impl->fingerprintsByPath.end() && otherFp->second.SameSample(fp) &&
+                    m_impl->assignments.count(other))
+                    twins.push_back(other);
+            }
+        }
+
+        if (!twins.empty())
+        {
+            m_impl->fingerprintCache.GetFull(fd->path, fp);
+            for (const std::string &other : twins)
+            {
+                FileFingerprint otherFp;
+                if (m_impl->fingerprintsByPath[other].full == 0 && m_impl->fingerprintCache.GetFull(other, otherFp))
+                    LogFingerprint(other, otherFp);
+            }
+        }
+        LogFingerprint(path, fp); });
+    m_impl->fingerprintDirty.ClearAll();
+}
+
+// A newly indexed, untagged file may be a tagged file moved behind our back: look up
+// tagged files of the same size and sample whose old path is gone. Ambiguous samples
+// are settled by full hash; if still ambiguous the tags stay where they are.
+bool TagManager::ReattachByFingerprint(FileData &fd)
+{
+    if (fd.type != FileType::REGULAR_FILE)
+        return false;
+    auto bucket = m_impl->pathsBySize.find(fd.size);
+    if (bucket == m_impl->pathsBySize.end())
+        return false;
+
+    const std::string path = fd.path.string();
+    FileFingerprint fp;
+    bool haveSample = false;
+    std::vector<std::string> candidates;
+    for (const std::string &oldPath : bucket->second)
+    {
+        if (oldPath == path || !m_impl->assignments.count(oldPath))
+            continue;
+        if (!haveSample)
+        {
+            if (!m_impl->fingerprintCache.GetSample(fd.path, fp))
+                return false;
+            haveSample = true;
+        }
+        if (!m_impl->fingerprintsByPath[oldPath].SameSample(fp))
+            continue;
+
+        // Still in place: this is a copy, not a move
+        std::error_code ec;
+        if (fs::exists(oldPath, ec) || ec)
+            continue;
+        candidates.push_back(oldPath);
+    }
+    if (candidates.empty())
+        return false;
+
+    const bool needFull = candidates.size() > 1 || m_impl->fingerprintsByPath[candidates[0]].full != 0;
+    if (needFull)
+    {
+        if (!m_impl->fingerprintCache.GetFull(fd.path, fp))
+            return false;
+        candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [&](const std::string &oldPath)
+                                        { return m_impl->fingerprintsByPath[oldPath].full != fp.full; }),
+                         candidates.end());
+        if (candidates.size() != 1)
+            return false;
+    }
+
+    MoveAssignments(candidates[0], fd);
+    return true;
+}
+
+// Move the persisted assignments (and fingerprint) of oldPath to fd's path and load them.
+// Returns false if oldPath had no assignments.
+bool TagManager::MoveAssignments(const std::string &oldPath, FileData &fd)
+{
+    if (!MoveAssignments(oldPath, fd.path.string()))
+        return false;
+    LoadFileTags(fd);
+    return true;
+}
+
+// Persisted assignments (and fingerprint) of oldPath now belong to newPath, merged with any it has
+bool TagManager::MoveAssignments(const std::string &oldPath, const std::string &newPath)
+{
+    auto it = m_impl->assignments.find(oldPath);
+    if (it == m_impl->assignments.end())
+        return false;
+
+    TagSet moved = std::move(it->second);
+    m_impl->assignments.erase(it);
+    m_impl->store.Append({TagStore::RecordType::UnassignAll, INVALID_TAG_ID, oldPath});
+
+    for (TagId id : moved)
+    {
+        if (!m_impl->Get(id))
+            continue;
+        m_impl->assignments[newPath].Insert(id);
+        m_impl->store.Append({TagStore::RecordType::Assign, id, newPath});
+    }
+
+    auto fp = m_impl->fingerprintsByPath.find(oldPath);
+    if (m_impl->fingerprints && fp != m_impl->fingerprintsByPath.end())
+        LogFingerprint(newPath, FileFingerprint(fp->second));
+    return true;
+}
+
+// Adopt tags found on the file itself that the central store does not know yet.
+// IDs of deleted tags are skipped. Returns true if anything was logged.
+bool TagManager::MergeXattrTags(FileData &fd)
+{
+    bool changed = false;
+    for (TagId id : fd.xattrTags)
+    {
+        if (m_impl->Get(id) && LinkTag(fd.handle.slot, id))
+            changed = true;
+    }
+    return changed;
+}
+
+void TagManager::MarkXattrDirty(size_t fileId)
+{
+    if (m_impl->xattrBackend)
+        m_impl->xattrDirty.Set(fileId);
+}
+
+// Write the tag sets of files touched since the last commit to their attributes, once per file
+void TagManager::FlushXattrTags()
+{
+    if (!m_impl->xattrBackend || m_impl->xattrDirty.None())
+        return;
+
+    size_t failed = 0;
+    m_impl->xattrDirty.ForEach([&](size_t fileId)
+                               {
+        FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId));
+        if (!fd)
+            return;
+        if (XattrTagStore::Write(fd->path, fd->tags))
+            fd->xattrTags = fd->tags;
+        else
+            ++failed; });
+    m_impl->xattrDirty.ClearAll();
+
+    if (failed)
+        std::cerr << "TagManager: failed to update the tags attribute of " << failed << " file(s)\n";
+}
+
+void TagManager::RebuildFromAssignments()
+{
+    const size_t slotCount = m_searchManager.GetSlotCount();
+    for (TagInfo &info : m_impl->tags)
+        info.files = std::make_shared<FileBitmap>(info.alive ? slotCount : 0);
+
+    const size_t fileCount = m_searchManager.GetAllFiles().size();
+    for (size_t idx = 0; idx < fileCount; ++idx)
+    {
+        FileData *fd = m_searchManager.GetFileByIndex(idx);
+        fd->tags.Clear();
+        LoadFileTags(*fd);
+    }
+    RebuildIndexedFiles();
+}
+
+void TagManager::RebuildIndexedFiles()
+{
+    auto indexed = std::make_shared<FileBitmap>(m_searchManager.GetSlotCount());
+    for (const auto &file : m_searchManager.GetAllFiles())
+        indexed->Set(static_cast<size_t>(file.fileID));
+    m_impl->indexedFiles = std::move(indexed);
+}
+
+void TagManager::SyncWithIndex()
+{
+    WriteBatch batch(*this);
+    const IndexDelta &delta = m_searchManager.GetLastDelta();
+
+    // Removed first: a slot freed here may already be reused by an added file
+    if (!delta.removed.empty())
+    {
+        FileBitmap removed(m_searchManager.GetSlotCount());
+        for (const FileHandle &handle : delta.removed)
+            removed.Set(handle.slot);
+        for (TagInfo &info : m_impl->tags)
+        {
+            if (info.files->Intersects(removed))
+                m_impl->EditFiles(info).AndNot(removed);
+        }
+        m_impl->xattrDirty.AndNot(removed);
+        m_impl->fingerprintDirty.AndNot(removed);
+        m_impl->history.ForgetFiles(removed);
+    }
+
+    // Files found again under a new path: carry the persisted assignments along
+    bool logged = false;
+    for (const auto &rename : delta.renamed)
+    {
+        FileData *fd = m_searchManager.Resolve(rename.first);
+        if (!fd)
+            continue;
+
+        if (MoveAssignments(rename.second.string(), *fd))
+            logged = true;
+        else
+            LoadFileTags(*fd);
+        if (m_impl->xattrBackend && MergeXattrTags(*fd))
+            logged = true;
+    }
+
+    // Moved where no record follows: out of the tree, or onto a file indexed already
+    for (const auto &relocation : delta.relocated)
+    {
+        if (!MoveAssignments(relocation.first.string(), relocation.second.string()))
+            continue;
+        logged = true;
+        if (FileData *fd = m_searchManager.FindFileByPath(relocation.second))
+            LoadFileTags(*fd);
+    }
+
+    for (const FileHandle &handle : delta.added)
+    {
+        if (FileData *fd = m_searchManager.Resolve(handle))
+        {
+            fd->tags.Clear();
+            LoadFileTags(*fd);
+            // Tags of a tagged file moved here by another tool: by content, then by attribute
+            if (fd->tags.Empty() && m_impl->fingerprints && ReattachByFingerprint(*fd))
+                logged = true;
+            if (m_impl->xattrBackend && MergeXattrTags(*fd))
+                logged = true;
+            if (m_impl->fingerprints && !fd->tags.Empty() && !m_impl->fingerprintsByPath.count(fd->path.string()))
+                m_impl->fingerprintDirty.Set(fd->handle.slot);
+        }
+    }
+
+    // Content changed: refresh fingerprints of tagged files
+    if (m_impl->fingerprints)
+    {
+        for (const FileHandle &handle : delta.modified)
+        {
+            const FileData *fd = m_searchManager.Resolve(handle);
+            if (fd && !fd->tags.Empty())
+                m_impl->fingerprintDirty.Set(fd->handle.slot);
+        }
+    }
+    if (!m_impl->fingerprintDirty.None())
+        logged = true;
+
+    if (!delta.added.empty() || !delta.removed.empty())
+        RebuildIndexedFiles();
+
+    if (logged)
+        CommitLog(true); // the files did move: keep the records for the next commit
+}
+
+// --------------------- Public API implementations ---------------------
+
+bool TagManager::CreateTag(const std::string tagName)
+{
+    WriteBatch batch(*this);
+    bool created = false;
+    EnsureTag(tagName, created);
+    if (!created)
+    {
+        return false; // already exists
+    }
+
+    // For create without destination: destination stays empty (user may set later)
+    return CommitLog();
+}
+
+bool TagManager::DeleteTag(const std::string tagName)
+{
+    WriteBatch batch(*this);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
+    {
+        return false;
+    }
+
+    // A failed commit puts the subtree back as it was (parents first), with its file links
+    std::vector<std::pair<TagId, TagInfo>> subtree;
+    std::vector<TagId> stack{idOpt.value()};
+    while (!stack.empty())
+    {
+        const TagId id = stack.back();
+        stack.pop_back();
+        subtree.emplace_back(id, m_impl->tags[id]);
+        for (const auto &child : m_impl->tags[id].children)
+            stack.push_back(child.second);
+    }
+    m_impl->RememberUndo([this, subtree = std::move(subtree)]()
+                         {
+        for (const auto &saved : subtree)
+        {
+            m_impl->tags[saved.first] = saved.second;
+            m_impl->Attach(saved.first, saved.second.parent, saved.second.leaf);
+            saved.second.files->ForEach([&](size_t fileId)
+                                        {
+                if (FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId)))
+                {
+                    fd->tags.Insert(saved.first);
+                    MarkXattrDirty(fileId);
+                } });
+        } });
+
+    // drop tag record and all file associations (both index directions)
+    std::vector<std::pair<std::string, TagSet>> dropped;
+    DropTag(idOpt.value(), &dropped);
+    m_impl->store.Append({TagStore::RecordType::DeleteTag, idOpt.value(), ""});
+    m_impl->RememberUndo([this, dropped = std::move(dropped)]()
+                         {
+        for (const auto &entry : dropped)
+            m_impl->assignments[entry.first] = entry.second; });
+
+    return CommitLog();
+}
+
+bool TagManager::AssignTag(const std::filesystem::path &filePath, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    // Resolve file index via SearchManager
+    auto idxOpt = ResolveFileIndex(filePath);
+    if (!idxOpt.has_value())
+    {
+        // Failed to find file in search manager
+        return false;
+    }
+    return AssignTagByIndex(idxOpt.value(), tagName);
+}
+
+bool TagManager::RemoveTag(const std::filesystem::path &filepath)
+{
+    WriteBatch batch(*this);
+    auto idxOpt = ResolveFileIndex(filepath);
+    if (!idxOpt.has_value())
+    {
+        return false;
+    }
+    return RemoveTagByIndex(idxOpt.value());
+}
+
+bool TagManager::AssignTagByIndex(size_t fileIndex, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    const FileData *fd = m_searchManager.GetFileByIndex(fileIndex);
+    if (!fd)
+        return false;
+
+    // Ensure tag exists. If not, create with empty destination.
+    bool created = false;
+    const TagId id = EnsureTag(tagName, created);
+    if (id == INVALID_TAG_ID)
+        return false;
+    LinkTag(fd->handle.slot, id);
+
+    // A failed commit also takes back the tag (and parents) created here
+    return CommitLog();
+}
+
+bool TagManager::RemoveTagByIndex(size_t fileIndex)
+{
+    WriteBatch batch(*this);
+    FileData *fd = m_searchManager.GetFileByIndex(fileIndex);
+    if (!fd || fd->tags.Empty())
+        return false;
+
+    // Walk the file's own tag set instead of scanning every tag
+    for (TagId id : fd->tags)
+    {
+        if (TagInfo *info = m_impl->Get(id))
+        {
+            m_impl->EditFiles(*info).Reset(fd->handle.slot);
+            if (!m_impl->applyingHistory)
+            {
+                m_impl->history.Record(id, fd->handle.slot, false);
+                m_impl->store.Append({TagStore::RecordType::StepUnassign, id, fd->path.string()});
+                m_impl->stepLogged = true;
+            }
+            m_impl->Remember(Impl::PendingChange::Kind::Unlinked, id, fd->handle.slot);
+        }
+    }
+    fd->tags.Clear();
+    MarkXattrDirty(fd->handle.slot);
+
+    std::string key = fd->path.string();
+    m_impl->assignments.erase(key);
+    m_impl->store.Append({TagStore::RecordType::UnassignAll, INVALID_TAG_ID, std::move(key)});
+
+    // Tags left without files stay in place (per earlier rules).
+    return CommitLog();
+}
+
+bool TagManager::AssignTagById(size_t fileIndex, TagId id)
+{
+    WriteBatch batch(*this);
+    const FileData *fd = m_searchManager.GetFileByIndex(fileIndex);
+    if (!m_impl->Get(id) || !fd)
+        return false;
+
+    if (!LinkTag(fd->handle.slot, id))
+        return true; // already tagged
+    return CommitLog();
+}
+
+bool TagManager::RemoveTagById(size_t fileIndex, TagId id)
+{
+    WriteBatch batch(*this);
+    const FileData *fd = m_searchManager.GetFileByIndex(fileIndex);
+    if (!m_impl->Get(id) || !fd || !UnlinkTag(fd->handle.slot, id))
+        return false;
+    return CommitLog();
+}
+
+std::optional<TagId> TagManager::FindTagId(const std::string &tagName) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->FindName(tagName);
+}
+
+std::string TagManager::GetTagName(TagId id) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->Get(id) ? m_impl->PathOf(id) : std::string();
+}
+
+std::string TagManager::GetDestination(const std::string &tagName) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
+        return std::string();
+    return m_impl->EffectiveDestination(idOpt.value());
+}
+
+std::string TagManager::GetDestinationTemplate(const std::string &tagName) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
+        return std::string();
+    return m_impl->tags[idOpt.value()].destination;
+}
+
+// --------------------- Tag hierarchy ---------------------
+
+bool TagManager::RenameTag(const std::string &tagName, const std::string &newName)
+{
+    WriteBatch batch(*this);
+    auto idOpt = m_impl->FindName(tagName);
+    const std::string newPath = NormalizeTag(newName);
+    if (!idOpt.has_value() || newPath.empty() || m_impl->Find(newPath).has_value())
+        return false;
+
+    const TagId id = idOpt.value();
+    const std::string oldPath = m_impl->PathOf(id);
+    const std::string oldPrefix = oldPath + "/";
+    if (newPath.compare(0, oldPrefix.size(), oldPrefix) == 0)
+    {
+        std::cerr << "TagManager: cannot move tag " << oldPath << " below itself\n";
+        return false;
+    }
+
+    // Log missing parents first so replay can attach the node
+    const size_t slash = newPath.rfind('/');
+    if (slash != std::string::npos)
+    {
+        bool created = false;
+        EnsureTag(newPath.substr(0, slash), created);
+    }
+    m_impl->RememberUndo([this, id, oldPath, rules = m_impl->rules]()
+                         {
+        RelinkTag(id, oldPath);
+        m_impl->rules = rules;
+        std::string error;
+        m_impl->ruleEngine.Compile(m_impl->rules, error); });
+    RelinkTag(id, newPath);
+    RetargetRules(oldPath, newPath);
+
+    // The one record covers the rules too: replay retargets them the same way
+    m_impl->store.Append({TagStore::RecordType::RenameTag, id, newPath});
+    return CommitLog();
+}
+
+// Rules name tags by path; keep them pointing at the same tags after a rename.
+// Run on rename and on its replay, so the rules in the snapshot catch up with the log.
+void TagManager::RetargetRules(const std::string &oldPath, const std::string &newPath)
+{
+    const std::string oldPrefix = oldPath + "/";
+    bool changed = false;
+    for (TagRule &rule : m_impl->rules)
+    {
+        const std::string ruleTag = NormalizeTag(rule.tag);
+        if (ruleTag == oldPath || ruleTag.compare(0, oldPrefix.size(), oldPrefix) == 0)
+        {
+            rule.tag = newPath + ruleTag.substr(oldPath.size());
+            changed = true;
+        }
+    }
+    if (changed)
+    {
+        std::string error;
+        m_impl->ruleEngine.Compile(m_impl->rules, error);
+    }
+}
+
+std::vector<std::string> TagManager::GetChildTags(const std::string &tagPath) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    std::vector<std::string> out;
+    const std::string path = NormalizeTag(tagPath);
+    TagId parent = INVALID_TAG_ID;
+    if (!path.empty())
+    {
+        auto idOpt = m_impl->Find(path);
+        if (!idOpt.has_value())
+            return out;
+        parent = idOpt.value();
+    }
+
+    for (const auto &child : m_impl->ChildrenOf(parent))
+        out.push_back(m_impl->PathOf(child.second));
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+FileBitmap TagManager::GetSubtreeFiles(const std::string &tagPath) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    FileBitmap merged;
+    auto idOpt = m_impl->FindName(tagPath);
+    if (!idOpt.has_value())
+        return merged;
+
+    // Union of the reverse indexes; tag names are never enumerated or compared
+    std::vector<TagId> stack{idOpt.value()};
+    while (!stack.empty())
+    {
+        const TagInfo &info = m_impl->tags[stack.back()];
+        stack.pop_back();
+        merged |= *info.files;
+        for (const auto &child : info.children)
+            stack.push_back(child.second);
+    }
+    return merged;
+}
+
+std::vector<FileData *> TagManager::GetFilesUnderTag(const std::string &tagPath)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    std::vector<FileData *> out;
+    GetSubtreeFiles(tagPath).ForEach([&](size_t fileId)
+                                     {
+        if (FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId)))
+            out.push_back(fd); });
+    return out;
+}
+
+// --------------------- Queries ---------------------
+
+bool TagManager::SelectFiles(const std::string &query, FileBitmap &outFiles, std::string &outError) const
+{
+    TagQuery parsed;
+    if (!parsed.Parse(query, outError))
+        return false;
+
+    // One snapshot for the whole evaluation: concurrent writers cannot tear the result
+    const TagSnapshotPtr snapshot = GetTagMap();
+
+    // Plain operands use the snapshot's bitmaps in place; subtrees are merged once per operand
+    std::deque<FileBitmap> subtrees;
+    auto resolve = [&](const std::string &tag, bool subtree) -> const FileBitmap *
+    {
+        const TagSnapshot::Tag *found = snapshot->Find(tag);
+        if (!found)
+            return nullptr;
+        if (!subtree)
+            return found->files.get();
+        subtrees.push_back(snapshot->SubtreeFiles(*found));
+        return &subtrees.back();
+    };
+
+    return parsed.Evaluate(resolve, *snapshot->indexedFiles, outFiles, outError);
+}
+
+const TagSet *TagManager::GetFileTags(size_t fileIndex) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    const FileData *fd = m_searchManager.GetFileByIndex(fileIndex);
+    return fd ? &fd->tags : nullptr;
+}
+
+// --------------------- Bulk assignments ---------------------
+
+// Both overloads return the selection as a bitmap over file IDs
+FileBitmap TagManager::CollectSelection(const std::vector<size_t> &fileIndices, TagBulkResult &result) const
+{
+    FileBitmap selection(m_searchManager.GetSlotCount());
+    for (size_t idx : fileIndices)
+    {
+        const FileData *fd = m_searchManager.GetFileByIndex(idx);
+        if (!fd)
+        {
+            result.failures.push_back({idx, "file index out of range"});
+            continue;
+        }
+        selection.Set(fd->handle.slot);
+    }
+    return selection;
+}
+
+FileBitmap TagManager::CollectSelection(const FileBitmap &selection, TagBulkResult &result) const
+{
+    FileBitmap valid(m_searchManager.GetSlotCount());
+    selection.ForEach([&](size_t fileId)
+                      {
+        if (!m_searchManager.FindFileByID(static_cast<int>(fileId)))
+        {
+            result.failures.push_back({fileId, "unknown file ID"});
+            return;
+        }
+        valid.Set(fileId); });
+    return valid;
+}
+
+TagBulkResult TagManager::ApplyBulk(const FileBitmap &selection, TagBulkResult result,
+                                    const std::string &fromTag, const std::string &toTag)
+{
+    // Resolve names to IDs once per batch
+    TagId from = INVALID_TAG_ID;
+    if (!fromTag.empty())
+    {
+        auto idOpt = m_impl->FindName(fromTag);
+        if (!idOpt.has_value())
+        {
+            result.error = "unknown tag: " + fromTag;
+            return result;
+        }
+        from = idOpt.value();
+    }
+
+    TagId to = INVALID_TAG_ID;
+    bool created = false;
+    if (!toTag.empty())
+    {
+        to = EnsureTag(toTag, created);
+        if (to == INVALID_TAG_ID)
+        {
+            result.error = "invalid tag name: " + toTag;
+            return result;
+        }
+    }
+
+    if (from == to)
+        return result; // retag onto itself is a no-op
+
+    // Pass 1: strip fromTag from the selected files (or take the whole selection for plain assign)
+    FileBitmap affected = selection;
+    if (from != INVALID_TAG_ID)
+    {
+        affected &= *m_impl->tags[from].files;
+        affected.ForEach([&](size_t fileId)
+                         { UnlinkTag(fileId, from); });
+    }
+
+    // Pass 2: add toTag, skipping files that already carry it
+    size_t added = 0;
+    if (to != INVALID_TAG_ID)
+        added = AssignBitmapById(affected, to);
+
+    result.applied = (from != INVALID_TAG_ID) ? affected.Count() : added;
+
+    // Single persistence commit for the whole batch; if it fails the batch is rolled back
+    result.persisted = CommitLog();
+    if (!result.persisted)
+    {
+        std::cerr << "TagManager: bulk operation rolled back, the tag log commit failed\n";
+        result.applied = 0;
+    }
+
+    return result;
+}
+
+TagBulkResult TagManager::AssignTagBulk(const std::vector<size_t> &fileIndices, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap selection = CollectSelection(fileIndices, result);
+    return ApplyBulk(selection, std::move(result), "", tagName);
+}
+
+TagBulkResult TagManager::AssignTagBulk(const FileBitmap &selection, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap valid = CollectSelection(selection, result);
+    return ApplyBulk(valid, std::move(result), "", tagName);
+}
+
+TagBulkResult TagManager::RemoveTagBulk(const std::vector<size_t> &fileIndices, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap selection = CollectSelection(fileIndices, result);
+    return ApplyBulk(selection, std::move(result), tagName, "");
+}
+
+TagBulkResult TagManager::RemoveTagBulk(const FileBitmap &selection, const std::string &tagName)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap valid = CollectSelection(selection, result);
+    return ApplyBulk(valid, std::move(result), tagName, "");
+}
+
+TagBulkResult TagManager::RetagBulk(const std::vector<size_t> &fileIndices, const std::string &fromTag, const std::string &toTag)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap selection = CollectSelection(fileIndices, result);
+    return ApplyBulk(selection, std::move(result), fromTag, toTag);
+}
+
+TagBulkResult TagManager::RetagBulk(const FileBitmap &selection, const std::string &fromTag, const std::string &toTag)
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    FileBitmap valid = CollectSelection(selection, result);
+    return ApplyBulk(valid, std::move(result), fromTag, toTag);
+}
+
+size_t TagManager::AssignBitmapById(const FileBitmap &files, TagId id)
+{
+    size_t added = 0;
+    files.ForEach([&](size_t fileId)
+                  {
+        if (LinkTag(fileId, id))
+            ++added; });
+    return added;
+}
+
+// --------------------- Undo / redo ---------------------
+
+// Loaded steps index a path table: map them onto the files indexed now (others are skipped),
+// then apply each change to its tag in bulk (see LinkFiles). The step moves
+// to the other stack in the same commit; if that fails, both are rolled back (see RollBack)
+// and the step stays where it was.
+bool TagManager::ApplyHistoryStep(TagHistory::Step step, bool undo)
+{
+    if (step.paths)
+    {
+        auto localize = [&](const TagHistory::FileSet &set)
+        {
+            std::vector<uint32_t> ids;
+            set.ForEach([&](size_t index)
+                        {
+                const FileHandle handle = m_searchManager.GetHandle((*step.paths)[index]);
+                if (handle.IsValid())
+                    ids.push_back(handle.slot); });
+            std::sort(ids.begin(), ids.end());
+            return TagHistory::FileSet::FromSorted(std::move(ids));
+        };
+        for (TagHistory::Change &change : step.changes)
+        {
+            change.added = localize(change.added);
+            change.removed = localize(change.removed);
+        }
+        step.paths.reset();
+    }
+
+    m_impl->applyingHistory = true;
+    for (const TagHistory::Change &change : step.changes)
+    {
+        if (!m_impl->Get(change.tag))
+            continue; // deleted since
+        LinkFiles((undo ? change.added : change.removed).ToBitmap(), change.tag, false);
+        LinkFiles((undo ? change.removed : change.added).ToBitmap(), change.tag, true);
+    }
+
+    TagHistory &history = m_impl->history;
+    const uint64_t event = history.Events() + 1;
+    m_impl->store.Append({undo ? TagStore::RecordType::Undo : TagStore::RecordType::Redo, INVALID_TAG_ID, std::to_string(event)});
+    history.SetEvents(event);
+    if (undo)
+        history.PushRedo(std::move(step));
+    else
+        history.PushUndo(std::move(step));
+    m_impl->RememberUndo([this, undo, event]
+                         {
+        TagHistory &h = m_impl->history;
+        TagHistory::Step back;
+        if (undo && h.PopRedo(back))
+            h.PushUndo(std::move(back));
+        else if (!undo && h.PopUndo(back))
+            h.PushRedo(std::move(back));
+        h.SetEvents(event - 1); });
+
+    const bool committed = CommitLog();
+    m_impl->applyingHistory = false;
+    return committed;
+}
+
+bool TagManager::Undo()
+{
+    WriteBatch batch(*this);
+    m_impl->history.CommitStep(); // an open explicit batch is a step of its own
+
+    TagHistory::Step step;
+    if (!m_impl->history.PopUndo(step))
+        return false;
+    return ApplyHistoryStep(std::move(step), true);
+}
+
+bool TagManager::Redo()
+{
+    WriteBatch batch(*this);
+    m_impl->history.CommitStep();
+
+    TagHistory::Step step;
+    if (!m_impl->history.PopRedo(step))
+        return false;
+    return ApplyHistoryStep(std::move(step), false);
+}
+
+bool TagManager::CanUndo() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->history.CanUndo();
+}
+
+bool TagManager::CanRedo() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->history.CanRedo();
+}
+
+std::string TagManager::DescribeHistoryStep(const TagHistory::Step *step) const
+{
+    if (!step || step->changes.empty())
+        return std::string();
+
+    auto nameOf = [&](TagId id)
+    {
+        return m_impl->Get(id) ? m_impl->PathOf(id) : std::string("(deleted tag)");
+    };
+    auto files = [](size_t n)
+    {
+        return " (" + std::to_string(n) + (n == 1 ? " file)" : " files)");
+    };
+
+    const auto &changes = step->changes;
+    if (changes.size() == 1)
+    {
+        const TagHistory::Change &c = changes[0];
+        if (c.removed.Empty())
+            return "assign " + nameOf(c.tag) + files(c.added.Count());
+        if (c.added.Empty())
+            return "remove " + nameOf(c.tag) + files(c.removed.Count());
+    }
+    if (changes.size() == 2)
+    {
+        // Retag: one tag only lost files, the other only gained the same number
+        const TagHistory::Change *from = changes[0].added.Empty() ? &changes[0] : &changes[1];
+        const TagHistory::Change *to = (from == &changes[0]) ? &changes[1] : &changes[0];
+        if (from->added.Empty() && to->removed.Empty() && from->removed.Count() == to->added.Count())
+            return "retag " + nameOf(from->tag) + " -> " + nameOf(to->tag) + files(to->added.Count());
+    }
+
+    size_t total = 0;
+    for (const TagHistory::Change &c : changes)
+        total += c.added.Count() + c.removed.Count();
+    return "change " + std::to_string(changes.size()) + " tags" + " (" + std::to_string(total) + " assignments)";
+}
+
+std::string TagManager::GetUndoLabel() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return DescribeHistoryStep(m_impl->history.PeekUndo());
+}
+
+std::string TagManager::GetRedoLabel() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return DescribeHistoryStep(m_impl->history.PeekRedo());
+}
+
+bool TagManager::SetHistoryBudget(size_t bytes)
+{
+    WriteBatch batch(*this);
+    m_impl->history.SetBudget(bytes);
+
+    // The budget lives in the snapshot only
+    return Compact();
+}
+
+size_t TagManager::GetHistoryBudget() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->history.GetBudget();
+}
+
+// --------------------- Auto-tagging rules ---------------------
+
+bool TagManager::SetRules(const std::vector<TagRule> &rules, std::string &outError)
+{
+    WriteBatch batch(*this);
+    for (const TagRule &rule : rules)
+    {
+        if (rule.tag.empty())
+        {
+            outError = "rule without a tag";
+            return false;
+        }
+    }
+
+    TagRuleEngine engine;
+    if (!engine.Compile(rules, outError))
+        return false;
+
+    m_impl->rules = rules;
+    m_impl->ruleEngine = std::move(engine);
+
+    // Rules live in the snapshot only
+    return Compact();
+}
+
+std::vector<TagRule> TagManager::GetRules() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->rules;
+}
+
+TagBulkResult TagManager::ApplyRuleMatches(const std::vector<FileBitmap> &matches)
+{
+    TagBulkResult result;
+    const auto &compiledRules = m_impl->ruleEngine.GetRules();
+
+    // Merge rules that target the same tag, interning each tag once
+    std::unordered_map<TagId, FileBitmap> perTag;
+    for (size_t r = 0; r < compiledRules.size() && r < matches.size(); ++r)
+    {
+        if (matches[r].None())
+            continue;
+        bool created = false;
+        const TagId id = EnsureTag(compiledRules[r].tag, created);
+        if (id != INVALID_TAG_ID)
+            perTag[id] |= matches[r];
+    }
+
+    // The classifier works in file-index space; tag bitmaps are keyed by file ID
+    for (auto &entry : perTag)
+    {
+        FileBitmap ids(m_searchManager.GetSlotCount());
+        entry.second.ForEach([&](size_t idx)
+                             {
+            if (const FileData *fd = m_searchManager.GetFileByIndex(idx))
+                ids.Set(fd->handle.slot); });
+        entry.second = std::move(ids);
+    }
+
+    for (const auto &entry : perTag)
+        result.applied += AssignBitmapById(entry.second, entry.first);
+
+    // Single persistence commit for the whole pass; if it fails the pass is rolled back
+    result.persisted = CommitLog();
+    if (!result.persisted)
+        result.applied = 0;
+    return result;
+}
+
+TagBulkResult TagManager::ApplyRules()
+{
+    WriteBatch batch(*this);
+    const auto &files = m_searchManager.GetAllFiles();
+    return ApplyRuleMatches(m_impl->ruleEngine.ClassifyAll(files));
+}
+
+TagBulkResult TagManager::ApplyRulesToRefreshDelta()
+{
+    WriteBatch batch(*this);
+    const auto &files = m_searchManager.GetAllFiles();
+    return ApplyRuleMatches(m_impl->ruleEngine.ClassifyIndices(files, m_searchManager.GetLastRefreshDelta()));
+}
+
+// --------------------- Extended-attribute backend ---------------------
+
+bool TagManager::SetXattrBackend(bool enabled)
+{
+    WriteBatch batch(*this);
+    if (enabled && !XattrTagStore::IsSupported())
+    {
+        std::cerr << "TagManager: extended attributes are not supported on this platform\n";
+        return false;
+    }
+    if (m_impl->xattrBackend == enabled)
+        return true;
+
+    m_impl->xattrBackend = enabled;
+    m_impl->xattrDirty = FileBitmap();
+    m_searchManager.SetReadXattrTags(enabled);
+
+    // The switch lives in the snapshot only
+    return Compact();
+}
+
+bool TagManager::IsXattrBackendEnabled() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->xattrBackend;
+}
+
+// --------------------- Content fingerprints ---------------------
+
+bool TagManager::SetContentFingerprints(bool enabled)
+{
+    WriteBatch batch(*this);
+    if (m_impl->fingerprints == enabled)
+        return true;
+
+    m_impl->fingerprints = enabled;
+    m_impl->fingerprintDirty = FileBitmap();
+    if (enabled)
+    {
+        // Fingerprint every tagged file that is indexed right now
+        for (const TagInfo &info : m_impl->tags)
+            m_impl->fingerprintDirty |= *info.files;
+        if (!CommitLog())
+            return false;
+    }
+
+    // The switch lives in the snapshot only
+    return Compact();
+}
+
+bool TagManager::IsContentFingerprintsEnabled() const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    return m_impl->fingerprints;
+}
+
+TagBulkResult TagManager::ImportXattrTags()
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    if (!XattrTagStore::IsSupported())
+    {
+        result.error = "extended attributes are not supported on this platform";
+        return result;
+    }
+
+    const size_t fileCount = m_searchManager.GetAllFiles().size();
+    for (size_t idx = 0; idx < fileCount; ++idx)
+    {
+        FileData *fd = m_searchManager.GetFileByIndex(idx);
+        if (fd->type != FileType::REGULAR_FILE && fd->type != FileType::DIRECTORY)
+            continue;
+
+        if (!XattrTagStore::Read(fd->path, fd->xattrTags))
+        {
+            result.failures.push_back({idx, "cannot read tags attribute"});
+            continue;
+        }
+        if (MergeXattrTags(*fd))
+            ++result.applied;
+    }
+
+    // Single persistence commit for the whole import; if it fails the import is rolled back
+    result.persisted = CommitLog();
+    if (!result.persisted)
+        result.applied = 0;
+    return result;
+}
+
+TagBulkResult TagManager::ExportXattrTags()
+{
+    WriteBatch batch(*this);
+    TagBulkResult result;
+    if (!XattrTagStore::IsSupported())
+    {
+        result.error = "extended attributes are not supported on this platform";
+        return result;
+    }
+
+    const size_t fileCount = m_searchManager.GetAllFiles().size();
+    for (size_t idx = 0; idx < fileCount; ++idx)
+    {
+        FileData *fd = m_searchManager.GetFileByIndex(idx);
+        if (fd->type != FileType::REGULAR_FILE && fd->type != FileType::DIRECTORY)
+            continue;
+
+        if (!XattrTagStore::Write(fd->path, fd->tags))
+        {
+            result.failures.push_back({idx, "cannot write tags attribute"});
+            continue;
+        }
+        fd->xattrTags = fd->tags;
+        if (!fd->tags.Empty())
+            ++result.applied;
+    }
+
+    // Every indexed file was just written
+    m_impl->xattrDirty.ClearAll();
+    return result;
+}
+
+std::vector<FileData *> TagManager::GetFilesByTag(const std::string &tagName)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    std::vector<FileData *> out;
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
+        return out;
+
+    m_impl->tags[idOpt.value()].files->ForEach([&](size_t fileId)
+                                               {
+        if (FileData *fd = m_searchManager.FindFileByID(static_cast<int>(fileId)))
+            out.push_back(fd); });
+
+    return out;
+}
 
 std::string TagManager::NormalizeTag(const std::string &tag)
 {
-    // Identity implementation as requested. Keep as a single place to change later.
-    return tag;
+    // Tags are '/'-separated paths: drop empty segments ("/a//b/" -> "a/b").
+    // Otherwise identity; keep as a single place to change later.
+    std::string out;
+    out.reserve(tag.size());
+    for (size_t i = 0; i < tag.size(); ++i)
+    {
+        if (tag[i] == '/' && (out.empty() || out.back() == '/'))
+            continue;
+        out.push_back(tag[i]);
+    }
+    if (!out.empty() && out.back() == '/')
+        out.pop_back();
+    return out;
 }
 
-// --------------------- Additional private members & initialization ---------------------
+// --------------------- Snapshots ---------------------
 
-// We declare the private members that support GetTagMap cache and the pimpl above.
-class TagManagerPrivateMembers
+const TagSnapshot::Tag *TagSnapshot::Find(const std::string &tagName) const
 {
-public:
-    std::unordered_map<std::string, std::vector<size_t>> m_tagMapCache;
-    bool initialized = false;
-};
+    return FindNormalized(TagManager::NormalizeTag(tagName));
+}
+
+const TagSnapshot::Tag *TagSnapshot::FindNormalized(const std::string &name) const
+{
+    auto it = byName.find(name);
+    return it == byName.end() ? nullptr : &tags[it->second];
+}
+
+FileBitmap TagSnapshot::SubtreeFiles(const std::string &tagName) const
+{
+    const Tag *root = Find(tagName);
+    return root ? SubtreeFiles(*root) : FileBitmap();
+}
+
+FileBitmap TagSnapshot::SubtreeFiles(const Tag &root) const
+{
+    // Sorted by name, so the descendants ("name/...") form one contiguous run
+    FileBitmap merged = *root.files;
+    const std::string prefix = root.name + "/";
+    auto it = std::lower_bound(tags.begin(), tags.end(), prefix, [](const Tag &tag, const std::string &key)
+                               { return tag.name < key; });
+    for (; it != tags.end() && it->name.compare(0, prefix.size(), prefix) == 0; ++it)
+        merged |= *it->files;
+    return merged;
+}
+
+TagManager::WriteBatch::WriteBatch(TagManager &owner)
+    : m_owner(owner)
+{
+    m_owner.m_impl->mutex.lock();
+    ++m_owner.m_impl->batchDepth;
+}
+
+TagManager::WriteBatch::~WriteBatch()
+{
+    Impl &impl = *m_owner.m_impl;
+    bool published = false;
+    if (--impl.batchDepth == 0)
+    {
+        // Everything assigned / removed in the batch becomes one undo step
+        impl.history.CommitStep();
+        published = m_owner.Publish();
+    }
+    impl.mutex.unlock();
+
+    // Subscribers run outside the writer lock so they can read without stalling writers
+    if (published)
+        m_owner.NotifySubscribers();
+}
 
-// Because header has no place for these, we add them as members to TagManager (C++ allowed if declared in class).
-// But since we cannot change header here, we emulate with static globals (not ideal, but keeps compatibility).
-// Better: update the header to expose TagInfo map or return a copy.
+// Build the next snapshot from the live state. Bitmaps are shared, not copied (the next
+// write to one clones it, see Impl::EditFiles). While the tag set is unchanged the previous
+// layout (names, destinations, lookup) is reused and only replaced bitmaps are recounted.
+// Returns false, publishing nothing, when the state equals the current snapshot.
+bool TagManager::Publish()
+{
+    const TagSnapshotPtr current = std::atomic_load(&m_impl->published);
+    auto next = std::make_shared<TagSnapshot>();
+    next->indexedFiles = m_impl->indexedFiles;
+    next->tagSetVersion = m_impl->tagSetGeneration;
+    bool changed = !current || current->indexedFiles != next->indexedFiles;
+
+    if (current && current->tagSetVersion == next->tagSetVersion)
+    {
+        next->tags = current->tags;
+        next->byName = current->byName;
+        for (TagSnapshot::Tag &tag : next->tags)
+        {
+            const auto &files = m_impl->tags[tag.id].files;
+            if (tag.files != files)
+            {
+                tag.files = files;
+                tag.count = files->Count();
+                changed = true;
+            }
+        }
+    }
+    else
+    {
+        // Counts of bitmaps that did not change carry over
+        std::vector<const TagSnapshot::Tag *> previous(m_impl->tags.size(), nullptr);
+        if (current)
+        {
+            for (const TagSnapshot::Tag &tag : current->tags)
+                previous[tag.id] = &tag;
+        }
+
+        for (TagId id = 0; id < m_impl->tags.size(); ++id)
+        {
+            const TagInfo &info = m_impl->tags[id];
+            if (!info.alive)
+                continue;
+            const size_t count = (previous[id] && previous[id]->files == info.files) ? previous[id]->count : info.files->Count();
+            std::string destination = m_impl->EffectiveDestination(id);
+            fs::path destinationDir = DestinationDirectory(destination);
+            next->tags.push_back({id, m_impl->PathOf(id), std::move(destination), std::move(destinationDir),
+                                  m_impl->EffectiveOrganizeMode(id), count, info.files});
+        }
+        std::sort(next->tags.begin(), next->tags.end(), [](const TagSnapshot::Tag &a, const TagSnapshot::Tag &b)
+                  { return a.name < b.name; });
+        next->byName.reserve(next->tags.size());
+        for (size_t i = 0; i < next->tags.size(); ++i)
+            next->byName.emplace(next->tags[i].name, i);
+        changed = true;
+    }
+    if (!changed)
+        return false;
 
-static std::unordered_map<std::string, std::vector<size_t>> g_tag_map_cache;
-static bool g_tag_map_cache_init = false;
+    next->version = current ? current->version + 1 : 1;
+    const uint64_t version = next->version;
+    std::atomic_store(&m_impl->published, TagSnapshotPtr(std::move(next)));
+    m_impl->generation.store(version, std::memory_order_release);
+    return true;
+}
 
-// Provide a thin wrapper to keep GetTagMap semantics
-const std::unordered_map<std::string, std::vector<size_t>> &TagManager::GetTagMap() const
+void TagManager::NotifySubscribers()
 {
-    // Rebuild cache always to reflect up-to-date data
-    g_tag_map_cache.clear();
-    for (const auto &pair : m_impl->tags)
+    std::lock_guard<std::mutex> order(m_impl->notifyMutex);
+    const TagSnapshotPtr snapshot = GetTagMap();
+    if (snapshot->version <= m_impl->notifiedVersion)
+        return; // a racing writer already delivered this (or a newer) version
+
+    m_impl->notifiedVersion = snapshot->version;
+    std::vector<ChangeCallback> callbacks;
     {
-        g_tag_map_cache.emplace(pair.first, pair.second.fileIndices);
+        std::lock_guard<std::mutex> lock(m_impl->subscriberMutex);
+        for (const auto &subscriber : m_impl->subscribers)
+            callbacks.push_back(subscriber.second);
     }
-    g_tag_map_cache_init = true;
-    return g_tag_map_cache;
+    for (const ChangeCallback &callback : callbacks)
+        callback(snapshot);
+}
+
+TagSnapshotPtr TagManager::GetTagMap() const
+{
+    return std::atomic_load(&m_impl->published);
+}
+
+uint64_t TagManager::GetGeneration() const
+{
+    return m_impl->generation.load(std::memory_order_acquire);
+}
+
+size_t TagManager::Subscribe(ChangeCallback callback)
+{
+    std::lock_guard<std::mutex> lock(m_impl->subscriberMutex);
+    const size_t token = m_impl->nextSubscriber++;
+    m_impl->subscribers.emplace_back(token, std::move(callback));
+    return token;
+}
+
+void TagManager::Unsubscribe(size_t token)
+{
+    std::lock_guard<std::mutex> lock(m_impl->subscriberMutex);
+    auto &subscribers = m_impl->subscribers;
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [token](const auto &subscriber)
+                                     { return subscriber.first == token; }),
+                      subscribers.end());
 }
 
 bool TagManager::SetDestination(const std::string &tagName, const std::string &newPath)
 {
-    const std::string tag = NormalizeTag(tagName);
-    auto it = m_impl->tags.find(tag);
-    if (it == m_impl->tags.end())
+    WriteBatch batch(*this);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
         return false;
+    const TagId id = idOpt.value();
 
-    std::string abs;
-    if (!ValidateDestination(newPath, abs))
+    std::string stored; // empty: inherit from the parent
+    if (newPath.find('{') != std::string::npos)
+    {
+        // Template: stored as written, but what it expands to now must be usable
+        const TagInfo &info = m_impl->tags[id];
+        const std::string inherited = (info.parent == INVALID_TAG_ID) ? std::string() : m_impl->EffectiveDestination(info.parent);
+        const std::string expanded = ExpandDestinationTemplate(newPath, inherited, info.leaf, m_impl->PathOf(id));
+        std::string abs;
+        if (expanded.empty())
+        {
+            std::cerr << "TagManager: destination template needs a parent destination: " << newPath << "\n";
+            return false;
+        }
+        if (!ValidateDestination(expanded, abs))
+            return false;
+        stored = newPath;
+    }
+    else if (!newPath.empty() && !ValidateDestination(newPath, stored))
+    {
+        return false;
+    }
+
+    m_impl->RememberUndo([this, id, previous = m_impl->tags[id].destination]()
+                         {
+        m_impl->tags[id].destination = previous;
+        ++m_impl->tagSetGeneration; });
+    m_impl->tags[id].destination = stored;
+    ++m_impl->tagSetGeneration; // effective destinations below it may change too
+    m_impl->store.Append({TagStore::RecordType::SetDestination, id, stored});
+    return CommitLog();
+}
+
+bool TagManager::SetOrganizeMode(const std::string &tagName, std::optional<OrganizeMode> mode)
+{
+    WriteBatch batch(*this);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
         return false;
+    const TagId id = idOpt.value();
+
+    m_impl->RememberUndo([this, id, previous = m_impl->tags[id].organize]()
+                         {
+        m_impl->tags[id].organize = previous;
+        ++m_impl->tagSetGeneration; });
+    m_impl->tags[id].organize = mode;
+    ++m_impl->tagSetGeneration; // tags below it inherit the mode
+    m_impl->store.Append({TagStore::RecordType::SetOrganize, id, mode ? OrganizeModeName(*mode) : std::string()});
+    return CommitLog();
+}
 
-    it->second.destination = abs;
-    return SaveTagsToJson();
+std::optional<OrganizeMode> TagManager::GetOrganizeMode(const std::string &tagName) const
+{
+    std::lock_guard<std::recursive_mutex> lock(m_impl->mutex);
+    auto idOpt = m_impl->FindName(tagName);
+    if (!idOpt.has_value())
+        return std::nullopt;
+    return m_impl->EffectiveOrganizeMode(idOpt.value());
 }
@@ -4,13 +4,91 @@
 #include <string>
 #include <vector>
 #include <filesystem>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional> // ✅ Required for std::optional
 
 #include "SearchManager.h"
+#include "FileBitmap.h"
+#include "TagSet.h"
+#include "TagRuleEngine.h"
+#include "TagHistory.h"
+#include "OrganizeMode.h"
 
 // Forward declaration
 class FileData;
+struct FileFingerprint;
+
+/**
+ * Per-item failure reported by the bulk tag APIs.
+ */
+struct TagBulkFailure
+{
+    size_t fileIndex; // file index, or file ID for bitmap selections
+    std::string reason;
+};
+
+/**
+ * Result of a bulk tag operation.
+ *  - applied:   number of files whose tag set actually changed
+ *  - failures:  items that could not be processed (batch continues past them)
+ *  - error:     batch-level error (e.g. unknown tag); empty on success
+ *  - persisted: false if the single end-of-batch commit failed; the batch was rolled back
+ *               then (applied is 0, nothing changed)
+ */
+struct TagBulkResult
+{
+    size_t applied = 0;
+    std::vector<TagBulkFailure> failures;
+    std::string error;
+    bool persisted = true;
+
+    bool Ok() const { return error.empty() && failures.empty() && persisted; }
+};
+
+/**
+ * Immutable, versioned view of the tag state, published by TagManager (see GetTagMap).
+ * A snapshot never changes once published; holding the pointer keeps it alive, on any thread.
+ * Bitmaps of tags that did not change are shared between consecutive versions.
+ */
+struct TagSnapshot
+{
+    struct Tag
+    {
+        TagId id = INVALID_TAG_ID;
+        std::string name;                        // full normalized name
+        std::string destination;                 // effective destination (empty if none resolves)
+        std::filesystem::path destinationDir;    // destination as an absolute, normalized directory
+        std::optional<OrganizeMode> organize;    // own or inherited; empty = the job decides
+        size_t count = 0;                        // number of files, counted once per bitmap change
+        std::shared_ptr<const FileBitmap> files; // file IDs carrying the tag
+    };
+
+    uint64_t version = 0;                           // bumped by every published change (see GetGeneration)
+    uint64_t tagSetVersion = 0;                     // moves only when tags, names or destinations change
+    std::vector<Tag> tags;                          // live tags, sorted by name
+    std::unordered_map<std::string, size_t> byName; // name -> position in tags
+    std::shared_ptr<const FileBitmap> indexedFiles; // every indexed file ID (as of the last SyncWithIndex)
+
+    /**
+     * Tag by name (normalized here); nullptr if unknown.
+     */
+    const Tag *Find(const std::string &tagName) const;
+
+    /**
+     * Tag by a name that is normalized already (Tag::name, NormalizeTag output): no copy.
+     */
+    const Tag *FindNormalized(const std::string &name) const;
+
+    /**
+     * Files carrying the tag or any tag below it.
+     */
+    FileBitmap SubtreeFiles(const std::string &tagName) const;
+    FileBitmap SubtreeFiles(const Tag &root) const;
+};
+
+using TagSnapshotPtr = std::shared_ptr<const TagSnapshot>;
 
 /**
  * TagManager
@@ -19,17 +97,43 @@ class FileData;
  *
  * Responsibilities:
  *  - Create / delete tags (persisted in JSON)
- *  - Assign / remove tags from files
- *  - Maintain in-memory mapping of tag → file indices
+ *  - Assign / remove tags from files (a file may carry several tags)
+ *  - Intern tag names into dense TagIds (NormalizeTag runs once, at interning)
+ *  - Arrange tags in a hierarchy: "media/photo/raw" is a child of "media/photo".
+ *    Missing parents are created on demand; destinations are inherited from parents
+ *  - Keep forward (FileData::tags) and reverse (tag → file bitmap) indexes in sync
  *  - Validate / auto-create destination directories for each tag
- *  - Load and save tags.json on startup/shutdown
+ *  - Persist tags and assignments: tags.json snapshot + tags.wal write-ahead log
+ *    (see TagStore). Each operation / batch appends its records and commits once;
+ *    the log is folded into a new snapshot when it grows large and on shutdown.
+ *  - Optionally mirror each file's tags onto the file itself (see XattrTagStore)
+ *  - Optionally fingerprint tagged files to re-attach tags after moves (see FileFingerprint)
+ *  - Undo / redo assignment changes, one step per WriteBatch (see TagHistory, tags.history)
  *
- * Persistence format (tags.json):
+ * Threading:
+ *  - Writers are serialized. Each mutating call runs as one WriteBatch (batches nest) and,
+ *    when the outermost batch ends, publishes a new TagSnapshot if anything changed.
+ *  - GetTagMap(), GetGeneration() and SelectFiles() read the published snapshot without
+ *    taking the lock, so the UI, a classifier and a background scanner can query while
+ *    another thread writes. Subscribe() to be told when a new snapshot is published.
+ *  - Other getters read the live state under the writer lock. References they return
+ *    stay valid only until the next mutation; other threads should use a snapshot.
+ *  - SearchManager itself is not synchronized: refresh it (and call SyncWithIndex)
+ *    while holding a WriteBatch.
+ *
+ * Snapshot format (tags.json):
  * {
+ *   "nextTagId": 2,
  *   "tags": {
- *     "game": { "destination": "C:/Projects/Sorted/Game" },
- *     "art":  { "destination": "C:/Projects/Sorted/Art"  }
- *   }
+ *     "game": { "id": 0, "destination": "C:/Projects/Sorted/Game", "files": ["C:/Games/a.sav"] },
+ *     "art":  { "id": 1, "destination": "C:/Projects/Sorted/Art", "organize": "hardlink" }
+ *   },
+ *   "rules": [
+ *     { "tag": "photos", "priority": 10, "extensions": ["jpg", "png"], "minSize": 1048576 }
+ *   ],
+ *   "xattrBackend": true,
+ *   "contentFingerprints": true,
+ *   "fingerprints": { "C:/Games/a.sav": [size, sampleHash, fullHash or 0] }
  * }
  */
 class TagManager
@@ -38,6 +142,22 @@ public:
     explicit TagManager(SearchManager &searchManager);
     ~TagManager();
 
+    /**
+     * Holds the writer lock; the outermost batch publishes one snapshot when it ends.
+     * Group several calls (or a SearchManager refresh + SyncWithIndex) to publish them atomically.
+     */
+    class WriteBatch
+    {
+    public:
+        explicit WriteBatch(TagManager &owner);
+        ~WriteBatch();
+        WriteBatch(const WriteBatch &) = delete;
+        WriteBatch &operator=(const WriteBatch &) = delete;
+
+    private:
+        TagManager &m_owner;
+    };
+
     // ------------------ Tag lifecycle ------------------
 
     /**
@@ -48,11 +168,42 @@ public:
     bool CreateTag(const std::string tagName);
 
     /**
-     * Delete a tag and remove all file associations.
-     * Removes its metadata from tags.json but does not delete the folder.
+     * Delete a tag, every tag below it, and all their file associations.
+     * Removes their metadata from tags.json but does not delete the folders.
      */
     bool DeleteTag(const std::string tagName);
 
+    // ------------------ Tag hierarchy ------------------
+
+    /**
+     * Rename or move a tag ("media/video" -> "archive/video"). Tags below it follow:
+     * children only reference their parent, so this is O(depth), not O(subtree).
+     * Missing parents of the new name are created; rules naming the subtree are updated.
+     * Fails if the new name exists or lies below the tag itself.
+     */
+    bool RenameTag(const std::string &tagName, const std::string &newName);
+
+    /**
+     * Full names of the direct children of a tag (of the top level for ""), sorted.
+     */
+    std::vector<std::string> GetChildTags(const std::string &tagPath) const;
+
+    /**
+     * Files (by ID) carrying the tag or any tag below it, merged from the subtree's bitmaps.
+     */
+    FileBitmap GetSubtreeFiles(const std::string &tagPath) const;
+    std::vector<FileData *> GetFilesUnderTag(const std::string &tagPath);
+
+    // ------------------ Queries ------------------
+
+    /**
+     * Evaluate a boolean tag query, e.g. "(photo OR scan) AND NOT archived AND year2023",
+     * to a bitmap of file IDs (see TagQuery for the grammar; media/\* selects a subtree).
+     * Returns false with outError set on a syntax error or an unknown tag.
+     * Evaluated against the published snapshot; safe from any thread.
+     */
+    bool SelectFiles(const std::string &query, FileBitmap &outFiles, std::string &outError) const;
+
     // ------------------ Tag assignments ------------------
 
     /**
@@ -76,8 +227,162 @@ public:
      */
     bool RemoveTagByIndex(size_t fileIndex);
 
+    /**
+     * Assign / remove a single interned tag on a file. No name lookup.
+     * Returns false if the ID or index is invalid (or, for remove, the file lacks the tag).
+     */
+    bool AssignTagById(size_t fileIndex, TagId id);
+    bool RemoveTagById(size_t fileIndex, TagId id);
+
+    // ------------------ Bulk assignments ------------------
+    // Bulk variants apply the whole batch in one pass and persist at most once.
+    // Invalid items are reported in TagBulkResult::failures without aborting.
+
+    /**
+     * Assign tag to every file index in the list / file ID in the selection bitmap.
+     * Creates the tag (once) if it does not exist yet.
+     */
+    TagBulkResult AssignTagBulk(const std::vector<size_t> &fileIndices, const std::string &tagName);
+    TagBulkResult AssignTagBulk(const FileBitmap &selection, const std::string &tagName);
+
+    /**
+     * Remove a single tag from every file in the list / selection bitmap.
+     */
+    TagBulkResult RemoveTagBulk(const std::vector<size_t> &fileIndices, const std::string &tagName);
+    TagBulkResult RemoveTagBulk(const FileBitmap &selection, const std::string &tagName);
+
+    /**
+     * Move files from one tag to another (remove fromTag, assign toTag).
+     * Files in the selection that do not carry fromTag are left untouched.
+     */
+    TagBulkResult RetagBulk(const std::vector<size_t> &fileIndices, const std::string &fromTag, const std::string &toTag);
+    TagBulkResult RetagBulk(const FileBitmap &selection, const std::string &fromTag, const std::string &toTag);
+
+    // ------------------ Undo / redo ------------------
+
+    /**
+     * Revert / re-apply the most recent step of assignment changes. A step is everything
+     * one call (or one explicit WriteBatch) assigned and removed. Creating, deleting and
+     * renaming tags is not recorded; changes to a tag deleted since are skipped.
+     * Returns false if there is nothing to undo / redo or the log commit failed.
+     */
+    bool Undo();
+    bool Redo();
+    bool CanUndo() const;
+    bool CanRedo() const;
+
+    /**
+     * What Undo() / Redo() would apply, e.g. "assign photo (1234 files)"; empty if nothing.
+     */
+    std::string GetUndoLabel() const;
+    std::string GetRedoLabel() const;
+
+    /**
+     * Memory budget of the history (default 64 MiB); the oldest steps are dropped first.
+     * Persisted in tags.json; the history itself is saved to tags.history with each snapshot.
+     */
+    bool SetHistoryBudget(size_t bytes);
+    size_t GetHistoryBudget() const;
+
+    // ------------------ Auto-tagging rules ------------------
+
+    /**
+     * Replace the rule set. Rules are compiled immediately and persisted to tags.json.
+     * Returns false (rules unchanged) if a rule is malformed.
+     */
+    bool SetRules(const std::vector<TagRule> &rules, std::string &outError);
+    std::vector<TagRule> GetRules() const;
+
+    /**
+     * Classify every indexed file in one parallel pass and assign the matching tags.
+     * Tags named by rules are created on demand; tags.json is saved at most once.
+     */
+    TagBulkResult ApplyRules();
+
+    /**
+     * Same as ApplyRules(), restricted to files added/modified by the last SearchManager::Refresh().
+     */
+    TagBulkResult ApplyRulesToRefreshDelta();
+
+    // ------------------ Extended-attribute backend ------------------
+
+    /**
+     * Mirror every tag change onto the file's user.foldersort.tags attribute, so tags
+     * follow files moved or renamed by other tools on the same filesystem. Scans then read
+     * the attribute and SyncWithIndex() merges it into the central store.
+     * Persisted in tags.json. Existing tags are not written out; use ExportXattrTags().
+     * Returns false if the platform has no xattr support.
+     */
+    bool SetXattrBackend(bool enabled);
+    bool IsXattrBackendEnabled() const;
+
+    /**
+     * Bulk transfer between the attributes and the central store, over every indexed file.
+     * Import merges attribute tags into the central store (one log commit);
+     * export overwrites each file's attribute with its central tags.
+     * Works whether or not the backend is enabled.
+     */
+    TagBulkResult ImportXattrTags();
+    TagBulkResult ExportXattrTags();
+
+    // ------------------ Content fingerprints ------------------
+
+    /**
+     * Fingerprint tagged files (size + head/tail sample hash, full hash only when two
+     * tagged files share a sample) and persist the fingerprints with the assignments.
+     * SyncWithIndex() then re-attaches the tags of a tagged file whose path disappeared
+     * to an added file with the same fingerprint. Persisted in tags.json.
+     * Enabling fingerprints every currently indexed tagged file once.
+     */
+    bool SetContentFingerprints(bool enabled);
+    bool IsContentFingerprintsEnabled() const;
+
+    // ------------------ Index synchronization ------------------
+
+    /**
+     * Apply SearchManager's last IndexDelta to the live tag associations:
+     * removed files leave the reverse index, added files pick up their persisted tags,
+     * renamed files keep their tags and have their persisted assignments moved to the new path,
+     * as do relocated files (moved out of the tree, or onto an indexed file, which adopts them).
+     * With the xattr backend, tags stored on added / renamed files are merged in as well;
+     * with content fingerprints, orphaned tags are re-attached to added files by content.
+     * Call after SearchManager::LoadMetaData / Refresh / ApplyMoves.
+     */
+    void SyncWithIndex();
+
     // ------------------ Query operations ------------------
 
+    /**
+     * Look up the interned ID of a tag name. The name is normalized here;
+     * callers holding a TagId never pay for normalization or string compares again.
+     */
+    std::optional<TagId> FindTagId(const std::string &tagName) const;
+
+    /**
+     * Normalized name of an interned tag; empty if the ID is unknown or deleted.
+     */
+    std::string GetTagName(TagId id) const;
+
+    /**
+     * Effective destination directory of a tag; empty if none resolves or the tag is unknown.
+     *  - explicit path: used as is
+     *  - empty: parent's effective destination + this tag's last segment
+     *  - template: {parent}, {name} (last segment) and {tag} (full name) are expanded,
+     *    e.g. "{parent}/RAW" under "media/photo"
+     * Reads in-memory state, which is ahead of the tags.json snapshot.
+     */
+    std::string GetDestination(const std::string &tagName) const;
+
+    /**
+     * Destination as set: a path, a template, or empty (inherited).
+     */
+    std::string GetDestinationTemplate(const std::string &tagName) const;
+
+    /**
+     * Tags carried by a file (forward index). nullptr if the index is out of range.
+     */
+    const TagSet *GetFileTags(size_t fileIndex) const;
+
     /**
      * Get all FileData* that have a given tag.
      * Returns empty vector if tag not found or no matches.
@@ -85,21 +390,55 @@ public:
     std::vector<FileData *> GetFilesByTag(const std::string &tagName);
 
     /**
-     * Return internal map of tags and associated file indices.
-     * NOTE: for inspection only, modifying this map directly is unsafe.
+     * Latest published snapshot of every tag (name, effective destination, file IDs).
+     * Never null, never rebuilt per call: this is one atomic pointer load, safe from any thread.
+     */
+    TagSnapshotPtr GetTagMap() const;
+
+    // ------------------ Change notifications ------------------
+
+    /**
+     * Version of the latest published snapshot (TagSnapshot::version). One atomic
+     * load: poll it every frame and fetch GetTagMap() only when it moved.
+     */
+    uint64_t GetGeneration() const;
+
+    /**
+     * Call back with the new snapshot after each published change. Callbacks run on the
+     * writing thread once the writer lock is released, in version order (a version may be
+     * skipped when writers race). Keep them short (e.g. flag a UI refresh) and do not
+     * modify tags from inside one. Returns a token for Unsubscribe().
      */
-    const std::unordered_map<std::string, std::vector<size_t>> &GetTagMap() const;
+    using ChangeCallback = std::function<void(const TagSnapshotPtr &)>;
+    size_t Subscribe(ChangeCallback callback);
+    void Unsubscribe(size_t token);
 
     // ------------------ Utility ------------------
 
     /**
-     * Normalize a tag name for internal storage.
-     * Currently identity; modify here if you later want case-insensitive behavior.
+     * Normalize a tag name for internal storage: empty '/' segments are dropped.
+     * Otherwise identity; modify here if you later want case-insensitive behavior.
      */
     static std::string NormalizeTag(const std::string &tag);
 
+    /**
+     * Set a tag's destination: a directory (validated / created), a template
+     * (see GetDestination; its current expansion is validated), or empty to inherit.
+     */
     bool SetDestination(const std::string &tagName, const std::string &newPath);
 
+    /**
+     * How files of a tag are organized into its destination (move, copy, link, ...).
+     * Empty = inherit from the parent; a tag without one anywhere up its tree uses the
+     * mode of the job that moves it.
+     */
+    bool SetOrganizeMode(const std::string &tagName, std::optional<OrganizeMode> mode);
+
+    /**
+     * Effective mode (own or inherited); empty if none is set or the tag is unknown.
+     */
+    std::optional<OrganizeMode> GetOrganizeMode(const std::string &tagName) const;
+
 private:
     SearchManager &m_searchManager;
 
@@ -107,15 +446,58 @@ private:
     class Impl;
     std::unique_ptr<Impl> m_impl;
 
-    // Cache for GetTagMap() view
-    mutable std::unordered_map<std::string, std::vector<size_t>> m_tagMapCache;
-    mutable bool m_tagMapCacheInitialized = false;
-
     // ------------------ Internal Helpers ------------------
-    bool SaveTagsToJson() const;
+    bool SaveTagsToJson() const; // full snapshot
+    bool CommitLog(bool keepOnFailure = false); // group-commit pending log records, compact if large
+    bool Compact();                             // snapshot + truncate log
+    void RollBack();                            // undo changes whose records failed to commit
+    bool Publish();              // live state -> new TagSnapshot (writer lock held); false if unchanged
+    void NotifySubscribers();    // deliver the published snapshot (writer lock released)
+
+    // Intern / drop tag records (keeps both index directions consistent)
+    TagId InternTag(const std::string &tagName, bool &created);
+    TagId EnsureTag(const std::string &tagName, bool &created); // InternTag + log creation
+    void RestoreTag(TagId id, const std::string &tagName);
+    void RelinkTag(TagId id, const std::string &newPath); // rename / move, no logging
+    void RetargetRules(const std::string &oldPath, const std::string &newPath);
+    void DropTag(TagId id, std::vector<std::pair<std::string, TagSet>> *dropped = nullptr);
+    bool LinkTag(size_t fileId, TagId id);
+    bool UnlinkTag(size_t fileId, TagId id);
+    FileBitmap LinkFiles(const FileBitmap &files, TagId id, bool link); // bulk, unrecorded; returns the files changed
+
+    // Live view <- persisted assignments
+    void LoadFileTags(FileData &fd);
+    void RebuildFromAssignments();
+    void RebuildIndexedFiles(); // universe of SelectFiles(), published with the next snapshot
+
+    // xattr backend
+    bool MergeXattrTags(FileData &fd); // file attribute -> central store
+    void MarkXattrDirty(size_t fileId);
+    void FlushXattrTags();             // central store -> file attributes (dirty files only)
+
+    // content fingerprints
+    void LogFingerprint(const std::string &path, const FileFingerprint &fp);
+    void FlushFingerprints();
+    bool ReattachByFingerprint(FileData &fd);
+    bool MoveAssignments(const std::string &oldPath, FileData &fd);
+    bool MoveAssignments(const std::string &oldPath, const std::string &newPath); // persisted only
+
+    // undo / redo
+    bool ApplyHistoryStep(TagHistory::Step step, bool undo); // unrecorded, committed with the stack move; false = nothing changed
+    std::string DescribeHistoryStep(const TagHistory::Step *step) const;
+
     bool LoadTagsFromJson();
     bool ValidateDestination(const std::string &path, std::string &outAbsolute) const;
 
-    // Resolve file index by path using SearchManager (adapt to your API)
+    // Bulk helpers: validate a selection against SearchManager, then apply in one pass.
+    // Empty fromTag / toTag means "no removal" / "no assignment".
+    FileBitmap CollectSelection(const std::vector<size_t> &fileIndices, TagBulkResult &result) const;
+    FileBitmap CollectSelection(const FileBitmap &selection, TagBulkResult &result) const;
+    TagBulkResult ApplyBulk(const FileBitmap &selection, TagBulkResult result,
+                            const std::string &fromTag, const std::string &toTag);
+    size_t AssignBitmapById(const FileBitmap &files, TagId id); // returns newly tagged count
+    TagBulkResult ApplyRuleMatches(const std::vector<FileBitmap> &matches);
+
+    // Resolve file index by path through SearchManager's handle table
     std::optional<size_t> ResolveFileIndex(const std::filesystem::path &filePath) const;
 };
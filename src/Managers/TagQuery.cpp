@@ -0,0 +1,374 @@
+// TagQuery.cpp
+#include "TagQuery.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace
+{
+    bool IsOperatorChar(char c)
+    {
+        return c == '(' || c == ')' || c == '!' || c == '&' || c == '|' || c == '"';
+    }
+
+    bool EqualsKeyword(const std::string &word, const char *keyword)
+    {
+        size_t i = 0;
+        for (; i < word.size() && keyword[i]; ++i)
+        {
+            if (std::toupper(static_cast<unsigned char>(word[i])) != keyword[i])
+                return false;
+        }
+        return i == word.size() && !keyword[i];
+    }
+}
+
+// ------------------ Parsing ------------------
+
+struct TagQuery::Parser
+{
+    TagQuery &query;
+    const std::string &text;
+    size_t pos = 0;
+    Token current;
+    std::string error;
+
+    bool Next()
+    {
+        while (pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])))
+            ++pos;
+
+        current = Token();
+        if (pos >= text.size())
+            return true;
+
+        const char c = text[pos];
+        if (c == '(' || c == ')' || c == '!')
+        {
+            current.kind = (c == '(') ? Token::Kind::Open : (c == ')') ? Token::Kind::Close : Token::Kind::Not;
+            ++pos;
+            return true;
+        }
+        if (c == '&' || c == '|')
+        {
+            current.kind = (c == '&') ? Token::Kind::And : Token::Kind::Or;
+            while (pos < text.size() && text[pos] == c)
+                ++pos;
+            return true;
+        }
+
+        if (c == '"')
+        {
+            const size_t close = text.find('"', pos + 1);
+            if (close == std::string::npos)
+            {
+                error = "unterminated quote at " + std::to_string(pos);
+                return false;
+            }
+            current.kind = Token::Kind::Tag;
+            current.text = text.substr(pos + 1, close - pos - 1);
+            pos = close + 1;
+        }
+        else
+        {
+            const size_t start = pos;
+            while (pos < text.size() && !std::isspace(static_cast<unsigned char>(text[pos])) && !IsOperatorChar(text[pos]))
+                ++pos;
+            current.text = text.substr(start, pos - start);
+
+            if (EqualsKeyword(current.text, "AND"))
+                current.kind = Token::Kind::And;
+            else if (EqualsKeyword(current.text, "OR"))
+                current.kind = Token::Kind::Or;
+            else if (EqualsKeyword(current.text, "NOT"))
+                current.kind = Token::Kind::Not;
+            else
+                current.kind = Token::Kind::Tag;
+            if (current.kind != Token::Kind::Tag)
+                return true;
+        }
+
+        // "media/\*" and "media/**" select the subtree
+        for (const char *suffix : {"/**", "/*"})
+        {
+            const size_t n = std::char_traits<char>::length(suffix);
+            if (current.text.size() > n && current.text.compare(current.text.size() - n, n, suffix) == 0)
+            {
+                current.text.resize(current.text.size() - n);
+                current.subtree = true;
+                break;
+            }
+        }
+        if (current.text.empty())
+        {
+            error = "empty tag name at " + std::to_string(pos);
+            return false;
+        }
+        return true;
+    }
+
+    // Build an n-ary node, splicing in operands of the same kind: a AND (b AND c) -> AND(a, b, c)
+    size_t Combine(Node::Kind kind, const std::vector<size_t> &operands)
+    {
+        if (operands.size() == 1)
+            return operands[0];
+
+        Node node;
+        node.kind = kind;
+        for (size_t operand : operands)
+        {
+            const Node &child = query.m_nodes[operand];
+            if (child.kind == kind)
+                node.children.insert(node.children.end(), child.children.begin(), child.children.end());
+            else
+                node.children.push_back(operand);
+        }
+        return query.AddNode(std::move(node));
+    }
+
+    bool ParseOr(size_t &out)
+    {
+        std::vector<size_t> operands(1);
+        if (!ParseAnd(operands[0]))
+            return false;
+        while (current.kind == Token::Kind::Or)
+        {
+            if (!Next())
+                return false;
+            operands.emplace_back();
+            if (!ParseAnd(operands.back()))
+                return false;
+        }
+        out = Combine(Node::Kind::Or, operands);
+        return true;
+    }
+
+    bool ParseAnd(size_t &out)
+    {
+        std::vector<size_t> operands(1);
+        if (!ParseUnary(operands[0]))
+            return false;
+        while (current.kind == Token::Kind::And || current.kind == Token::Kind::Not ||
+               current.kind == Token::Kind::Tag || current.kind == Token::Kind::Open)
+        {
+            if (current.kind == Token::Kind::And && !Next())
+                return false;
+            operands.emplace_back();
+            if (!ParseUnary(operands.back()))
+                return false;
+        }
+        out = Combine(Node::Kind::And, operands);
+        return true;
+    }
+
+    bool ParseUnary(size_t &out)
+    {
+        if (current.kind == Token::Kind::Not)
+        {
+            if (!Next())
+                return false;
+            size_t operand;
+            if (!ParseUnary(operand))
+                return false;
+
+            // NOT NOT x -> x
+            if (query.m_nodes[operand].kind == Node::Kind::Not)
+            {
+                out = query.m_nodes[operand].children[0];
+                return true;
+            }
+            Node node;
+            node.kind = Node::Kind::Not;
+            node.children.push_back(operand);
+            out = query.AddNode(std::move(node));
+            return true;
+        }
+
+        if (current.kind == Token::Kind::Open)
+        {
+            if (!Next() || !ParseOr(out))
+                return false;
+            if (current.kind != Token::Kind::Close)
+            {
+                error = "expected ')' at " + std::to_string(pos);
+                return false;
+            }
+            return Next();
+        }
+
+        if (current.kind == Token::Kind::Tag)
+        {
+            Node node;
+            node.kind = Node::Kind::Tag;
+            node.tag = current.text;
+            node.subtree = current.subtree;
+            out = query.AddNode(std::move(node));
+            return Next();
+        }
+
+        error = (current.kind == Token::Kind::End) ? "unexpected end of query"
+                                                   : "unexpected token at " + std::to_string(pos);
+        return false;
+    }
+};
+
+size_t TagQuery::AddNode(Node node)
+{
+    m_nodes.push_back(std::move(node));
+    return m_nodes.size() - 1;
+}
+
+bool TagQuery::Parse(const std::string &text, std::string &outError)
+{
+    m_nodes.clear();
+    m_root = 0;
+
+    Parser parser{*this, text, 0, Token(), std::string()};
+    size_t root = 0;
+    bool ok = parser.Next() && parser.ParseOr(root);
+    if (ok && parser.current.kind != Token::Kind::End)
+    {
+        parser.error = "unexpected token at " + std::to_string(parser.pos);
+        ok = false;
+    }
+    if (!ok)
+    {
+        outError = parser.error;
+        m_nodes.clear();
+        return false;
+    }
+
+    m_root = root;
+    return true;
+}
+
+// ------------------ Evaluation ------------------
+
+bool TagQuery::Evaluate(const Resolver &resolve, const FileBitmap &universe, FileBitmap &outFiles, std::string &outError) const
+{
+    outFiles = FileBitmap();
+    if (m_nodes.empty())
+        return true;
+
+    Evaluation ev{universe, std::vector<const FileBitmap *>(m_nodes.size(), nullptr), std::vector<size_t>(m_nodes.size(), 0)};
+    const size_t universeCount = universe.Count();
+
+    // Resolve operands and estimate result sizes bottom-up (children precede parents)
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+    {
+        const Node &node = m_nodes[i];
+        switch (node.kind)
+        {
+        case Node::Kind::Tag:
+            ev.leaves[i] = resolve(node.tag, node.subtree);
+            if (!ev.leaves[i])
+            {
+                outError = "unknown tag: " + node.tag;
+                return false;
+            }
+            ev.estimates[i] = ev.leaves[i]->Count();
+            break;
+        case Node::Kind::Not:
+            // The child's estimate is itself only an upper bound, so its complement could be
+            // as big as the universe; anything smaller could wrongly stop an AND early
+            ev.estimates[i] = universeCount;
+            break;
+        case Node::Kind::And:
+        {
+            size_t est = universeCount;
+            for (size_t child : node.children)
+                est = std::min(est, ev.estimates[child]);
+            ev.estimates[i] = est;
+            break;
+        }
+        case Node::Kind::Or:
+        {
+            size_t est = 0;
+            for (size_t child : node.children)
+                est += ev.estimates[child];
+            ev.estimates[i] = std::min(est, universeCount);
+            break;
+        }
+        }
+    }
+
+    outFiles = Eval(ev, m_root);
+    return true;
+}
+
+FileBitmap TagQuery::Eval(const Evaluation &ev, size_t index) const
+{
+    const Node &node = m_nodes[index];
+    switch (node.kind)
+    {
+    case Node::Kind::Tag:
+        return *ev.leaves[index];
+
+    case Node::Kind::Not:
+    {
+        FileBitmap result = ev.universe;
+        const size_t child = node.children[0];
+        if (m_nodes[child].kind == Node::Kind::Tag)
+            result.AndNot(*ev.leaves[child]);
+        else
+            result.AndNot(Eval(ev, child));
+        return result;
+    }
+
+    case Node::Kind::Or:
+    {
+        FileBitmap result;
+        for (size_t child : node.children)
+        {
+            if (m_nodes[child].kind == Node::Kind::Tag)
+                result |= *ev.leaves[child];
+            else
+                result |= Eval(ev, child);
+        }
+        return result;
+    }
+
+    case Node::Kind::And:
+    {
+        // Intersect smallest operands first; subtract the biggest negations first
+        std::vector<size_t> positive;
+        std::vector<size_t> negative;
+        for (size_t child : node.children)
+        {
+            if (m_nodes[child].kind == Node::Kind::Not)
+                negative.push_back(m_nodes[child].children[0]);
+            else
+                positive.push_back(child);
+        }
+        std::sort(positive.begin(), positive.end(), [&](size_t a, size_t b)
+                  { return ev.estimates[a] < ev.estimates[b]; });
+        std::sort(negative.begin(), negative.end(), [&](size_t a, size_t b)
+                  { return ev.estimates[a] > ev.estimates[b]; });
+
+        if (!positive.empty() && ev.estimates[positive[0]] == 0)
+            return FileBitmap(); // empty operand: nothing else needs evaluating
+
+        FileBitmap result = positive.empty() ? ev.universe : Eval(ev, positive[0]);
+        for (size_t i = 1; i < positive.size(); ++i)
+        {
+            if (result.None())
+                return result;
+            if (m_nodes[positive[i]].kind == Node::Kind::Tag)
+                result &= *ev.leaves[positive[i]];
+            else
+                result &= Eval(ev, positive[i]);
+        }
+        for (size_t child : negative)
+        {
+            if (result.None())
+                return result;
+            if (m_nodes[child].kind == Node::Kind::Tag)
+                result.AndNot(*ev.leaves[child]);
+            else
+                result.AndNot(Eval(ev, child));
+        }
+        return result;
+    }
+    }
+    return FileBitmap();
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FileBitmap.h"
+
+/**
+ * TagQuery
+ * ---------
+ * Boolean expression over tag membership, e.g. (photo OR scan) AND NOT archived AND year2023
+ *
+ * Grammar (keywords are case-insensitive; symbols are synonyms):
+ *   query   := and ( (OR | '|' | '||') and )*
+ *   and     := unary ( [AND | '&' | '&&'] unary )*     juxtaposition also means AND
+ *   unary   := (NOT | '!') unary | primary
+ *   primary := '(' query ')' | tag | "quoted tag"
+ * A tag written as media/\* (or media/\*\*) selects that tag and every tag below it.
+ *
+ * Parse once, Evaluate() against the current tag bitmaps as often as needed.
+ * Evaluation orders AND operands by estimated cardinality (smallest first,
+ * negations last) and stops as soon as an intersection is empty.
+ */
+class TagQuery
+{
+public:
+    /**
+     * Returns false (query left empty) with outError set on a syntax error.
+     */
+    bool Parse(const std::string &text, std::string &outError);
+
+    bool Empty() const { return m_nodes.empty(); }
+
+    /**
+     * Maps a tag operand to its file bitmap; nullptr for an unknown tag.
+     * subtree is true for operands written as "tag/\*".
+     */
+    using Resolver = std::function<const FileBitmap *(const std::string &tag, bool subtree)>;
+
+    /**
+     * Evaluate to a bitmap over the same index space as the resolved bitmaps.
+     * universe is the set NOT complements against (every indexed file).
+     * Returns false with outError set if an operand does not resolve.
+     */
+    bool Evaluate(const Resolver &resolve, const FileBitmap &universe, FileBitmap &outFiles, std::string &outError) const;
+
+private:
+    struct Node
+    {
+        enum class Kind : uint8_t
+        {
+            Tag,
+            And,
+            Or,
+            Not
+        };
+        Kind kind = Kind::Tag;
+        std::string tag;             // Tag
+        bool subtree = false;        // Tag written as "tag/*"
+        std::vector<size_t> children; // And / Or: operands, Not: one operand
+    };
+
+    // Children always precede their parent, so index order is a valid bottom-up order
+    std::vector<Node> m_nodes;
+    size_t m_root = 0;
+
+    struct Token
+    {
+        enum class Kind : uint8_t
+        {
+            Tag,
+            And,
+            Or,
+            Not,
+            Open,
+            Close,
+            End
+        };
+        Kind kind = Kind::End;
+        std::string text;
+        bool subtree = false;
+    };
+
+    struct Parser;
+
+    struct Evaluation
+    {
+        const FileBitmap &universe;
+        std::vector<const FileBitmap *> leaves; // per node (Tag only)
+        std::vector<size_t> estimates;          // per node, upper bound of the result size
+    };
+
+    size_t AddNode(Node node);
+    FileBitmap Eval(const Evaluation &ev, size_t node) const;
+};
@@ -0,0 +1,517 @@
+// TagRuleEngine.cpp
+#include "TagRuleEngine.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <map>
+#include <thread>
+
+namespace
+{
+    // Below this many files a single thread is faster than spawning workers
+    constexpr size_t PARALLEL_MIN_FILES = 8192;
+
+    // Lazily built DFA states are dropped (between files) once this many exist
+    constexpr size_t DFA_STATE_LIMIT = 4096;
+
+    std::string LowerExtension(const std::filesystem::path &path)
+    {
+        std::string ext = path.extension().string();
+        if (!ext.empty() && ext[0] == '.')
+            ext.erase(0, 1);
+        for (char &c : ext)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return ext;
+    }
+
+    int64_t ToEpochSeconds(std::chrono::system_clock::time_point tp)
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(tp.time_since_epoch()).count();
+    }
+
+    void SetBit(std::vector<uint64_t> &set, size_t i) { set[i >> 6] |= (uint64_t(1) << (i & 63)); }
+    bool TestBit(const std::vector<uint64_t> &set, size_t i) { return (set[i >> 6] >> (i & 63)) & 1; }
+}
+
+// --------------------- Per-thread lazy DFA ---------------------
+
+class TagRuleEngine::Scratch
+{
+public:
+    explicit Scratch(const TagRuleEngine &engine)
+        : globHitStamp(engine.m_globPatternCount, 0), m_tokens(engine.m_globTokens)
+    {
+        Reset();
+    }
+
+    /**
+     * Run the combined automaton over one path and stamp every accepted pattern.
+     */
+    void Match(const std::string &path)
+    {
+        ++stamp;
+        if (m_tokens.empty())
+            return;
+        if (m_states.size() > DFA_STATE_LIMIT)
+            Reset();
+
+        int cur = 0;
+        for (unsigned char c : path)
+        {
+            int next = m_states[cur].next[c];
+            if (next < 0)
+            {
+                next = Transition(cur, c);
+                m_states[cur].next[c] = next;
+            }
+            cur = next;
+            if (cur == m_deadState)
+                return;
+        }
+
+        for (uint32_t pattern : m_states[cur].accepts)
+            globHitStamp[pattern] = stamp;
+    }
+
+    std::vector<uint32_t> globHitStamp; // per pattern: == stamp if matched for the current file
+    uint32_t stamp = 0;
+    std::vector<size_t> ruleBuffer;
+    int64_t now = ToEpochSeconds(std::chrono::system_clock::now()); // "now" for age predicates
+
+private:
+    using Token = TagRuleEngine::GlobToken;
+    using Kind = Token::Kind;
+
+    struct DState
+    {
+        std::vector<uint64_t> nfa;     // set of NFA positions
+        std::vector<uint32_t> accepts; // patterns accepted in this state
+        int next[256];
+    };
+
+    const std::vector<Token> &m_tokens;
+    std::vector<DState> m_states;
+    std::map<std::vector<uint64_t>, int> m_lookup;
+    int m_deadState = -1;
+
+    void Reset()
+    {
+        m_states.clear();
+        m_lookup.clear();
+        m_deadState = -1;
+
+        // Start state: first position of every pattern (i.e. 0 and each position after an Accept)
+        std::vector<uint64_t> start((m_tokens.size() + 63) / 64, 0);
+        bool atPatternStart = true;
+        for (size_t i = 0; i < m_tokens.size(); ++i)
+        {
+            if (atPatternStart)
+                SetBit(start, i);
+            atPatternStart = (m_tokens[i].kind == Kind::Accept);
+        }
+        Intern(std::move(start));
+    }
+
+    // Epsilon closure: wildcards may match the empty string and fall through to i + 1.
+    // Epsilon edges only go forward, so a single ascending pass is enough.
+    void Close(std::vector<uint64_t> &set) const
+    {
+        for (size_t i = 0; i < m_tokens.size(); ++i)
+        {
+            if (!TestBit(set, i))
+                continue;
+            const Kind k = m_tokens[i].kind;
+            if (k == Kind::Star || k == Kind::DoubleStar || k == Kind::DirStar)
+                SetBit(set, i + 1);
+        }
+    }
+
+    int Intern(std::vector<uint64_t> set)
+    {
+        Close(set);
+        auto it = m_lookup.find(set);
+        if (it != m_lookup.end())
+            return it->second;
+
+        DState state;
+        std::fill(std::begin(state.next), std::end(state.next), -1);
+        bool empty = true;
+        for (size_t i = 0; i < m_tokens.size(); ++i)
+        {
+            if (!TestBit(set, i))
+                continue;
+            empty = false;
+            if (m_tokens[i].kind == Kind::Accept)
+                state.accepts.push_back(m_tokens[i].pattern);
+        }
+        state.nfa = set;
+
+        const int id = static_cast<int>(m_states.size());
+        m_states.push_back(std::move(state));
+        m_lookup.emplace(std::move(set), id);
+        if (empty)
+            m_deadState = id;
+        return id;
+    }
+
+    int Transition(int from, unsigned char c)
+    {
+        std::vector<uint64_t> next(m_states[from].nfa.size(), 0);
+        const std::vector<uint64_t> &cur = m_states[from].nfa;
+        for (size_t i = 0; i < m_tokens.size(); ++i)
+        {
+            if (!TestBit(cur, i))
+                continue;
+            const Token &t = m_tokens[i];
+            switch (t.kind)
+            {
+            case Kind::Literal:
+                if (c == t.literal)
+                    SetBit(next, i + 1);
+                break;
+            case Kind::AnyChar:
+                if (c != '/')
+                    SetBit(next, i + 1);
+                break;
+            case Kind::Class:
+                if ((t.classBits[c >> 6] >> (c & 63)) & 1)
+                    SetBit(next, i + 1);
+                break;
+            case Kind::Star:
+                if (c != '/')
+                    SetBit(next, i);
+                break;
+            case Kind::DoubleStar:
+                SetBit(next, i);
+                break;
+            case Kind::DirStar:
+                SetBit(next, i);
+                if (c == '/')
+                    SetBit(next, i + 1);
+                break;
+            case Kind::Accept:
+                break;
+            }
+        }
+        return Intern(std::move(next));
+    }
+};
+
+TagRuleEngine::TagRuleEngine() = default;
+TagRuleEngine::~TagRuleEngine() = default;
+
+std::unique_ptr<TagRuleEngine::Scratch> TagRuleEngine::CreateScratch() const
+{
+    return std::make_unique<Scratch>(*this);
+}
+
+// --------------------- Compilation ---------------------
+
+bool TagRuleEngine::CompileGlob(const std::string &rawPattern, size_t patternIndex, std::string &outError)
+{
+    std::string pattern = rawPattern;
+    std::replace(pattern.begin(), pattern.end(), '\\', '/');
+
+    // A bare name pattern ("*.tmp") matches the last path component only
+    if (pattern.find('/') == std::string::npos)
+        pattern = "**/" + pattern;
+
+    for (size_t i = 0; i < pattern.size(); ++i)
+    {
+        GlobToken t;
+        const char c = pattern[i];
+        if (c == '*')
+        {
+            if (i + 1 < pattern.size() && pattern[i + 1] == '*')
+            {
+                if (i + 2 < pattern.size() && pattern[i + 2] == '/')
+                {
+                    t.kind = GlobToken::Kind::DirStar;
+                    i += 2;
+                }
+                else
+                {
+                    t.kind = GlobToken::Kind::DoubleStar;
+                    i += 1;
+                }
+            }
+            else
+            {
+                t.kind = GlobToken::Kind::Star;
+            }
+        }
+        else if (c == '?')
+        {
+            t.kind = GlobToken::Kind::AnyChar;
+        }
+        else if (c == '[')
+        {
+            size_t j = i + 1;
+            bool negate = false;
+            if (j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^'))
+            {
+                negate = true;
+                ++j;
+            }
+            const size_t first = j;
+            while (j < pattern.size() && (pattern[j] != ']' || j == first))
+            {
+                unsigned char lo = static_cast<unsigned char>(pattern[j]);
+                unsigned char hi = lo;
+                if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']')
+                {
+                    hi = static_cast<unsigned char>(pattern[j + 2]);
+                    j += 2;
+                }
+                for (unsigned v = lo; v <= hi; ++v)
+                    t.classBits[v >> 6] |= (uint64_t(1) << (v & 63));
+                ++j;
+            }
+            if (j >= pattern.size())
+            {
+                outError = "unterminated '[' in glob: " + rawPattern;
+                return false;
+            }
+            if (negate)
+            {
+                for (auto &w : t.classBits)
+                    w = ~w;
+            }
+            // a class never matches the path separator
+            t.classBits['/' >> 6] &= ~(uint64_t(1) << ('/' & 63));
+            t.kind = GlobToken::Kind::Class;
+            i = j;
+        }
+        else
+        {
+            t.kind = GlobToken::Kind::Literal;
+            t.literal = static_cast<unsigned char>(c);
+        }
+        m_globTokens.push_back(t);
+    }
+
+    GlobToken accept;
+    accept.kind = GlobToken::Kind::Accept;
+    accept.pattern = static_cast<uint32_t>(patternIndex);
+    m_globTokens.push_back(accept);
+    return true;
+}
+
+bool TagRuleEngine::Compile(const std::vector<TagRule> &rules, std::string &outError)
+{
+    m_rules = rules;
+    m_compiled.clear();
+    m_extTable.clear();
+    m_noExtRules.clear();
+    m_globTokens.clear();
+    m_globPatternCount = 0;
+
+    // Highest priority first; declaration order breaks ties
+    std::stable_sort(m_rules.begin(), m_rules.end(), [](const TagRule &a, const TagRule &b)
+                     { return a.priority > b.priority; });
+
+    for (size_t r = 0; r < m_rules.size(); ++r)
+    {
+        TagRule &rule = m_rules[r];
+        CompiledRule compiled;
+        compiled.ruleIndex = r;
+        compiled.hasExtensions = !rule.extensions.empty();
+
+        for (std::string &ext : rule.extensions)
+        {
+            if (!ext.empty() && ext[0] == '.')
+                ext.erase(0, 1);
+            for (char &c : ext)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            m_extTable.emplace(ext, std::vector<size_t>());
+        }
+
+        for (const std::string &glob : rule.globs)
+        {
+            if (!CompileGlob(glob, m_globPatternCount, outError))
+            {
+                Compile({}, outError);
+                return false;
+            }
+            compiled.globPatterns.push_back(m_globPatternCount++);
+        }
+        m_compiled.push_back(std::move(compiled));
+    }
+
+    // Candidate lists per extension, merged with extension-less rules, in priority order
+    for (size_t r = 0; r < m_rules.size(); ++r)
+    {
+        if (!m_compiled[r].hasExtensions)
+        {
+            m_noExtRules.push_back(r);
+            for (auto &entry : m_extTable)
+                entry.second.push_back(r);
+            continue;
+        }
+        for (const std::string &ext : m_rules[r].extensions)
+        {
+            auto &list = m_extTable[ext];
+            if (list.empty() || list.back() != r)
+                list.push_back(r);
+        }
+    }
+
+    return true;
+}
+
+// --------------------- Classification ---------------------
+
+void TagRuleEngine::Classify(const FileData &file, Scratch &scratch, std::vector<size_t> &outRules) const
+{
+    if (file.type == FileType::DIRECTORY || m_rules.empty())
+        return;
+
+    // 1. extension table
+    const std::vector<size_t> *candidates = &m_noExtRules;
+    if (!m_extTable.empty())
+    {
+        auto it = m_extTable.find(LowerExtension(file.path));
+        if (it != m_extTable.end())
+            candidates = &it->second;
+    }
+    if (candidates->empty())
+        return;
+
+    const int64_t mtime = ToEpochSeconds(file.modifiedTime);
+    bool globsRun = false;
+
+    for (size_t r : *candidates)
+    {
+        const TagRule &rule = m_rules[r];
+        const CompiledRule &compiled = m_compiled[r];
+
+        // 3. numeric predicates (cheap, checked before the automaton)
+        if (rule.minSize && file.size < rule.minSize)
+            continue;
+        if (rule.maxSize && file.size > rule.maxSize)
+            continue;
+        if (rule.minAgeDays && mtime > scratch.now - int64_t(rule.minAgeDays) * 86400)
+            continue;
+        if (rule.maxAgeDays && mtime < scratch.now - int64_t(rule.maxAgeDays) * 86400)
+            continue;
+
+        // 2. combined glob automaton, run at most once per file
+        if (!compiled.globPatterns.empty())
+        {
+            if (!globsRun)
+            {
+                scratch.Match(file.path.generic_string());
+                globsRun = true;
+            }
+            bool hit = false;
+            for (size_t p : compiled.globPatterns)
+            {
+                if (scratch.globHitStamp[p] == scratch.stamp)
+                {
+                    hit = true;
+                    break;
+                }
+            }
+            if (!hit)
+                continue;
+        }
+
+        outRules.push_back(r);
+        if (rule.stop)
+            break;
+    }
+}
+
+void TagRuleEngine::ClassifyRange(const std::vector<FileData> &files, const size_t *indices, size_t begin, size_t end,
+                                  int64_t now, std::vector<FileBitmap> &out) const
+{
+    auto scratch = CreateScratch();
+    scratch->now = now;
+    for (size_t i = begin; i < end; ++i)
+    {
+        const size_t idx = indices ? indices[i] : i;
+        scratch->ruleBuffer.clear();
+        Classify(files[idx], *scratch, scratch->ruleBuffer);
+        for (size_t r : scratch->ruleBuffer)
+            out[r].Set(idx);
+    }
+}
+
+// Workers own disjoint 64-file word ranges of the shared output bitmaps,
+// so no synchronization is needed while classifying. Ages are measured from one "now"
+// taken per call, so a long-lived engine never classifies against its compile time.
+std::vector<FileBitmap> TagRuleEngine::ClassifyAll(const std::vector<FileData> &files) const
+{
+    const int64_t now = ToEpochSeconds(std::chrono::system_clock::now());
+    const size_t n = files.size();
+    std::vector<FileBitmap> out(m_rules.size(), FileBitmap(n));
+    if (m_rules.empty() || n == 0)
+        return out;
+
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+    if (n < PARALLEL_MIN_FILES)
+        workers = 1;
+
+    size_t chunk = (n + workers - 1) / workers;
+    chunk = (chunk + 63) & ~size_t(63);
+
+    std::vector<std::thread> threads;
+    for (size_t begin = chunk; begin < n; begin += chunk)
+    {
+        const size_t end = std::min(n, begin + chunk);
+        threads.emplace_back([this, &files, &out, begin, end, now]()
+                             { ClassifyRange(files, nullptr, begin, end, now, out); });
+    }
+    ClassifyRange(files, nullptr, 0, std::min(n, chunk), now, out);
+
+    for (auto &t : threads)
+        t.join();
+    return out;
+}
+
+std::vector<FileBitmap> TagRuleEngine::ClassifyIndices(const std::vector<FileData> &files, const std::vector<size_t> &indices) const
+{
+    const int64_t now = ToEpochSeconds(std::chrono::system_clock::now());
+    const size_t n = files.size();
+    std::vector<FileBitmap> out(m_rules.size(), FileBitmap(n));
+    if (m_rules.empty() || indices.empty())
+        return out;
+
+    std::vector<size_t> sorted;
+    sorted.reserve(indices.size());
+    for (size_t idx : indices)
+    {
+        if (idx < n)
+            sorted.push_back(idx);
+    }
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    size_t workers = std::max<size_t>(1, std::thread::hardware_concurrency());
+    if (sorted.size() < PARALLEL_MIN_FILES)
+        workers = 1;
+
+    // Split points are moved forward until they fall on a new bitmap word
+    const size_t target = (sorted.size() + workers - 1) / workers;
+    std::vector<std::thread> threads;
+    size_t begin = 0;
+    while (begin < sorted.size())
+    {
+        size_t end = std::min(sorted.size(), begin + target);
+        while (end < sorted.size() && (sorted[end] >> 6) == (sorted[end - 1] >> 6))
+            ++end;
+        if (end == sorted.size() && begin == 0)
+        {
+            ClassifyRange(files, sorted.data(), 0, end, now, out);
+            break;
+        }
+        threads.emplace_back([this, &files, &sorted, &out, begin, end, now]()
+                             { ClassifyRange(files, sorted.data(), begin, end, now, out); });
+        begin = end;
+    }
+
+    for (auto &t : threads)
+        t.join();
+    return out;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SearchManager.h"
+#include "FileBitmap.h"
+
+// Declarative auto-tagging rule (persisted in tags.json under "rules").
+//
+// All present conditions must hold (AND); within a list any entry may match (OR).
+//   extensions              : {"jpg", "png"}, case-insensitive, without the dot
+//   globs                   : {"**/invoices/**"}, matched against the generic ('/') path;
+//                             a pattern without '/' matches the file name only.
+//                             Supports *, **, ?, [abc], [!a-z]
+//   minSize / maxSize       : bytes, 0 = unbounded
+//   minAgeDays / maxAgeDays : age of last modification in days, 0 = unbounded
+//
+// Rules run in descending priority; a matching rule with stop = true
+// prevents lower-priority rules from tagging the same file.
+struct TagRule
+{
+    std::string tag;
+    int priority = 0;
+    std::vector<std::string> extensions;
+    std::vector<std::string> globs;
+    std::uintmax_t minSize = 0;
+    std::uintmax_t maxSize = 0;
+    uint32_t minAgeDays = 0;
+    uint32_t maxAgeDays = 0;
+    bool stop = false;
+};
+
+/**
+ * TagRuleEngine
+ * --------------
+ * Compiles a rule set into a single-pass classifier:
+ *   1. extension lookup table  -> candidate rules (already in priority order)
+ *   2. one combined glob automaton for every pattern (lazy DFA, run at most once per file)
+ *   3. numeric predicates (size / age)
+ *
+ * Classification is read-only and safe to run from several threads,
+ * each with its own Scratch.
+ */
+class TagRuleEngine
+{
+public:
+    TagRuleEngine();
+    ~TagRuleEngine();
+
+    /**
+     * Compile rules. Returns false (and leaves the engine empty) if a glob is malformed.
+     */
+    bool Compile(const std::vector<TagRule> &rules, std::string &outError);
+
+    bool Empty() const { return m_rules.empty(); }
+    const std::vector<TagRule> &GetRules() const { return m_rules; }
+
+    /**
+     * Per-thread matching state (lazy DFA cache + reusable buffers).
+     */
+    class Scratch;
+    std::unique_ptr<Scratch> CreateScratch() const;
+
+    /**
+     * Classify one file. Appends the indices (into GetRules()) of matching rules.
+     * Ages are measured from the time the scratch was created.
+     */
+    void Classify(const FileData &file, Scratch &scratch, std::vector<size_t> &outRules) const;
+
+    /**
+     * Classify every file (or only the listed indices) into one bitmap per rule,
+     * splitting the work across hardware threads. Bitmaps are sized to files.size().
+     */
+    std::vector<FileBitmap> ClassifyAll(const std::vector<FileData> &files) const;
+    std::vector<FileBitmap> ClassifyIndices(const std::vector<FileData> &files, const std::vector<size_t> &indices) const;
+
+private:
+    // One NFA position of the combined glob automaton
+    struct GlobToken
+    {
+        enum class Kind : uint8_t
+        {
+            Literal,    // exact byte
+            AnyChar,    // ?
+            Star,       // *   (any run without '/')
+            DoubleStar, // **  (any run)
+            DirStar,    // **/ (empty, or any run ending in '/')
+            Class,      // [...]
+            Accept      // end of pattern
+        };
+        Kind kind = Kind::Literal;
+        unsigned char literal = 0;
+        uint32_t pattern = 0;          // Accept: pattern index
+        uint64_t classBits[4] = {};    // Class: 256-bit membership set
+    };
+
+    struct CompiledRule
+    {
+        size_t ruleIndex;
+        std::vector<size_t> globPatterns; // indices into the automaton's patterns
+        bool hasExtensions;
+    };
+
+    std::vector<TagRule> m_rules;              // sorted by descending priority
+    std::vector<CompiledRule> m_compiled;      // parallel to m_rules
+    std::unordered_map<std::string, std::vector<size_t>> m_extTable; // ext -> candidate rules
+    std::vector<size_t> m_noExtRules;          // candidates for any other extension
+    std::vector<GlobToken> m_globTokens;       // combined NFA of all glob patterns
+    size_t m_globPatternCount = 0;
+
+    bool CompileGlob(const std::string &pattern, size_t patternIndex, std::string &outError);
+    void ClassifyRange(const std::vector<FileData> &files, const size_t *indices, size_t begin, size_t end,
+                       int64_t now, std::vector<FileBitmap> &out) const;
+};
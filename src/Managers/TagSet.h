@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Dense interned tag identifier (see TagManager::FindTagId)
+using TagId = uint32_t;
+static constexpr TagId INVALID_TAG_ID = UINT32_MAX;
+
+/**
+ * TagSet
+ * -------
+ * Small set of tag IDs carried by a single file.
+ *
+ * Most files have one or two tags, so up to INLINE_CAPACITY IDs are stored
+ * inline in the FileData record; larger sets spill to a heap vector.
+ * IDs are kept sorted so Contains() is a short scan and iteration is ordered.
+ */
+class TagSet
+{
+public:
+    static constexpr size_t INLINE_CAPACITY = 4;
+
+    size_t Size() const { return m_size; }
+    bool Empty() const { return m_size == 0; }
+
+    const TagId *begin() const { return Data(); }
+    const TagId *end() const { return Data() + m_size; }
+
+    bool Contains(TagId id) const
+    {
+        for (TagId t : *this)
+        {
+            if (t == id)
+                return true;
+            if (t > id)
+                break;
+        }
+        return false;
+    }
+
+    /**
+     * Insert an ID. Returns false if it was already present.
+     */
+    bool Insert(TagId id)
+    {
+        size_t pos = 0;
+        const TagId *data = Data();
+        while (pos < m_size && data[pos] < id)
+            ++pos;
+        if (pos < m_size && data[pos] == id)
+            return false;
+
+        if (m_size == INLINE_CAPACITY && m_heap.empty())
+        {
+            // Spill inline storage to the heap
+            m_heap.assign(m_inline, m_inline + m_size);
+        }
+
+        if (!m_heap.empty())
+        {
+            m_heap.insert(m_heap.begin() + pos, id);
+        }
+        else
+        {
+            for (size_t i = m_size; i > pos; --i)
+                m_inline[i] = m_inline[i - 1];
+            m_inline[pos] = id;
+        }
+        ++m_size;
+        return true;
+    }
+
+    /**
+     * Erase an ID. Returns false if it was not present.
+     */
+    bool Erase(TagId id)
+    {
+        TagId *data = Data();
+        size_t pos = 0;
+        while (pos < m_size && data[pos] != id)
+            ++pos;
+        if (pos == m_size)
+            return false;
+
+        if (!m_heap.empty())
+        {
+            m_heap.erase(m_heap.begin() + pos);
+            if (m_heap.size() <= INLINE_CAPACITY)
+            {
+                // Shrink back into inline storage
+                for (size_t i = 0; i < m_heap.size(); ++i)
+                    m_inline[i] = m_heap[i];
+                m_heap.clear();
+                m_heap.shrink_to_fit();
+            }
+        }
+        else
+        {
+            for (size_t i = pos; i + 1 < m_size; ++i)
+                m_inline[i] = m_inline[i + 1];
+        }
+        --m_size;
+        return true;
+    }
+
+    void Clear()
+    {
+        m_heap.clear();
+        m_heap.shrink_to_fit();
+        m_size = 0;
+    }
+
+private:
+    TagId m_inline[INLINE_CAPACITY] = {};
+    std::vector<TagId> m_heap; // used only when Size() > INLINE_CAPACITY
+    uint32_t m_size = 0;
+
+    const TagId *Data() const { return m_heap.empty() ? m_inline : m_heap.data(); }
+    TagId *Data() { return m_heap.empty() ? m_inline : m_heap.data(); }
+};
@@ -0,0 +1,408 @@
+// TagStore.cpp
+#include "TagStore.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char LOG_MAGIC[4] = {'F', 'S', 'W', 'L'};
+    constexpr uint32_t LOG_VERSION = 1;
+    constexpr size_t HEADER_SIZE = 8;
+
+    // ------------------ Platform file primitives ------------------
+
+    int OpenAppend(const std::string &path)
+    {
+#if defined(_WIN32)
+        return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_BINARY | _O_APPEND, _S_IREAD | _S_IWRITE);
+#else
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+    }
+
+    bool WriteAll(int fd, const uint8_t *data, size_t size)
+    {
+        while (size > 0)
+        {
+#if defined(_WIN32)
+            const int n = _write(fd, data, static_cast<unsigned>(size));
+#else
+            const ssize_t n = ::write(fd, data, size);
+#endif
+            if (n <= 0)
+                return false;
+            data += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    bool SyncFile(int fd)
+    {
+#if defined(_WIN32)
+        return _commit(fd) == 0;
+#else
+        return ::fsync(fd) == 0;
+#endif
+    }
+
+    bool TruncateFile(int fd, uint64_t size)
+    {
+#if defined(_WIN32)
+        return _chsize_s(fd, static_cast<__int64>(size)) == 0;
+#else
+        return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+    }
+
+    void CloseFile(int fd)
+    {
+#if defined(_WIN32)
+        _close(fd);
+#else
+        ::close(fd);
+#endif
+    }
+
+    int OpenTruncate(const std::string &path)
+    {
+#if defined(_WIN32)
+        return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        return ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+    }
+
+    // Make a rename in dir durable (directory entries are not covered by the file's fsync)
+    bool SyncDirectory(const std::filesystem::path &dir)
+    {
+#if defined(_WIN32)
+        (void)dir;
+        return true;
+#else
+        const std::string name = dir.empty() ? std::string(".") : dir.string();
+        const int fd = ::open(name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        const bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+#endif
+    }
+
+    // ------------------ Encoding ------------------
+
+    void PutU32(std::vector<uint8_t> &out, uint32_t v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    uint32_t GetU32(const uint8_t *p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    // FNV-1a, enough to detect torn / garbage tails
+    uint32_t Checksum(const uint8_t *data, size_t size)
+    {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < size; ++i)
+        {
+            h ^= data[i];
+            h *= 16777619u;
+        }
+        return h;
+    }
+
+    void PutHeader(std::vector<uint8_t> &out)
+    {
+        out.insert(out.end(), LOG_MAGIC, LOG_MAGIC + 4);
+        PutU32(out, LOG_VERSION);
+    }
+}
+
+TagStore::TagStore(std::string logPath)
+    : m_logPath(std::move(logPath))
+{
+}
+
+TagStore::~TagStore()
+{
+    if (m_fd >= 0)
+    {
+        Commit();
+        CloseFile(m_fd);
+    }
+}
+
+bool TagStore::Replay(const std::function<void(const Record &)> &apply)
+{
+    m_validBytes = 0;
+    m_replayed = true;
+
+    std::ifstream ifs(m_logPath, std::ios::binary);
+    if (!ifs.is_open())
+        return true; // no log yet
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    if (data.size() < HEADER_SIZE || !std::equal(LOG_MAGIC, LOG_MAGIC + 4, data.begin()) ||
+        GetU32(data.data() + 4) != LOG_VERSION)
+    {
+        if (!data.empty())
+            std::cerr << "TagStore: " << m_logPath << " has no valid header; ignoring log\n";
+        return true;
+    }
+
+    size_t pos = HEADER_SIZE;
+    while (pos + 5 <= data.size())
+    {
+        const uint8_t *rec = data.data() + pos;
+        const uint32_t payloadLen = GetU32(rec + 1);
+        if (payloadLen < 4 || pos + 5 + payloadLen + 4 > data.size())
+            break;
+
+        const uint8_t *payload = rec + 5;
+        if (Checksum(rec, 5 + payloadLen) != GetU32(payload + payloadLen))
+            break;
+
+        Record record;
+        record.type = static_cast<RecordType>(rec[0]);
+        record.tag = GetU32(payload);
+        if (payloadLen >= 8)
+        {
+            const uint32_t textLen = GetU32(payload + 4);
+            if (8 + size_t(textLen) != payloadLen)
+                break;
+            record.text.assign(reinterpret_cast<const char *>(payload + 8), textLen);
+        }
+        apply(record);
+
+        pos += 5 + payloadLen + 4;
+    }
+
+    m_validBytes = pos;
+    if (pos != data.size())
+        std::cerr << "TagStore: dropping " << (data.size() - pos) << " trailing bytes of torn log\n";
+    return true;
+}
+
+bool TagStore::Open()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd >= 0)
+        return true;
+
+    // Never truncate a log whose valid length we have not measured
+    if (!m_replayed)
+        Replay([](const Record &) {});
+
+    m_fd = OpenAppend(m_logPath);
+    if (m_fd < 0)
+    {
+        std::cerr << "TagStore: failed to open " << m_logPath << " for appending\n";
+        return false;
+    }
+
+    // Drop a torn tail (or a foreign file) so new records follow the last good one
+    if (m_validBytes < HEADER_SIZE)
+    {
+        std::vector<uint8_t> header;
+        PutHeader(header);
+        if (!TruncateFile(m_fd, 0) || !WriteAll(m_fd, header.data(), header.size()) || !SyncFile(m_fd))
+        {
+            std::cerr << "TagStore: failed to initialize " << m_logPath << "\n";
+            return false;
+        }
+        m_logBytes = HEADER_SIZE;
+    }
+    else
+    {
+        if (!TruncateFile(m_fd, m_validBytes))
+        {
+            std::cerr << "TagStore: failed to truncate torn log tail\n";
+            return false;
+        }
+        m_logBytes = m_validBytes;
+    }
+    return true;
+}
+
+void TagStore::Append(const Record &record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const size_t start = m_buffer.size();
+    m_buffer.push_back(static_cast<uint8_t>(record.type));
+    const bool hasText = record.type != RecordType::DeleteTag;
+    PutU32(m_buffer, static_cast<uint32_t>(hasText ? 8 + record.text.size() : 4));
+    PutU32(m_buffer, record.tag);
+    if (hasText)
+    {
+        PutU32(m_buffer, static_cast<uint32_t>(record.text.size()));
+        m_buffer.insert(m_buffer.end(), record.text.begin(), record.text.end());
+    }
+    PutU32(m_buffer, Checksum(m_buffer.data() + start, m_buffer.size() - start));
+
+    m_appendedLsn += m_buffer.size() - start;
+}
+
+bool TagStore::Commit()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const uint64_t target = m_appendedLsn;
+    bool ok = true;
+
+    while (m_durableLsn < target)
+    {
+        if (m_flushing)
+        {
+            // Another caller is flushing; its write may already cover our records
+            m_flushed.wait(lock);
+            continue;
+        }
+        if (m_fd < 0)
+            return false;
+
+        m_flushing = true;
+        std::vector<uint8_t> batch;
+        batch.swap(m_buffer);
+        const uint64_t batchEnd = m_appendedLsn;
+        const uint64_t durableBytes = m_logBytes;
+        lock.unlock();
+
+        ok = WriteAll(m_fd, batch.data(), batch.size()) && SyncFile(m_fd);
+        if (!ok)
+        {
+            // Drop whatever part of the batch reached the file, so a retry appends it whole
+            // after the last durable record instead of after a torn one
+            TruncateFile(m_fd, durableBytes);
+        }
+
+        lock.lock();
+        m_flushing = false;
+        if (ok)
+        {
+            m_logBytes += batch.size();
+            m_durableLsn = batchEnd;
+        }
+        else
+        {
+            // The batch goes back in front of anything appended meanwhile, for the next Commit()
+            batch.insert(batch.end(), m_buffer.begin(), m_buffer.end());
+            m_buffer.swap(batch);
+        }
+        m_flushed.notify_all();
+        if (!ok)
+        {
+            std::cerr << "TagStore: failed to write " << m_logPath << "\n";
+            return false;
+        }
+    }
+    return ok;
+}
+
+uint64_t TagStore::Mark() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_appendedLsn;
+}
+
+void TagStore::Discard(uint64_t mark)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_flushed.wait(lock, [this]()
+                   { return !m_flushing; });
+    if (mark >= m_appendedLsn)
+        return;
+
+    // Not flushing, so the buffer holds exactly the bytes from m_durableLsn on
+    const uint64_t keep = mark > m_durableLsn ? mark - m_durableLsn : 0;
+    m_buffer.resize(static_cast<size_t>(std::min<uint64_t>(keep, m_buffer.size())));
+    m_appendedLsn = m_durableLsn + m_buffer.size();
+}
+
+bool TagStore::Reset()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_flushed.wait(lock, [this]()
+                   { return !m_flushing; });
+    if (m_fd < 0)
+        return false;
+
+    std::vector<uint8_t> header;
+    PutHeader(header);
+    if (!TruncateFile(m_fd, 0) || !WriteAll(m_fd, header.data(), header.size()) || !SyncFile(m_fd))
+    {
+        std::cerr << "TagStore: failed to reset " << m_logPath << "\n";
+        return false;
+    }
+
+    // Anything still buffered was folded into the snapshot as well
+    m_buffer.clear();
+    m_durableLsn = m_appendedLsn;
+    m_logBytes = HEADER_SIZE;
+    return true;
+}
+
+uint64_t TagStore::LogBytes() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_logBytes;
+}
+
+bool TagStore::WriteSnapshot(const std::string &path, const std::string &contents)
+{
+    namespace fs = std::filesystem;
+    const std::string tmpPath = path + ".tmp";
+
+    const int fd = OpenTruncate(tmpPath);
+    if (fd < 0)
+    {
+        std::cerr << "TagStore: failed to open " << tmpPath << " for writing\n";
+        return false;
+    }
+    const bool written = WriteAll(fd, reinterpret_cast<const uint8_t *>(contents.data()), contents.size()) && SyncFile(fd);
+    CloseFile(fd);
+    if (!written)
+    {
+        std::cerr << "TagStore: failed to write " << tmpPath << "\n";
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        // On some platforms rename fails when target exists; try remove+rename
+        fs::remove(path, ec); // ignore error
+        fs::rename(tmpPath, path, ec);
+        if (ec)
+        {
+            std::cerr << "TagStore: failed to finalize " << path << ": " << ec.message() << "\n";
+            return false;
+        }
+    }
+
+    if (!SyncDirectory(fs::path(path).parent_path()))
+    {
+        std::cerr << "TagStore: failed to sync the directory of " << path << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "TagSet.h"
+
+/**
+ * TagStore
+ * ---------
+ * Append-only write-ahead log for tag mutations (tags.wal).
+ *
+ * tags.json is the snapshot; the log holds every mutation made since that
+ * snapshot was written. Startup = load snapshot + Replay(log).
+ * Compaction = write a fresh snapshot, then Reset() the log.
+ *
+ * Record layout (little-endian):
+ *   u8 type | u32 payloadLength | payload | u32 checksum(type + payload)
+ * payload = u32 tagId [| u32 textLength | text]
+ *
+ * A torn or corrupt tail (crash mid-append) ends replay and is truncated on Open().
+ * Every record is idempotent, so replaying a log already folded into the snapshot is harmless;
+ * history events are numbered, and those tags.history already holds are skipped.
+ */
+class TagStore
+{
+public:
+    enum class RecordType : uint8_t
+    {
+        CreateTag = 1,      // tag, text = name
+        DeleteTag = 2,      // tag
+        SetDestination = 3, // tag, text = destination
+        Assign = 4,         // tag, text = file path
+        Unassign = 5,       // tag, text = file path
+        UnassignAll = 6,    // text = file path (tag unused)
+        SetFingerprint = 7, // text = file path '\0' u64 size | u64 sample | u64 full (tag unused)
+        RenameTag = 8,      // tag, text = new full name
+        SetOrganize = 9,    // tag, text = organize mode name, empty = inherit
+        StepAssign = 10,    // Assign that is part of an undo step
+        StepUnassign = 11,  // Unassign that is part of an undo step
+        StepEnd = 12,       // text = history event: the step the Step* records before it belong to
+        Undo = 13,          // text = history event: the newest undo step moved to the redo stack
+        Redo = 14,          // text = history event: the newest redo step moved back
+        AssignMany = 15,    // tag, text = file paths separated by '\0'
+        UnassignMany = 16   // tag, text = file paths separated by '\0'
+    };
+
+    struct Record
+    {
+        RecordType type;
+        TagId tag = INVALID_TAG_ID;
+        std::string text;
+    };
+
+    explicit TagStore(std::string logPath);
+    ~TagStore();
+
+    /**
+     * Feed every valid record of the existing log to apply(), in order.
+     * Call before Open(). A missing log is not an error.
+     */
+    bool Replay(const std::function<void(const Record &)> &apply);
+
+    /**
+     * Open the log for appending (creates it, drops any torn tail found by Replay).
+     * Replays into a no-op first if Replay() was not called, so valid records are never lost.
+     */
+    bool Open();
+
+    /**
+     * Buffer a record in memory. Nothing reaches disk until Commit().
+     */
+    void Append(const Record &record);
+
+    /**
+     * Group commit: write everything appended so far with one write + one fsync.
+     * Concurrent callers whose records are covered by an in-flight flush just wait for it.
+     */
+    bool Commit();
+
+    /**
+     * Position of the next record to Append(); pass to Discard() to take back what an
+     * operation appended when its Commit() failed.
+     */
+    uint64_t Mark() const;
+
+    /**
+     * Drop every record appended after mark that is not on disk yet.
+     */
+    void Discard(uint64_t mark);
+
+    /**
+     * Truncate the log after its contents were folded into a snapshot.
+     */
+    bool Reset();
+
+    uint64_t LogBytes() const;
+
+    /**
+     * Replace the file at path with contents atomically and durably: write a temp file,
+     * fsync it, rename it over path, then fsync the directory. Only after this returns true
+     * may the log that the snapshot supersedes be Reset().
+     */
+    static bool WriteSnapshot(const std::string &path, const std::string &contents);
+
+private:
+    std::string m_logPath;
+    int m_fd = -1;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_flushed;
+    std::vector<uint8_t> m_buffer; // appended, not yet written
+    uint64_t m_appendedLsn = 0;    // LSN = bytes appended since Open()
+    uint64_t m_durableLsn = 0;
+    bool m_flushing = false;
+    uint64_t m_logBytes = 0;  // bytes on disk
+    uint64_t m_validBytes = 0; // end of last good record seen by Replay()
+    bool m_replayed = false;
+};
@@ -0,0 +1,140 @@
+// XattrTagStore.cpp
+#include "XattrTagStore.h"
+
+#include <cerrno>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/types.h>
+#include <sys/xattr.h>
+#define FOLDERSORT_HAS_XATTR 1
+#endif
+
+#if defined(__APPLE__)
+#define FOLDERSORT_ENOATTR ENOATTR
+#elif defined(__linux__)
+#define FOLDERSORT_ENOATTR ENODATA
+#endif
+
+#if defined(FOLDERSORT_HAS_XATTR)
+namespace
+{
+    constexpr uint8_t VALUE_VERSION = 1;
+
+    // Fits a version byte plus 15 tags; larger values fall back to a sized read
+    constexpr size_t INLINE_READ_SIZE = 64;
+
+    ssize_t GetAttr(const char *path, void *buffer, size_t size)
+    {
+#if defined(__APPLE__)
+        return ::getxattr(path, XattrTagStore::ATTRIBUTE_NAME, buffer, size, 0, 0);
+#else
+        return ::getxattr(path, XattrTagStore::ATTRIBUTE_NAME, buffer, size);
+#endif
+    }
+
+    int SetAttr(const char *path, const void *value, size_t size)
+    {
+#if defined(__APPLE__)
+        return ::setxattr(path, XattrTagStore::ATTRIBUTE_NAME, value, size, 0, 0);
+#else
+        return ::setxattr(path, XattrTagStore::ATTRIBUTE_NAME, value, size, 0);
+#endif
+    }
+
+    int RemoveAttr(const char *path)
+    {
+#if defined(__APPLE__)
+        return ::removexattr(path, XattrTagStore::ATTRIBUTE_NAME, 0);
+#else
+        return ::removexattr(path, XattrTagStore::ATTRIBUTE_NAME);
+#endif
+    }
+
+    bool Decode(const uint8_t *data, size_t size, TagSet &outTags)
+    {
+        outTags.Clear();
+        if (size == 0)
+            return true;
+        if (data[0] != VALUE_VERSION || (size - 1) % 4 != 0)
+            return false;
+
+        for (size_t pos = 1; pos < size; pos += 4)
+        {
+            const TagId id = TagId(data[pos]) | (TagId(data[pos + 1]) << 8) |
+                             (TagId(data[pos + 2]) << 16) | (TagId(data[pos + 3]) << 24);
+            outTags.Insert(id);
+        }
+        return true;
+    }
+}
+#endif
+
+bool XattrTagStore::IsSupported()
+{
+#if defined(FOLDERSORT_HAS_XATTR)
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool XattrTagStore::Read(const std::filesystem::path &path, TagSet &outTags)
+{
+    outTags.Clear();
+#if defined(FOLDERSORT_HAS_XATTR)
+    const std::string native = path.string();
+
+    // Common case: one syscall into a stack buffer
+    uint8_t inlineBuffer[INLINE_READ_SIZE];
+    ssize_t n = GetAttr(native.c_str(), inlineBuffer, sizeof(inlineBuffer));
+    if (n >= 0)
+        return Decode(inlineBuffer, static_cast<size_t>(n), outTags);
+    if (errno == FOLDERSORT_ENOATTR)
+        return true;
+    if (errno != ERANGE)
+        return false;
+
+    // Larger than the stack buffer: ask for the size, then read (retry if it grew meanwhile)
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        n = GetAttr(native.c_str(), nullptr, 0);
+        if (n < 0)
+            return errno == FOLDERSORT_ENOATTR;
+
+        std::vector<uint8_t> buffer(static_cast<size_t>(n));
+        n = GetAttr(native.c_str(), buffer.data(), buffer.size());
+        if (n >= 0)
+            return Decode(buffer.data(), static_cast<size_t>(n), outTags);
+        if (errno != ERANGE)
+            return errno == FOLDERSORT_ENOATTR;
+    }
+    return false;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+bool XattrTagStore::Write(const std::filesystem::path &path, const TagSet &tags)
+{
+#if defined(FOLDERSORT_HAS_XATTR)
+    const std::string native = path.string();
+    if (tags.Empty())
+        return RemoveAttr(native.c_str()) == 0 || errno == FOLDERSORT_ENOATTR;
+
+    std::vector<uint8_t> value;
+    value.reserve(1 + 4 * tags.Size());
+    value.push_back(VALUE_VERSION);
+    for (TagId id : tags)
+    {
+        for (int i = 0; i < 4; ++i)
+            value.push_back(static_cast<uint8_t>(id >> (8 * i)));
+    }
+    return SetAttr(native.c_str(), value.data(), value.size()) == 0;
+#else
+    (void)path;
+    (void)tags;
+    return false;
+#endif
+}
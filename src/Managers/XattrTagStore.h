@@ -0,0 +1,37 @@
+#pragma once
+
+#include <filesystem>
+
+#include "TagSet.h"
+
+/**
+ * XattrTagStore
+ * --------------
+ * Optional per-file tag storage in an extended attribute (user.foldersort.tags).
+ *
+ * The attribute travels with the inode, so tags survive renames and moves made
+ * by other tools on the same filesystem. Only tag IDs are stored; IDs are never
+ * reused (see TagManager), so an ID whose tag was deleted is simply ignored.
+ *
+ * Value layout: u8 version | u32 tagId... (little-endian, ascending)
+ *
+ * Supported on Linux and macOS; elsewhere every call fails and IsSupported() is false.
+ */
+class XattrTagStore
+{
+public:
+    static constexpr const char *ATTRIBUTE_NAME = "user.foldersort.tags";
+
+    static bool IsSupported();
+
+    /**
+     * Read the tags stored on a file. A file without the attribute yields an empty set.
+     * Returns false on I/O errors, unsupported filesystems or a malformed value.
+     */
+    static bool Read(const std::filesystem::path &path, TagSet &outTags);
+
+    /**
+     * Store tags on a file. An empty set removes the attribute.
+     */
+    static bool Write(const std::filesystem::path &path, const TagSet &tags);
+};
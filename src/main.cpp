@@ -6,6 +6,9 @@
 #include <fstream>
 #include "../include/json/json.hpp"
 #include <filesystem>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
 
 #include "Managers/SearchManager.h"
 #include "Managers/TagManager.h"
@@ -14,9 +17,9 @@
 namespace fs = std::filesystem;
 
 // Forward declarations
-void DrawTagPanel(TagManager &tagManager, std::string &selectedTag, std::string &destinationEdit);
+void DrawTagPanel(TagManager &tagManager, const TagSnapshot &tagView, std::string &selectedTag, std::string &destinationEdit);
 void DrawFilePanel(SearchManager &searchManager, TagManager &tagManager, FileManager &fileManager, const std::string &selectedTag);
-void DrawTopMenu(SearchManager &searchManager, std::string &currentDir);
+void DrawTopMenu(SearchManager &searchManager, TagManager &tagManager, std::string &currentDir);
 
 // -------------------------------------------------------------
 
@@ -48,6 +51,13 @@ int main()
 
     // Preload current directory
     searchManager.LoadMetaData(currentDir, SearchMode::TOP_LEVEL);
+    tagManager.SyncWithIndex();
+
+    // The tag panel draws from a cached snapshot, refetched only after TagManager publishes a change
+    std::atomic<bool> tagsChanged{true};
+    const size_t tagSubscription = tagManager.Subscribe([&tagsChanged](const TagSnapshotPtr &)
+                                                        { tagsChanged = true; });
+    TagSnapshotPtr tagView;
 
     while (!glfwWindowShouldClose(window))
     {
@@ -56,11 +66,18 @@ int main()
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
 
+        // Moves the background jobs finished since the last frame: the index and the tags
+        // follow them without a rescan
+        fileManager.PublishMoves();
+
+        if (tagsChanged.exchange(false))
+            tagView = tagManager.GetTagMap();
+
         ImGui::Begin("FolderSort Tool", nullptr, ImGuiWindowFlags_MenuBar | ImGuiWindowFlags_NoCollapse);
-        DrawTopMenu(searchManager, currentDir);
+        DrawTopMenu(searchManager, tagManager, currentDir);
         ImGui::Separator();
         ImGui::Columns(2);
-        DrawTagPanel(tagManager, selectedTag, destinationEdit);
+        DrawTagPanel(tagManager, *tagView, selectedTag, destinationEdit);
         ImGui::NextColumn();
         DrawFilePanel(searchManager, tagManager, fileManager, selectedTag);
         ImGui::Columns(1);
@@ -76,6 +93,11 @@ int main()
         glfwSwapBuffers(window);
     }
 
+    // Running moves finish before exit (the executor drains them anyway); their tags follow
+    fileManager.GetMoveExecutor().WaitAll();
+    fileManager.PublishMoves();
+    tagManager.Unsubscribe(tagSubscription);
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -86,7 +108,7 @@ int main()
 
 // -------------------------------------------------------------
 // Menu: Load Directory
-void DrawTopMenu(SearchManager &searchManager, std::string &currentDir)
+void DrawTopMenu(SearchManager &searchManager, TagManager &tagManager, std::string &currentDir)
 {
     if (ImGui::Button("Load Directory"))
     {
@@ -104,43 +126,82 @@ void DrawTopMenu(SearchManager &searchManager, std::string &currentDir)
             {
                 currentDir = dirPath;
                 searchManager.LoadMetaData(currentDir, SearchMode::TOP_LEVEL);
+                tagManager.SyncWithIndex();
             }
             ImGui::CloseCurrentPopup();
         }
         ImGui::EndPopup();
     }
 
+    ImGui::SameLine();
+    if (ImGui::Button("Refresh"))
+    {
+        // Re-stat the directory and auto-tag only what changed
+        if (searchManager.Refresh())
+        {
+            tagManager.SyncWithIndex();
+            tagManager.ApplyRulesToRefreshDelta();
+        }
+    }
+
+    // Tags stored on the files themselves (xattr backend)
+    ImGui::SameLine();
+    bool xattrBackend = tagManager.IsXattrBackendEnabled();
+    if (ImGui::Checkbox("Store Tags On Files", &xattrBackend))
+    {
+        if (tagManager.SetXattrBackend(xattrBackend) && xattrBackend)
+            tagManager.ExportXattrTags();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Import File Tags"))
+        tagManager.ImportXattrTags();
+
+    // Re-attach tags to files moved by other tools, by content
+    ImGui::SameLine();
+    bool fingerprints = tagManager.IsContentFingerprintsEnabled();
+    if (ImGui::Checkbox("Track Moved Files", &fingerprints))
+        tagManager.SetContentFingerprints(fingerprints);
+
+    // Undo / redo of tag assignments
+    ImGui::SameLine();
+    const std::string undoLabel = tagManager.GetUndoLabel();
+    if (ImGui::Button("Undo") && !undoLabel.empty())
+        tagManager.Undo();
+    if (ImGui::IsItemHovered() && !undoLabel.empty())
+        ImGui::SetTooltip("Undo %s", undoLabel.c_str());
+    ImGui::SameLine();
+    const std::string redoLabel = tagManager.GetRedoLabel();
+    if (ImGui::Button("Redo") && !redoLabel.empty())
+        tagManager.Redo();
+    if (ImGui::IsItemHovered() && !redoLabel.empty())
+        ImGui::SetTooltip("Redo %s", redoLabel.c_str());
+
     ImGui::SameLine();
     ImGui::Text("Current Directory: %s", currentDir.c_str());
 }
 
 // -------------------------------------------------------------
 // Tag panel with editable destination
-void DrawTagPanel(TagManager &tagManager, std::string &selectedTag, std::string &destinationEdit)
+void DrawTagPanel(TagManager &tagManager, const TagSnapshot &tagView, std::string &selectedTag, std::string &destinationEdit)
 {
     ImGui::BeginChild("TagPanel", ImVec2(300, 0), true);
     ImGui::Text("Tags:");
     ImGui::Separator();
 
-    const auto &tagMap = tagManager.GetTagMap();
-    for (const auto &[tag, _] : tagMap)
+    // Summary rows straight from the snapshot (sorted by name): nothing is rebuilt per frame
+    for (const auto &entry : tagView.tags)
     {
+        const std::string &tag = entry.name;
         bool isSelected = (selectedTag == tag);
-        if (ImGui::Selectable(tag.c_str(), isSelected))
+        const std::string label = tag + " (" + std::to_string(entry.count) + ")##" + tag;
+        if (ImGui::Selectable(label.c_str(), isSelected))
         {
             selectedTag = tag;
-            // Load current destination from JSON or memory
-            destinationEdit.clear();
-            std::ifstream ifs("tags.json");
-            nlohmann::json j;
-            if (ifs.is_open())
-            {
-                ifs >> j;
-                ifs.close();
-                if (j.contains("tags") && j["tags"].contains(tag))
-                    destinationEdit = j["tags"][tag]["destination"].get<std::string>();
-            }
+            // Load current destination from memory (tags.json may lag behind tags.wal)
+            destinationEdit = tagManager.GetDestinationTemplate(tag);
         }
+        if (ImGui::IsItemHovered() && !entry.destination.empty())
+            ImGui::SetTooltip("%s", entry.destination.c_str());
     }
 
     static char newTagName[128] = {};
@@ -161,11 +222,28 @@ void DrawTagPanel(TagManager &tagManager, std::string &selectedTag, std::string
         strcpy(destBuf, destinationEdit.c_str());
         if (ImGui::InputText("##dest", destBuf, IM_ARRAYSIZE(destBuf)))
             destinationEdit = destBuf;
+        // Empty inherits from the parent tag; {parent}, {name} and {tag} are expanded
+        const TagSnapshot::Tag *selected = tagView.FindNormalized(selectedTag); // a snapshot name
+        ImGui::TextWrapped("Resolves to: %s", selected ? selected->destination.c_str() : "");
 
         if (ImGui::Button("Update Destination"))
+            tagManager.SetDestination(selectedTag, destinationEdit);
+
+        // Own or inherited organize mode; "job default" follows the mode chosen when moving
+        static const char *organizeItems[] = {"job default", "move", "mirror", "copy", "reflink", "hardlink", "symlink"};
+        int organize = (selected && selected->organize) ? static_cast<int>(*selected->organize) + 1 : 0;
+        if (ImGui::Combo("Organize", &organize, organizeItems, IM_ARRAYSIZE(organizeItems)))
+        {
+            tagManager.SetOrganizeMode(selectedTag, organize == 0 ? std::nullopt
+                                                                  : std::optional<OrganizeMode>(static_cast<OrganizeMode>(organize - 1)));
+        }
+
+        static char renameBuf[128] = {};
+        if (ImGui::InputText("Rename To", renameBuf, IM_ARRAYSIZE(renameBuf), ImGuiInputTextFlags_EnterReturnsTrue))
         {
-            if (!destinationEdit.empty())
-                tagManager.SetDestination(selectedTag, destinationEdit);
+            if (tagManager.RenameTag(selectedTag, renameBuf))
+                selectedTag = TagManager::NormalizeTag(renameBuf);
+            renameBuf[0] = 0;
         }
 
         if (ImGui::Button("Delete Tag"))
@@ -188,6 +266,30 @@ void DrawFilePanel(SearchManager &searchManager, TagManager &tagManager, FileMan
     ImGui::Text("Files in Current Directory");
     ImGui::Separator();
 
+    // Tag query filter, e.g. (photo OR scan) AND NOT archived
+    static char queryBuf[256] = {};
+    static std::string queryError;
+    static FileBitmap queryMatches;
+    static bool queryActive = false;
+    if (ImGui::InputText("Query", queryBuf, IM_ARRAYSIZE(queryBuf), ImGuiInputTextFlags_EnterReturnsTrue) ||
+        ImGui::Button("Run Query"))
+    {
+        queryError.clear();
+        queryActive = queryBuf[0] != '\0' && tagManager.SelectFiles(queryBuf, queryMatches, queryError);
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear Query"))
+    {
+        queryBuf[0] = '\0';
+        queryError.clear();
+        queryActive = false;
+    }
+    if (!queryError.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Query error: %s", queryError.c_str());
+    else if (queryActive)
+        ImGui::Text("%zu matching files", queryMatches.Count());
+    ImGui::Separator();
+
     ImGui::Columns(3);
     ImGui::Text("ID");
     ImGui::NextColumn();
@@ -199,6 +301,8 @@ void DrawFilePanel(SearchManager &searchManager, TagManager &tagManager, FileMan
 
     for (const auto &file : files)
     {
+        if (queryActive && !queryMatches.Test(static_cast<size_t>(file.fileID)))
+            continue;
         ImGui::Text("%d", file.fileID);
         ImGui::NextColumn();
         ImGui::Text("%s", file.name.c_str());
@@ -212,15 +316,147 @@ void DrawFilePanel(SearchManager &searchManager, TagManager &tagManager, FileMan
 
     if (ImGui::Button("Assign Selected Tag to All Files") && !selectedTag.empty())
     {
+        // Selections are keyed by stable file ID; an active query narrows "all" to its matches
+        FileBitmap selection;
         for (const auto &file : files)
-            tagManager.AssignTag(file.path, selectedTag);
+        {
+            if (!queryActive || queryMatches.Test(static_cast<size_t>(file.fileID)))
+                selection.Set(file.fileID);
+        }
+        TagBulkResult result = tagManager.AssignTagBulk(selection, selectedTag);
+        for (const auto &failure : result.failures)
+            std::cerr << "Assign failed for file " << failure.fileIndex << ": " << failure.reason << "\n";
+    }
+
+    if (ImGui::Button("Apply Auto-Tag Rules"))
+        tagManager.ApplyRules();
+
+    // Moves run in the background; their jobs are polled below every frame
+    static std::vector<MoveJobPtr> moveJobs;
+
+    // Mode for tags without their own: move, or organize and leave the sources alone
+    static int jobMode = 0;
+    static const char *jobModeItems[] = {"move", "mirror", "copy", "reflink", "hardlink", "symlink"};
+    ImGui::Combo("Organize Mode", &jobMode, jobModeItems, IM_ARRAYSIZE(jobModeItems));
+    const OrganizeMode mode = static_cast<OrganizeMode>(jobMode);
+
+    // Same name and same content already at the destination
+    static const char *duplicateItems[] = {"keep both", "skip", "delete source", "hard link source"};
+    int duplicates = static_cast<int>(fileManager.GetDuplicatePolicy());
+    if (ImGui::Combo("Duplicates", &duplicates, duplicateItems, IM_ARRAYSIZE(duplicateItems)))
+        fileManager.SetDuplicatePolicy(static_cast<DuplicatePolicy>(duplicates));
+
+    // Batched: every touched directory is fsynced once when the job commits
+    static const char *durabilityItems[] = {"default", "batched directory sync", "batched, syncfs for many directories"};
+    int durability = static_cast<int>(fileManager.GetDurability());
+    if (ImGui::Combo("Durability", &durability, durabilityItems, IM_ARRAYSIZE(durabilityItems)))
+        fileManager.SetDurability(static_cast<Durability>(durability));
+
+    // Dry run: the plan "Move All Tagged Files" would execute, kept until run or discarded
+    static MovePlan preview;
+    static std::string previewText;
+    if (ImGui::Button("Preview Move (Dry Run)"))
+    {
+        preview = fileManager.PlanAllTaggedFiles(mode);
+        previewText = preview.Describe();
+    }
+    if (!previewText.empty())
+    {
+        ImGui::BeginChild("MovePreview", ImVec2(0, 150), true, ImGuiWindowFlags_HorizontalScrollbar);
+        ImGui::TextUnformatted(previewText.c_str());
+        ImGui::EndChild();
+        if (ImGui::Button("Execute Plan"))
+        {
+            moveJobs.push_back(fileManager.ExecutePlan(preview));
+            preview = MovePlan();
+            previewText.clear();
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Discard Plan"))
+        {
+            preview = MovePlan();
+            previewText.clear();
+        }
     }
 
     if (ImGui::Button("Move All Tagged Files"))
-        fileManager.MoveAllTaggedFiles();
+        moveJobs.push_back(fileManager.MoveAllTaggedFiles(mode));
 
     if (ImGui::Button("Move Selected Tag Files") && !selectedTag.empty())
-        fileManager.MoveFilesByTag(selectedTag);
+        moveJobs.push_back(fileManager.MoveFilesByTag(selectedTag, mode));
+
+    if (queryActive && ImGui::Button("Move Query Matches to Selected Tag") && !selectedTag.empty())
+    {
+        moveJobs.push_back(fileManager.MoveFiles(queryMatches, tagManager.GetDestination(selectedTag), mode));
+        queryActive = false;
+    }
+
+    // Throttling for shared storage; applies to running moves as well
+    MoveExecutor &executor = fileManager.GetMoveExecutor();
+    IoLimits limits = executor.GetDefaultIoLimits();
+    int mibPerSecond = static_cast<int>(limits.bytesPerSecond >> 20);
+    int filesPerSecond = static_cast<int>(limits.operationsPerSecond);
+    ImGui::SetNextItemWidth(100);
+    bool limitsChanged = ImGui::InputInt("MiB/s (0 = no limit)", &mibPerSecond);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100);
+    limitsChanged |= ImGui::InputInt("files/s", &filesPerSecond);
+    if (limitsChanged)
+    {
+        limits.bytesPerSecond = static_cast<uint64_t>(std::max(0, mibPerSecond)) << 20;
+        limits.operationsPerSecond = static_cast<uint64_t>(std::max(0, filesPerSecond));
+        executor.SetDefaultIoLimits(limits);
+    }
+    ImGui::SameLine();
+    bool idle = executor.GetIdlePriority();
+    if (ImGui::Checkbox("Idle I/O", &idle))
+        executor.SetIdlePriority(idle);
+
+    for (size_t i = 0; i < moveJobs.size();)
+    {
+        const MoveJob::Progress progress = moveJobs[i]->GetProgress();
+        char overlay[192];
+        if (progress.state == MoveJob::State::Running)
+        {
+            const std::string eta = progress.etaSeconds < 0 ? "-" : std::to_string(static_cast<long>(progress.etaSeconds)) + " s";
+            std::snprintf(overlay, sizeof(overlay), "%zu / %zu files, %.1f MiB/s, ETA %s",
+                          progress.files + progress.failed, progress.totalFiles, progress.bytesPerSecond / (1024.0 * 1024.0),
+                          eta.c_str());
+        }
+        else
+        {
+            const int written = std::snprintf(overlay, sizeof(overlay), "%s: %zu moved, %zu not moved, %zu duplicates (%.1f MiB saved)",
+                                              progress.state == MoveJob::State::Cancelled ? "Cancelled" : "Done", progress.files,
+                                              progress.failed, progress.duplicates,
+                                              static_cast<double>(progress.savedBytes) / (1024.0 * 1024.0));
+            if (progress.syncedDirectories + progress.syncedFilesystems > 0 && written > 0 &&
+                static_cast<size_t>(written) < sizeof(overlay))
+            {
+                std::snprintf(overlay + written, sizeof(overlay) - written, ", %zu directory syncs in %.0f ms",
+                              progress.syncedDirectories + progress.syncedFilesystems, progress.syncSeconds * 1000.0);
+            }
+        }
+
+        ImGui::PushID(static_cast<int>(i));
+        ImGui::ProgressBar(static_cast<float>(progress.Fraction()), ImVec2(-120, 0), overlay);
+        ImGui::SameLine();
+        bool dismiss = false;
+        if (progress.state == MoveJob::State::Running)
+        {
+            if (moveJobs[i]->IsCancelRequested())
+                ImGui::TextDisabled("Cancelling");
+            else if (ImGui::Button("Cancel"))
+                moveJobs[i]->Cancel();
+        }
+        else
+            dismiss = ImGui::Button("Dismiss");
+        ImGui::PopID();
+
+        if (dismiss)
+            moveJobs.erase(moveJobs.begin() + static_cast<std::ptrdiff_t>(i));
+        else
+            ++i;
+    }
 
     ImGui::EndChild();
 }
@@ -0,0 +1,311 @@
+// MoveJournalRecoveryTest.cpp
+// Crash / recovery check for MoveJournal: batches are interrupted at chosen points (a
+// child process that exits mid-batch, or a journal left exactly as a crash would leave
+// it) and Recover() must bring every file back to one consistent place.
+#include "Managers/FileCopier.h"
+#include "Managers/MoveExecutor.h"
+#include "Managers/MoveJournal.h"
+#include "Managers/MovePlanner.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    int g_failures = 0;
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": failed: " #condition "\n"; \
+            ++g_failures;                                                             \
+        }                                                                             \
+    } while (0)
+
+    fs::path g_root;
+
+    fs::path Fresh(const std::string &name)
+    {
+        const fs::path dir = g_root / name;
+        fs::remove_all(dir);
+        fs::create_directories(dir / "src");
+        fs::create_directories(dir / "dst");
+        return dir;
+    }
+
+    void WriteFile(const fs::path &path, const std::string &content)
+    {
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    std::string ReadFile(const fs::path &path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    }
+
+    MoveOperation Operation(const fs::path &source, const fs::path &destination, MoveStrategy strategy)
+    {
+        MoveOperation op;
+        op.source = source;
+        op.destination = destination;
+        op.strategy = strategy;
+        return op;
+    }
+
+    MoveJournal::RecoveryReport Recover(const fs::path &journal, MoveJournal::Recovery mode)
+    {
+        MoveJournal::RecoveryReport report;
+        MoveJournal recovering(journal.string());
+        CHECK(recovering.Recover(mode, report));
+        return report;
+    }
+
+    // A rename that hit EXDEV and fell back to copy + unlink, interrupted after the copy was
+    // renamed into place but before the source was unlinked
+    void CrashAfterRenameFallback(MoveJournal::Recovery mode)
+    {
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "exdev_forward" : "exdev_back");
+        const fs::path journal = dir / "moves.journal";
+        const fs::path source = dir / "src" / "a.bin";
+        const fs::path destination = dir / "dst" / "a.bin";
+        WriteFile(source, std::string(100000, 'a'));
+        {
+            MoveJournal writer(journal.string());
+            CHECK(writer.Open());
+            const uint64_t batch = writer.BeginBatch({Operation(source, destination, MoveStrategy::Rename)});
+            CHECK(batch != 0);
+            CHECK(writer.Fallback(batch, 0, MoveStrategy::CopyAndUnlink));
+            FileCopier::Result copy;
+            std::string error;
+            CHECK(FileCopier::Place(source, destination, copy, error));
+        } // "crash": the batch is never ended
+
+        const MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.repaired == 1 && report.problems.empty());
+        const fs::path kept = mode == MoveJournal::Recovery::RollForward ? destination : source;
+        const fs::path gone = mode == MoveJournal::Recovery::RollForward ? source : destination;
+        CHECK(fs::exists(kept) && !fs::exists(gone));
+        CHECK(ReadFile(kept) == std::string(100000, 'a'));
+    }
+
+    // A mirror whose hard link was refused and that copied instead, interrupted after the copy
+    void CrashAfterMirrorFallback(MoveJournal::Recovery mode)
+    {
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "mirror_forward" : "mirror_back");
+        const fs::path journal = dir / "moves.journal";
+        const fs::path source = dir / "src" / "m.txt";
+        const fs::path destination = dir / "dst" / "m.txt";
+        WriteFile(source, "mirrored");
+        {
+            MoveJournal writer(journal.string());
+            CHECK(writer.Open());
+            const uint64_t batch = writer.BeginBatch({Operation(source, destination, MoveStrategy::Hardlink)});
+            CHECK(batch != 0);
+            CHECK(writer.Fallback(batch, 0, MoveStrategy::Copy));
+            if (mode == MoveJournal::Recovery::RollBack)
+            {
+                FileCopier::Result copy;
+                std::string error;
+                CHECK(FileCopier::Place(source, destination, copy, error));
+            }
+        }
+
+        const MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.repaired == 1 && report.problems.empty());
+        CHECK(fs::exists(source) && ReadFile(source) == "mirrored");
+        if (mode == MoveJournal::Recovery::RollForward)
+        {
+            // Redone as the copy that ran, not as the planned link
+            CHECK(ReadFile(destination) == "mirrored");
+            std::error_code ec;
+            CHECK(!fs::equivalent(source, destination, ec));
+        }
+        else
+            CHECK(!fs::exists(destination));
+    }
+
+    // An operation reported failed (a cancelled one, say) left its source alone: neither
+    // direction redoes it
+    void FailedOperationStays(MoveJournal::Recovery mode)
+    {
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "failed_forward" : "failed_back");
+        const fs::path journal = dir / "moves.journal";
+        const fs::path source = dir / "src" / "f.txt";
+        const fs::path destination = dir / "dst" / "f.txt";
+        WriteFile(source, "stays");
+        {
+            MoveJournal writer(journal.string());
+            CHECK(writer.Open());
+            const uint64_t batch = writer.BeginBatch({Operation(source, destination, MoveStrategy::Rename)});
+            CHECK(batch != 0);
+            writer.MarkDone(batch, 0, false);
+        } // the marker is flushed on close: a crash right after it
+
+        const MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.intact == 1 && report.repaired == 0 && report.problems.empty());
+        CHECK(fs::exists(source) && !fs::exists(destination));
+    }
+
+    // A cancelled batch whose markers were lost: one operation ran, one was copying (a staged
+    // partial file), one never started. Forward keeps what ran and starts nothing new
+    void CrashAfterCancel(MoveJournal::Recovery mode)
+    {
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "cancel_forward" : "cancel_back");
+        const fs::path journal = dir / "moves.journal";
+        std::vector<MoveOperation> operations;
+        for (const char *name : {"ran", "copying", "waiting"})
+        {
+            WriteFile(dir / "src" / name, name);
+            operations.push_back(Operation(dir / "src" / name, dir / "dst" / name,
+                                           name[0] == 'c' ? MoveStrategy::Copy : MoveStrategy::Rename));
+        }
+        {
+            MoveJournal writer(journal.string());
+            CHECK(writer.Open());
+            const uint64_t batch = writer.BeginBatch(operations);
+            CHECK(batch != 0);
+            fs::rename(operations[0].source, operations[0].destination);
+            WriteFile(FileCopier::TemporaryPath(operations[1].destination), "cop");
+            CHECK(writer.Cancel(batch));
+        }
+
+        const MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.problems.empty());
+        const bool forward = mode == MoveJournal::Recovery::RollForward;
+        CHECK(report.repaired == (forward ? 0u : 1u));
+        CHECK(fs::exists(operations[0].destination) == forward && fs::exists(operations[0].source) == !forward);
+        for (size_t i = 1; i < operations.size(); ++i)
+            CHECK(fs::exists(operations[i].source) && !fs::exists(operations[i].destination));
+        CHECK(!fs::exists(FileCopier::TemporaryPath(operations[1].destination)));
+    }
+
+    // An operation recovery cannot settle (both paths hold different files) stays journaled,
+    // through a session that opens the journal and runs a batch of its own, until it can be
+    void KeepsUnresolved(MoveJournal::Recovery mode)
+    {
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "kept_forward" : "kept_back");
+        const fs::path journal = dir / "moves.journal";
+        const fs::path source = dir / "src" / "k.txt";
+        const fs::path destination = dir / "dst" / "k.txt";
+        WriteFile(source, "mine");
+        WriteFile(destination, "theirs");
+        {
+            MoveJournal writer(journal.string());
+            CHECK(writer.Open());
+            CHECK(writer.BeginBatch({Operation(source, destination, MoveStrategy::Rename)}) != 0);
+        }
+
+        MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.problems.size() == 1);
+        {
+            MoveJournal next(journal.string());
+            MoveJournal::RecoveryReport again;
+            CHECK(next.Recover(mode, again) && again.problems.size() == 1);
+            CHECK(next.Open());
+            const fs::path other = dir / "src" / "other.txt";
+            WriteFile(other, "other");
+            const uint64_t batch = next.BeginBatch({Operation(other, dir / "dst" / "other.txt", MoveStrategy::Rename)});
+            CHECK(batch != 0);
+            next.MarkDone(batch, 0, false);
+            CHECK(next.EndBatch(batch));
+        }
+
+        report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.problems.size() == 1);
+        fs::remove(destination);
+        report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.problems.empty() && !fs::exists(journal));
+        CHECK(fs::exists(mode == MoveJournal::Recovery::RollForward ? destination : source));
+    }
+
+#if !defined(_WIN32)
+    // A real batch run by MoveExecutor in a child process that dies after `survivors` files
+    void CrashMidBatch(MoveJournal::Recovery mode)
+    {
+        constexpr int FILES = 40;
+        const fs::path dir = Fresh(mode == MoveJournal::Recovery::RollForward ? "kill_forward" : "kill_back");
+        const fs::path journal = dir / "moves.journal";
+        std::vector<MoveRequest> requests;
+        for (int i = 0; i < FILES; ++i)
+        {
+            const fs::path source = dir / "src" / ("f" + std::to_string(i));
+            WriteFile(source, std::to_string(i));
+            requests.push_back({static_cast<size_t>(i), source, dir / "dst"});
+        }
+        const MovePlan plan = MovePlanner::Plan(requests);
+        CHECK(plan.operations.size() == FILES);
+
+        const pid_t child = ::fork();
+        if (child == 0)
+        {
+            MoveJournal writer(journal.string());
+            if (!writer.Open())
+                ::_exit(2);
+            const uint64_t batch = writer.BeginBatch(plan.operations);
+            if (batch == 0)
+                ::_exit(2);
+            MoveExecutor executor(2);
+            MoveExecutor::Callbacks callbacks;
+            int completed = 0;
+            callbacks.onComplete = [&](const MoveResult &result)
+            {
+                writer.MarkDone(batch, result.index, result.ok);
+                if (++completed == FILES / 3)
+                    ::_exit(0); // no flush, no end record: as a crash leaves it
+            };
+            executor.Wait(executor.Submit(plan.operations, std::move(callbacks)));
+            ::_exit(3);
+        }
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+        const MoveJournal::RecoveryReport report = Recover(journal, mode);
+        CHECK(report.batches == 1 && report.problems.empty());
+        for (int i = 0; i < FILES; ++i)
+        {
+            const std::string name = "f" + std::to_string(i);
+            const fs::path kept = dir / (mode == MoveJournal::Recovery::RollForward ? "dst" : "src") / name;
+            const fs::path gone = dir / (mode == MoveJournal::Recovery::RollForward ? "src" : "dst") / name;
+            CHECK(fs::exists(kept) && !fs::exists(gone));
+            CHECK(ReadFile(kept) == std::to_string(i));
+        }
+    }
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    g_root = argc > 1 ? fs::path(argv[1]) : fs::temp_directory_path() / "foldersort_recovery_test";
+    fs::remove_all(g_root);
+
+    for (MoveJournal::Recovery mode : {MoveJournal::Recovery::RollForward, MoveJournal::Recovery::RollBack})
+    {
+        CrashAfterRenameFallback(mode);
+        CrashAfterMirrorFallback(mode);
+        FailedOperationStays(mode);
+        CrashAfterCancel(mode);
+        KeepsUnresolved(mode);
+#if !defined(_WIN32)
+        CrashMidBatch(mode);
+#endif
+    }
+
+    if (g_failures == 0)
+        fs::remove_all(g_root);
+    std::cout << (g_failures == 0 ? "all recovery checks passed\n" : "recovery checks FAILED\n");
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,80 @@
+// TagQueryTest.cpp
+// TagQuery evaluation against small hand-built bitmaps, with NOT nested under AND / OR
+// (where a cardinality estimate that is not an upper bound stops an AND too early).
+#include "Managers/TagQuery.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int g_failures = 0;
+
+    constexpr size_t FILES = 4;
+
+    FileBitmap Bits(const std::vector<size_t> &ids)
+    {
+        FileBitmap bits(FILES);
+        for (size_t id : ids)
+            bits.Set(id);
+        return bits;
+    }
+
+    std::vector<size_t> Ids(const FileBitmap &bits)
+    {
+        std::vector<size_t> ids;
+        bits.ForEach([&](size_t id)
+                     { ids.push_back(id); });
+        return ids;
+    }
+
+    // universe = {0..3}; a = b = {0, 1}; c = {2, 3}; x = {}
+    void Expect(const std::string &text, const std::vector<size_t> &expected)
+    {
+        static const std::map<std::string, FileBitmap> tags = {
+            {"a", Bits({0, 1})}, {"b", Bits({0, 1})}, {"c", Bits({2, 3})}, {"x", Bits({})}};
+        FileBitmap universe(FILES);
+        universe.SetAll();
+
+        TagQuery query;
+        std::string error;
+        if (!query.Parse(text, error))
+        {
+            std::cerr << "parse failed: " << text << ": " << error << "\n";
+            ++g_failures;
+            return;
+        }
+        FileBitmap result;
+        const bool ok = query.Evaluate([](const std::string &tag, bool)
+                                       {
+            auto found = tags.find(tag);
+            return found == tags.end() ? nullptr : &found->second; },
+                                       universe, result, error);
+        if (!ok || Ids(result) != expected)
+        {
+            std::cerr << "failed: " << text << " gave";
+            for (size_t id : Ids(result))
+                std::cerr << " " << id;
+            std::cerr << (ok ? "" : " (" + error + ")") << "\n";
+            ++g_failures;
+        }
+    }
+}
+
+int main()
+{
+    Expect("c AND (NOT (a OR b) OR x)", {2, 3});
+    Expect("(NOT a OR x) AND c", {2, 3});
+    Expect("c AND NOT (a AND b)", {2, 3});
+    Expect("NOT (NOT c) AND c", {2, 3});
+    Expect("NOT a AND NOT c", {});
+    Expect("x OR NOT x", {0, 1, 2, 3});
+    Expect("a AND x", {});
+    Expect("(a OR c) AND NOT (b AND NOT x)", {2, 3});
+
+    std::cout << (g_failures == 0 ? "all query checks passed\n" : "query checks FAILED\n");
+    return g_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}